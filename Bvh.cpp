@@ -0,0 +1,1426 @@
+#include "Bvh.h"
+#include "BvhBuild.h"
+#include "BvhCacheFormat.h"
+#include "BvhWideKernels.h"
+#include "TrianglePacketKernels.h"
+
+#include "utils/CpuUtils.h"
+#include "utils/ProfileUtils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+using CpuUtils::IsaLevel;
+using CpuUtils::IsaTag;
+
+/// Names of the build modes, in the order of the enum
+static const char *bvhBuildModeNames[] = { "sweep", "binned", "lbvh", "sbvh" };
+
+/// Allocates an array aligned to the alignment of its type.
+/// The array is aligned by hand, as new[] doesn't align to more than 16 bytes before C++17.
+/// The values are default constructed and never destructed.
+/// @param[in] count Number of values in the array
+/// @param[out] memory The allocated memory, which holds the array and is freed with delete[]
+/// @return The array, at the first multiple of the alignment in the memory
+template <typename T>
+static T *allocateAligned(int count, char* &memory) {
+	static_assert(std::is_trivially_destructible<T>::value, "The values of the array are never destructed");
+	memory = new char[size_t(count) * sizeof(T) + alignof(T) - 1];
+	T *arr = reinterpret_cast<T *>(
+		(reinterpret_cast<uintptr_t>(memory) + alignof(T) - 1) / alignof(T) * alignof(T)
+	);
+	for (int i = 0; i < count; i++) {
+		new (arr + i) T();
+	}
+	return arr;
+}
+
+const char *getBvhBuildModeName(BvhBuildMode mode) {
+	return bvhBuildModeNames[int(mode)];
+}
+
+bool parseBvhBuildMode(const char *name, BvhBuildMode &mode) {
+	for (int i = 0; i < int(sizeof(bvhBuildModeNames) / sizeof(bvhBuildModeNames[0])); i++) {
+		if (strcmp(name, bvhBuildModeNames[i]) == 0) {
+			mode = BvhBuildMode(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+/// Names of the layouts, in the order of the enum
+static const char *bvhLayoutNames[] = { "binary", "wide" };
+
+const char *getBvhLayoutName(BvhLayout layout) {
+	return bvhLayoutNames[int(layout)];
+}
+
+bool parseBvhLayout(const char *name, BvhLayout &layout) {
+	for (int i = 0; i < int(sizeof(bvhLayoutNames) / sizeof(bvhLayoutNames[0])); i++) {
+		if (strcmp(name, bvhLayoutNames[i]) == 0) {
+			layout = BvhLayout(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+/// Range of the exponents of the wide nodes' cells, within which the cells and the corners are normal floats
+static const int minCellExponent = -126;
+static const int maxCellExponent = 120;
+
+/// Capacity of the traversal stack of the wide layout.
+/// Visiting a node replaces it with at most all of its children, and the depth is at most the binary one.
+static const int wideStackSize = (bvhWideNodeWidth - 1) * maxDepth + 1;
+
+/// Returns the bounding box of a triangle of a mesh
+static BoundingBox getTriangleBox(const Mesh &mesh, int trIdx) {
+	BoundingBox box;
+	box.expand(mesh.vertices[mesh.triangles[trIdx].x]);
+	box.expand(mesh.vertices[mesh.triangles[trIdx].y]);
+	box.expand(mesh.vertices[mesh.triangles[trIdx].z]);
+	return box;
+}
+
+/// Returns the number of threads to build with
+static int getBuildThreadsCount(const BvhBuildOptions &options) {
+	return options.threadsCount > 0
+		? options.threadsCount
+		: getMax(1, int(std::thread::hardware_concurrency()));
+}
+
+/// Builds the nodes over some triangle references with the builder of a mode
+/// @param[out] nodes The built nodes
+/// @param[in,out] refs The triangle references, reordered and possibly split by the builder
+/// @param[in] objects Meshes of the references
+/// @param[in] options Algorithm and number of threads to build with
+static void buildNodes(std::vector<BvhNode> &nodes, std::vector<BvhBuildRef> &refs, const Mesh *objects, const BvhBuildOptions &options) {
+	const int threadsCount = getBuildThreadsCount(options);
+	switch (options.mode) {
+	case BvhBuildMode::Sweep:
+		buildSweepSah(nodes, refs, trianglePacketWidth);
+		break;
+	case BvhBuildMode::Binned:
+		buildBinnedSah(nodes, refs, trianglePacketWidth, threadsCount);
+		break;
+	case BvhBuildMode::Lbvh:
+		buildLbvh(nodes, refs, trianglePacketWidth, threadsCount);
+		break;
+	case BvhBuildMode::Sbvh:
+		buildSpatialSah(nodes, refs, objects, trianglePacketWidth, options.spatialSplitBudget);
+		break;
+	}
+}
+
+/// Returns the number of packets of the leaves of some nodes
+static int getLeafPacketsCount(const BvhNode *nodes, int nodesCount) {
+	int packetsCount = 0;
+	for (int nodeIdx = 0; nodeIdx < nodesCount; nodeIdx++) {
+		if (nodes[nodeIdx].isLeaf()) {
+			packetsCount += nodes[nodeIdx].getPacketsCount();
+		}
+	}
+	return packetsCount;
+}
+
+/// Packs the triangles of each leaf of built nodes, and points the leaf to its first packet instead of its first reference
+/// @param[in,out] nodes The built nodes
+/// @param[in] nodesCount Number of nodes
+/// @param[in] refs The build references, in the order of the leaves
+/// @param[in] objects Meshes of the references, with precomputed triangles
+/// @param[out] packets Array of getLeafPacketsCount packets, filled in the order of the leaves
+/// @param[out] triangleRefs Array of a reference for each lane of each packet
+static void packLeaves(
+	BvhNode *nodes,
+	int nodesCount,
+	const BvhBuildRef *refs,
+	const Mesh *objects,
+	TrianglePacket *packets,
+	BvhTriangleRef *triangleRefs
+) {
+	int nextPacketIdx = 0;
+	for (int nodeIdx = 0; nodeIdx < nodesCount; nodeIdx++) {
+		BvhNode &node = nodes[nodeIdx];
+		if (!node.isLeaf()) {
+			continue;
+		}
+		const int firstRefIdx = nextPacketIdx * trianglePacketWidth;
+		for (int i = 0; i < node.trianglesCount; i++) {
+			const BvhTriangleRef &ref = refs[node.offset + i].ref;
+			packets[nextPacketIdx + i / trianglePacketWidth].setLane(
+				i % trianglePacketWidth,
+				objects[ref.meshIdx].precomputedTriangles[ref.triangleIdx]
+			);
+			triangleRefs[firstRefIdx + i] = ref;
+		}
+		for (int i = node.trianglesCount; i < node.getPacketsCount() * trianglePacketWidth; i++) {
+			triangleRefs[firstRefIdx + i] = { -1, 0 };
+		}
+		node.offset = nextPacketIdx;
+		nextPacketIdx += node.getPacketsCount();
+	}
+}
+
+void Bvh::build(const Mesh *objects, int objectsCount, const BvhBuildOptions &options) {
+	PROFILE_SCOPE("Bvh::build");
+	const auto startTime = std::chrono::steady_clock::now();
+	buildStats = BvhBuildStats();
+	buildStats.mode = options.mode;
+	buildStats.spatialSplitBudget = options.spatialSplitBudget;
+	clear();
+	this->objects = objects;
+	this->objectsCount = objectsCount;
+
+	// Create a build reference for each triangle of each mesh
+	std::vector<BvhBuildRef> buildRefs;
+	for (int meshIdx = 0; meshIdx < objectsCount; meshIdx++) {
+		const Mesh &mesh = objects[meshIdx];
+		for (int trIdx = 0; trIdx < mesh.trianglesCount; trIdx++) {
+			BvhBuildRef buildRef;
+			buildRef.ref = { meshIdx, trIdx };
+			buildRef.box = getTriangleBox(mesh, trIdx);
+			buildRef.center = buildRef.box.getCenter();
+			buildRefs.push_back(buildRef);
+		}
+	}
+	if (buildRefs.empty()) {
+		return;
+	}
+
+	const int trianglesCount = int(buildRefs.size());
+	std::vector<BvhNode> builtNodes;
+	buildNodes(builtNodes, buildRefs, objects, options);
+	buildStats.duplicatedRefs = int(buildRefs.size()) - trianglesCount;
+
+	// Copy the final nodes, and pack the triangles of their leaves
+	nodesCount = int(builtNodes.size());
+	nodes = new BvhNode[nodesCount];
+	std::copy(builtNodes.begin(), builtNodes.end(), nodes);
+	packetsCount = getLeafPacketsCount(nodes, nodesCount);
+	packets = allocateAligned<TrianglePacket>(packetsCount, packetsMemory);
+	triangleRefsCount = packetsCount * trianglePacketWidth;
+	triangleRefs = new BvhTriangleRef[triangleRefsCount];
+	packLeaves(nodes, nodesCount, buildRefs.data(), objects, packets, triangleRefs);
+
+	if (options.layout == BvhLayout::Wide) {
+		buildWideNodes();
+	}
+
+	buildStats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	buildStats.sahCost = computeSahCost(nodes, nodesCount, trianglePacketWidth);
+}
+
+void Bvh::update(const BvhBuildOptions &options, BvhUpdateStats &stats) {
+	PROFILE_SCOPE("Bvh::update");
+	if (nodesCount == 0) {
+		return;
+	}
+	// The boxes haven't been refit yet, so the costs are the ones of the built hierarchy
+	if (!builtCosts) {
+		builtCosts = new float[nodesCount];
+		computeRelativeCosts(nodes, nodesCount, trianglePacketWidth, builtCosts);
+	}
+	refit(stats);
+
+	// Find the largest subtrees which degraded past the threshold, the ones under them are rebuilt with them
+	std::vector<float> costs(nodesCount);
+	computeRelativeCosts(nodes, nodesCount, trianglePacketWidth, costs.data());
+	struct Subtree {
+		int rootIdx;
+		int rootDepth;
+	};
+	std::vector<Subtree> degradedSubtrees;
+	std::vector<Subtree> stack = { { 0, 0 } };
+	while (!stack.empty()) {
+		const Subtree subtree = stack.back();
+		stack.pop_back();
+		const BvhNode &node = nodes[subtree.rootIdx];
+		if (node.isLeaf()) {
+			continue;
+		}
+		if (costs[subtree.rootIdx] > options.rebuildThreshold * builtCosts[subtree.rootIdx]) {
+			degradedSubtrees.push_back(subtree);
+			continue;
+		}
+		stack.push_back({ node.offset, subtree.rootDepth + 1 });
+		stack.push_back({ subtree.rootIdx + 1, subtree.rootDepth + 1 });
+	}
+
+	// Rebuild from the last subtree to the first, so that moving the nodes after a subtree doesn't move the ones still to be rebuilt
+	std::sort(degradedSubtrees.begin(), degradedSubtrees.end(), [](const Subtree &a, const Subtree &b) {
+		return a.rootIdx > b.rootIdx;
+	});
+	for (const Subtree &subtree : degradedSubtrees) {
+		if (!rebuildSubtree(subtree.rootIdx, subtree.rootDepth, options, stats)) {
+			// Rebuilding the whole hierarchy keeps it within the maximum depth
+			build(objects, objectsCount, options);
+			stats.rebuiltSubtrees++;
+			// The references hold empty lanes of the packets, so count the meshes' triangles
+			for (int objIdx = 0; objIdx < objectsCount; objIdx++) {
+				stats.rebuiltTriangles += objects[objIdx].trianglesCount;
+			}
+			break;
+		}
+	}
+	// The wide nodes are converted again from the updated binary ones
+	clearWideNodes();
+	if (options.layout == BvhLayout::Wide) {
+		buildWideNodes();
+	}
+	buildStats.sahCost = computeSahCost(nodes, nodesCount, trianglePacketWidth);
+}
+
+void Bvh::refit(BvhUpdateStats &stats) {
+	// Children are after their parents, so going backwards refits the children first
+	for (int nodeIdx = nodesCount - 1; nodeIdx >= 0; nodeIdx--) {
+		BvhNode &node = nodes[nodeIdx];
+		if (!node.isLeaf()) {
+			node.box = nodes[nodeIdx + 1].box;
+			node.box.expand(nodes[node.offset].box);
+			continue;
+		}
+		node.box = BoundingBox();
+		for (int packetIdx = node.offset; packetIdx < node.offset + node.getPacketsCount(); packetIdx++) {
+			for (int lane = 0; lane < trianglePacketWidth; lane++) {
+				const BvhTriangleRef &ref = triangleRefs[packetIdx * trianglePacketWidth + lane];
+				if (ref.meshIdx < 0) {
+					continue;
+				}
+				const Mesh &mesh = objects[ref.meshIdx];
+				node.box.expand(getTriangleBox(mesh, ref.triangleIdx));
+				packets[packetIdx].setLane(lane, mesh.precomputedTriangles[ref.triangleIdx]);
+			}
+		}
+	}
+	stats.refitNodes += nodesCount;
+}
+
+bool Bvh::rebuildSubtree(int rootIdx, int rootDepth, const BvhBuildOptions &options, BvhUpdateStats &stats) {
+	// The subtree's nodes are consecutive, up to its rightmost leaf, and so are the packets of its leaves
+	int firstLeafIdx = rootIdx;
+	while (!nodes[firstLeafIdx].isLeaf()) {
+		firstLeafIdx++;
+	}
+	int lastLeafIdx = rootIdx;
+	while (!nodes[lastLeafIdx].isLeaf()) {
+		lastLeafIdx = nodes[lastLeafIdx].offset;
+	}
+	const int endIdx = lastLeafIdx + 1;
+	const int firstPacketIdx = nodes[firstLeafIdx].offset;
+	const int endPacketIdx = nodes[lastLeafIdx].offset + nodes[lastLeafIdx].getPacketsCount();
+
+	std::vector<BvhTriangleRef> subtreeRefs;
+	for (int refIdx = firstPacketIdx * trianglePacketWidth; refIdx < endPacketIdx * trianglePacketWidth; refIdx++) {
+		if (triangleRefs[refIdx].meshIdx >= 0) {
+			subtreeRefs.push_back(triangleRefs[refIdx]);
+		}
+	}
+	const int oldRefsCount = int(subtreeRefs.size());
+	// A triangle split by spatial splits is in several leaves, and is rebuilt from a single reference
+	if (buildStats.duplicatedRefs > 0) {
+		std::sort(subtreeRefs.begin(), subtreeRefs.end(), [](const BvhTriangleRef &a, const BvhTriangleRef &b) {
+			return a.meshIdx != b.meshIdx ? a.meshIdx < b.meshIdx : a.triangleIdx < b.triangleIdx;
+		});
+		subtreeRefs.erase(std::unique(subtreeRefs.begin(), subtreeRefs.end(), [](const BvhTriangleRef &a, const BvhTriangleRef &b) {
+			return a.meshIdx == b.meshIdx && a.triangleIdx == b.triangleIdx;
+		}), subtreeRefs.end());
+	}
+
+	std::vector<BvhBuildRef> buildRefs;
+	for (const BvhTriangleRef &ref : subtreeRefs) {
+		BvhBuildRef buildRef;
+		buildRef.ref = ref;
+		buildRef.box = getTriangleBox(objects[ref.meshIdx], ref.triangleIdx);
+		buildRef.center = buildRef.box.getCenter();
+		buildRefs.push_back(buildRef);
+	}
+	const int subtreeTrianglesCount = int(buildRefs.size());
+	std::vector<BvhNode> subtreeNodes;
+	buildNodes(subtreeNodes, buildRefs, objects, options);
+	const int subtreeNodesCount = int(subtreeNodes.size());
+
+	// Each node is deeper than its parent, which is before it
+	std::vector<int> depths(subtreeNodesCount, 0);
+	int subtreeDepth = 0;
+	for (int nodeIdx = 0; nodeIdx < subtreeNodesCount; nodeIdx++) {
+		subtreeDepth = getMax(subtreeDepth, depths[nodeIdx]);
+		if (!subtreeNodes[nodeIdx].isLeaf()) {
+			depths[nodeIdx + 1] = depths[nodeIdx] + 1;
+			depths[subtreeNodes[nodeIdx].offset] = depths[nodeIdx] + 1;
+		}
+	}
+	if (rootDepth + subtreeDepth >= maxDepth) {
+		return false;
+	}
+
+	std::vector<float> subtreeCosts(subtreeNodesCount);
+	computeRelativeCosts(subtreeNodes.data(), subtreeNodesCount, trianglePacketWidth, subtreeCosts.data());
+	const int subtreePacketsCount = getLeafPacketsCount(subtreeNodes.data(), subtreeNodesCount);
+	char *subtreePacketsMemory = nullptr;
+	TrianglePacket *subtreePackets = allocateAligned<TrianglePacket>(subtreePacketsCount, subtreePacketsMemory);
+	std::vector<BvhTriangleRef> subtreeTriangleRefs(subtreePacketsCount * trianglePacketWidth);
+	packLeaves(subtreeNodes.data(), subtreeNodesCount, buildRefs.data(), objects, subtreePackets, subtreeTriangleRefs.data());
+
+	// Move the offsets to the subtree's place in the arrays, and the offsets of the nodes after it by the change of its size
+	const int nodesDelta = subtreeNodesCount - (endIdx - rootIdx);
+	const int packetsDelta = subtreePacketsCount - (endPacketIdx - firstPacketIdx);
+	for (BvhNode &node : subtreeNodes) {
+		node.offset += node.isLeaf() ? firstPacketIdx : rootIdx;
+	}
+	for (int nodeIdx = 0; nodeIdx < rootIdx; nodeIdx++) {
+		// Only right children after the subtree move, the leaves before it have their packets before it too
+		if (!nodes[nodeIdx].isLeaf() && nodes[nodeIdx].offset >= endIdx) {
+			nodes[nodeIdx].offset += nodesDelta;
+		}
+	}
+	for (int nodeIdx = endIdx; nodeIdx < nodesCount; nodeIdx++) {
+		nodes[nodeIdx].offset += nodes[nodeIdx].isLeaf() ? packetsDelta : nodesDelta;
+	}
+
+	// Put together the arrays of the nodes before the subtree, the rebuilt subtree, and the nodes after it
+	const int newNodesCount = nodesCount + nodesDelta;
+	BvhNode *newNodes = new BvhNode[newNodesCount];
+	float *newBuiltCosts = new float[newNodesCount];
+	std::copy(nodes, nodes + rootIdx, newNodes);
+	std::copy(subtreeNodes.begin(), subtreeNodes.end(), newNodes + rootIdx);
+	std::copy(nodes + endIdx, nodes + nodesCount, newNodes + rootIdx + subtreeNodesCount);
+	std::copy(builtCosts, builtCosts + rootIdx, newBuiltCosts);
+	std::copy(subtreeCosts.begin(), subtreeCosts.end(), newBuiltCosts + rootIdx);
+	std::copy(builtCosts + endIdx, builtCosts + nodesCount, newBuiltCosts + rootIdx + subtreeNodesCount);
+
+	const int newPacketsCount = packetsCount + packetsDelta;
+	char *newPacketsMemory = nullptr;
+	TrianglePacket *newPackets = allocateAligned<TrianglePacket>(newPacketsCount, newPacketsMemory);
+	std::copy(packets, packets + firstPacketIdx, newPackets);
+	std::copy(subtreePackets, subtreePackets + subtreePacketsCount, newPackets + firstPacketIdx);
+	std::copy(packets + endPacketIdx, packets + packetsCount, newPackets + firstPacketIdx + subtreePacketsCount);
+	delete[] subtreePacketsMemory;
+
+	BvhTriangleRef *newTriangleRefs = new BvhTriangleRef[newPacketsCount * trianglePacketWidth];
+	std::copy(triangleRefs, triangleRefs + firstPacketIdx * trianglePacketWidth, newTriangleRefs);
+	std::copy(subtreeTriangleRefs.begin(), subtreeTriangleRefs.end(), newTriangleRefs + firstPacketIdx * trianglePacketWidth);
+	std::copy(
+		triangleRefs + endPacketIdx * trianglePacketWidth,
+		triangleRefs + packetsCount * trianglePacketWidth,
+		newTriangleRefs + (firstPacketIdx + subtreePacketsCount) * trianglePacketWidth
+	);
+
+	// Frees the old arrays, which may be in the cache file, and the new ones are owned by the hierarchy from now on
+	clear();
+	nodes = newNodes;
+	nodesCount = newNodesCount;
+	builtCosts = newBuiltCosts;
+	packets = newPackets;
+	packetsMemory = newPacketsMemory;
+	packetsCount = newPacketsCount;
+	triangleRefs = newTriangleRefs;
+	triangleRefsCount = newPacketsCount * trianglePacketWidth;
+
+	stats.rebuiltSubtrees++;
+	stats.rebuiltTriangles += subtreeTrianglesCount;
+	buildStats.duplicatedRefs += int(buildRefs.size()) - oldRefsCount;
+	return true;
+}
+
+/// Quantizes the boxes of a wide node's children on a grid over their union, see BvhWideNode
+/// @param[in,out] node The node, with its number of children set
+/// @param[in] childBoxes The exact boxes of the children
+static void quantizeChildBoxes(BvhWideNode &node, const BoundingBox *childBoxes) {
+	BoundingBox box;
+	for (int childIdx = 0; childIdx < node.childrenCount; childIdx++) {
+		box.expand(childBoxes[childIdx]);
+	}
+	for (int axis = 0; axis < 3; axis++) {
+		const float origin = getAxis(box.min, axis);
+		const float extent = getAxis(box.max, axis) - origin;
+		node.origin[axis] = origin;
+
+		// The smallest power of two whose 255 cells cover the extent, frexp gives extent / 255 = m * 2^exponent with m in [0.5, 1)
+		int exponent = minCellExponent;
+		if (extent > 0.f) {
+			frexpf(extent / 255.f, &exponent);
+		}
+		exponent = getMin(getMax(exponent, minCellExponent), maxCellExponent);
+
+		// Rounding may leave a child's maximum past the last cell, then the cells are made twice as large
+		while (true) {
+			node.exponents[axis] = int8_t(exponent);
+			const float cellSize = node.getCellSize(axis);
+			bool fits = true;
+			for (int childIdx = 0; childIdx < node.childrenCount; childIdx++) {
+				const float childMin = getAxis(childBoxes[childIdx].min, axis);
+				const float childMax = getAxis(childBoxes[childIdx].max, axis);
+				// Round outwards, then correct the rounding of the division by checking the decoded corners
+				int cellsMin = int(getMin(getMax(floorf((childMin - origin) / cellSize), 0.f), 255.f));
+				while (cellsMin > 0 && origin + float(cellsMin) * cellSize > childMin) {
+					cellsMin--;
+				}
+				int cellsMax = int(getMin(getMax(ceilf((childMax - origin) / cellSize), 0.f), 255.f));
+				while (cellsMax < 255 && origin + float(cellsMax) * cellSize < childMax) {
+					cellsMax++;
+				}
+				fits = fits && origin + float(cellsMax) * cellSize >= childMax;
+				node.childMin[axis][childIdx] = uint8_t(cellsMin);
+				node.childMax[axis][childIdx] = uint8_t(cellsMax);
+			}
+			if (fits || exponent >= maxCellExponent) {
+				break;
+			}
+			exponent++;
+		}
+	}
+}
+
+void Bvh::buildWideNodes() {
+	PROFILE_SCOPE("Bvh::buildWideNodes");
+	clearWideNodes();
+	buildStats.layout = BvhLayout::Wide;
+	if (nodesCount == 0) {
+		return;
+	}
+
+	// First collapse the binary nodes, finding the binary nodes which become the children of each wide node.
+	// The children of a wide node are consecutive, so that the nodes visited together are close in memory.
+	struct CollapsedNode {
+		int childIdxs[bvhWideNodeWidth];
+		int childrenCount;
+		/// Wide node of each inner child
+		int childWideIdxs[bvhWideNodeWidth];
+	};
+	std::vector<CollapsedNode> collapsedNodes(1);
+	// Binary nodes of the wide nodes which still have to be collapsed, the root is the only child of the root if it is a leaf
+	struct PendingNode {
+		int nodeIdx;
+		int wideNodeIdx;
+	};
+	std::vector<PendingNode> pendingNodes = { { 0, 0 } };
+	while (!pendingNodes.empty()) {
+		const PendingNode pending = pendingNodes.back();
+		pendingNodes.pop_back();
+		CollapsedNode collapsed;
+		collapsed.childrenCount = 0;
+		if (nodes[pending.nodeIdx].isLeaf()) {
+			collapsed.childIdxs[collapsed.childrenCount++] = pending.nodeIdx;
+		} else {
+			collapsed.childIdxs[collapsed.childrenCount++] = pending.nodeIdx + 1;
+			collapsed.childIdxs[collapsed.childrenCount++] = nodes[pending.nodeIdx].offset;
+		}
+		while (collapsed.childrenCount < bvhWideNodeWidth) {
+			// Open the inner child with the largest box, which the rays are the most likely to hit
+			int openedIdx = -1;
+			float openedArea = -1.f;
+			for (int i = 0; i < collapsed.childrenCount; i++) {
+				const BvhNode &child = nodes[collapsed.childIdxs[i]];
+				if (!child.isLeaf() && child.box.getSurfaceArea() > openedArea) {
+					openedIdx = i;
+					openedArea = child.box.getSurfaceArea();
+				}
+			}
+			if (openedIdx < 0) {
+				break;
+			}
+			// Its children take its place, keeping the children in the order of the binary nodes
+			const int openedNodeIdx = collapsed.childIdxs[openedIdx];
+			for (int i = collapsed.childrenCount; i > openedIdx + 1; i--) {
+				collapsed.childIdxs[i] = collapsed.childIdxs[i - 1];
+			}
+			collapsed.childIdxs[openedIdx] = openedNodeIdx + 1;
+			collapsed.childIdxs[openedIdx + 1] = nodes[openedNodeIdx].offset;
+			collapsed.childrenCount++;
+		}
+		for (int i = 0; i < collapsed.childrenCount; i++) {
+			collapsed.childWideIdxs[i] = -1;
+			if (!nodes[collapsed.childIdxs[i]].isLeaf()) {
+				collapsed.childWideIdxs[i] = int(collapsedNodes.size());
+				pendingNodes.push_back({ collapsed.childIdxs[i], collapsed.childWideIdxs[i] });
+				collapsedNodes.emplace_back();
+			}
+		}
+		collapsedNodes[pending.wideNodeIdx] = collapsed;
+	}
+
+	wideNodesCount = int(collapsedNodes.size());
+	wideNodes = allocateAligned<BvhWideNode>(wideNodesCount, wideNodesMemory);
+
+	// Then fill the wide nodes
+	for (int wideNodeIdx = 0; wideNodeIdx < wideNodesCount; wideNodeIdx++) {
+		const CollapsedNode &collapsed = collapsedNodes[wideNodeIdx];
+		BvhWideNode &wideNode = wideNodes[wideNodeIdx];
+		memset(&wideNode, 0, sizeof(BvhWideNode));
+		wideNode.childrenCount = uint8_t(collapsed.childrenCount);
+		BoundingBox childBoxes[bvhWideNodeWidth];
+		for (int i = 0; i < collapsed.childrenCount; i++) {
+			const BvhNode &child = nodes[collapsed.childIdxs[i]];
+			childBoxes[i] = child.box;
+			if (child.isLeaf()) {
+				assert(child.trianglesCount <= UINT16_MAX);
+				wideNode.children[i] = child.offset;
+				wideNode.trianglesCounts[i] = uint16_t(child.trianglesCount);
+			} else {
+				wideNode.children[i] = collapsed.childWideIdxs[i];
+			}
+		}
+		quantizeChildBoxes(wideNode, childBoxes);
+	}
+}
+
+long long Bvh::getNodesSize() const {
+	return wideNodes
+		? (long long)(wideNodesCount) * (long long)(sizeof(BvhWideNode))
+		: (long long)(nodesCount) * (long long)(sizeof(BvhNode));
+}
+
+void Bvh::clearWideNodes() {
+	delete[] wideNodesMemory;
+	wideNodesMemory = nullptr;
+	wideNodes = nullptr;
+	wideNodesCount = 0;
+	buildStats.layout = BvhLayout::Binary;
+}
+
+void Bvh::clear() {
+	clearWideNodes();
+	if (cacheFile.data) {
+		cacheFile.unmap();
+	} else {
+		delete[] nodes;
+		delete[] packetsMemory;
+		delete[] triangleRefs;
+	}
+	delete[] builtCosts;
+	builtCosts = nullptr;
+	nodes = nullptr;
+	nodesCount = 0;
+	packets = nullptr;
+	packetsMemory = nullptr;
+	packetsCount = 0;
+	triangleRefs = nullptr;
+	triangleRefsCount = 0;
+}
+
+/// Checks if loaded nodes and triangle references can be traversed without reading out of bounds:
+/// the nodes form a single tree in depth-first order, no deeper than the traversal stacks,
+/// the leaves' packets are within the packets array and the references are within the mesh.
+/// Takes a single pass over the nodes and one over the references.
+/// @param[in] nodes The nodes
+/// @param[in] nodesCount Number of the nodes
+/// @param[in] packetsCount Number of the packets
+/// @param[in] triangleRefs Array of a reference for each lane of each packet
+/// @param[in] mesh The mesh of the hierarchy
+/// @param[out] usedRefsCount Number of the references of triangles, without the unused lanes
+static bool isValidLoadedTree(
+	const BvhNode *nodes,
+	int nodesCount,
+	int packetsCount,
+	const BvhTriangleRef *triangleRefs,
+	const Mesh &mesh,
+	int &usedRefsCount
+) {
+	// Right children yet to be reached, with their depths, the last one comes next after a leaf
+	std::vector<std::pair<int, int>> pendingChildren;
+	int depth = 0;
+	for (int nodeIdx = 0; nodeIdx < nodesCount; nodeIdx++) {
+		const BvhNode &node = nodes[nodeIdx];
+		if (depth >= maxDepth) {
+			return false;
+		}
+		if (!node.isLeaf()) {
+			// The traversal picks the child to visit first by the sign of the ray's direction along the axis
+			if (node.splitAxis < 0 || node.splitAxis > 2) {
+				return false;
+			}
+			pendingChildren.push_back({ node.offset, depth + 1 });
+			depth++;
+			continue;
+		}
+		// Also keeps the rounding up of the triangles count to packets from overflowing
+		if (node.trianglesCount > packetsCount * trianglePacketWidth) {
+			return false;
+		}
+		if (node.offset < 0 || node.offset > packetsCount - node.getPacketsCount()) {
+			return false;
+		}
+		if (pendingChildren.empty()) {
+			// The last leaf ends the tree
+			if (nodeIdx != nodesCount - 1) {
+				return false;
+			}
+			break;
+		}
+		if (pendingChildren.back().first != nodeIdx + 1) {
+			return false;
+		}
+		depth = pendingChildren.back().second;
+		pendingChildren.pop_back();
+	}
+	if (!pendingChildren.empty()) {
+		return false;
+	}
+
+	usedRefsCount = 0;
+	for (int refIdx = 0; refIdx < packetsCount * trianglePacketWidth; refIdx++) {
+		const BvhTriangleRef &ref = triangleRefs[refIdx];
+		if (ref.meshIdx == -1) {
+			continue;
+		}
+		if (ref.meshIdx != 0 || ref.triangleIdx < 0 || ref.triangleIdx >= mesh.trianglesCount) {
+			return false;
+		}
+		usedRefsCount++;
+	}
+	return true;
+}
+
+bool Bvh::loadFromCache(const std::string &filepath, const Mesh &mesh, uint64_t geometryHash, const BvhBuildOptions &options) {
+	PROFILE_SCOPE("Bvh::loadFromCache");
+	using namespace BvhCacheFormat;
+	const auto startTime = std::chrono::steady_clock::now();
+	clear();
+
+	if (!cacheFile.map(filepath)) {
+		return false;
+	}
+	const char *data = cacheFile.data;
+	const uint64_t fileSize = cacheFile.size;
+
+	// Checks if an array of some size at some offset is within the file and properly aligned
+	auto isValidArray = [fileSize](uint64_t offset, uint64_t count, uint64_t elementSize) {
+		return offset % alignment == 0 && offset <= fileSize && count <= (fileSize - offset) / elementSize;
+	};
+
+	const Header *header = reinterpret_cast<const Header *>(data);
+	const float spatialSplitBudget = options.mode == BvhBuildMode::Sbvh ? options.spatialSplitBudget : 0.f;
+	const bool isValid = fileSize >= sizeof(Header)
+		&& memcmp(header->magic, magic, sizeof(magic)) == 0
+		&& header->version == version
+		&& header->headerSize == sizeof(Header)
+		&& header->packetWidth == uint32_t(trianglePacketWidth)
+		&& header->packetSize == uint32_t(sizeof(TrianglePacket))
+		&& header->geometryHash == geometryHash
+		&& header->verticesCount == uint32_t(mesh.verticesCount)
+		&& header->trianglesCount == uint32_t(mesh.trianglesCount)
+		&& header->buildMode == uint32_t(options.mode)
+		&& header->spatialSplitBudget == spatialSplitBudget
+		&& header->nodesCount > 0
+		// The counts are used as ints, also multiplied by the packet width
+		&& header->nodesCount <= uint32_t(INT_MAX / trianglePacketWidth)
+		&& header->packetsCount <= uint32_t(INT_MAX / trianglePacketWidth)
+		&& uint64_t(header->triangleRefsCount) == uint64_t(header->packetsCount) * uint64_t(trianglePacketWidth)
+		&& isValidArray(header->nodesOffset, header->nodesCount, sizeof(BvhNode))
+		&& isValidArray(header->packetsOffset, header->packetsCount, sizeof(TrianglePacket))
+		&& isValidArray(header->triangleRefsOffset, header->triangleRefsCount, sizeof(BvhTriangleRef));
+	int usedRefsCount = 0;
+	if (!isValid || !isValidLoadedTree(
+		reinterpret_cast<const BvhNode *>(data + header->nodesOffset),
+		int(header->nodesCount),
+		int(header->packetsCount),
+		reinterpret_cast<const BvhTriangleRef *>(data + header->triangleRefsOffset),
+		mesh,
+		usedRefsCount
+	)) {
+		cacheFile.unmap();
+		return false;
+	}
+
+	// Point the hierarchy directly into the mapping
+	nodes = reinterpret_cast<BvhNode *>(cacheFile.data + header->nodesOffset);
+	nodesCount = int(header->nodesCount);
+	packets = reinterpret_cast<TrianglePacket *>(cacheFile.data + header->packetsOffset);
+	packetsCount = int(header->packetsCount);
+	triangleRefs = reinterpret_cast<BvhTriangleRef *>(cacheFile.data + header->triangleRefsOffset);
+	triangleRefsCount = int(header->triangleRefsCount);
+	objects = &mesh;
+	objectsCount = 1;
+
+	buildStats = BvhBuildStats();
+	buildStats.mode = options.mode;
+	buildStats.spatialSplitBudget = options.spatialSplitBudget;
+	buildStats.sahCost = header->sahCost;
+	// Each triangle has a reference, and the ones added by spatial splits are on top of them
+	buildStats.duplicatedRefs = usedRefsCount - mesh.trianglesCount;
+	buildStats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	return true;
+}
+
+/// Writes zeros to a file up to the next multiple of the cache's alignment
+/// @param[in] file The file being written
+/// @param[in,out] offset Number of bytes written so far, moved to the aligned offset
+static void writeAlignmentPadding(FILE *file, uint64_t &offset) {
+	static const char zeros[BvhCacheFormat::alignment] = {};
+	const uint64_t alignedOffset = BvhCacheFormat::alignOffset(offset);
+	fwrite(zeros, 1, size_t(alignedOffset - offset), file);
+	offset = alignedOffset;
+}
+
+bool Bvh::saveToCache(const std::string &filepath, const Mesh &mesh, uint64_t geometryHash) const {
+	PROFILE_SCOPE("Bvh::saveToCache");
+	using namespace BvhCacheFormat;
+	if (nodesCount == 0) {
+		return false;
+	}
+
+	Header header = {};
+	memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	header.headerSize = sizeof(Header);
+	header.packetWidth = uint32_t(trianglePacketWidth);
+	header.packetSize = uint32_t(sizeof(TrianglePacket));
+	header.geometryHash = geometryHash;
+	header.verticesCount = uint32_t(mesh.verticesCount);
+	header.trianglesCount = uint32_t(mesh.trianglesCount);
+	header.buildMode = uint32_t(buildStats.mode);
+	header.sahCost = buildStats.sahCost;
+	header.nodesCount = uint32_t(nodesCount);
+	header.packetsCount = uint32_t(packetsCount);
+	header.triangleRefsCount = uint32_t(triangleRefsCount);
+	header.spatialSplitBudget = buildStats.mode == BvhBuildMode::Sbvh ? buildStats.spatialSplitBudget : 0.f;
+	header.nodesOffset = alignOffset(sizeof(Header));
+	header.packetsOffset = alignOffset(header.nodesOffset + uint64_t(nodesCount) * sizeof(BvhNode));
+	header.triangleRefsOffset = alignOffset(header.packetsOffset + uint64_t(packetsCount) * sizeof(TrianglePacket));
+
+	// The temporary name is unique to the thread, as several threads may write the hierarchies of equal meshes
+	const uint64_t tmpId = uint64_t(std::hash<std::thread::id>()(std::this_thread::get_id()))
+		^ uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+	const std::string tmpPath = filepath + "." + std::to_string(tmpId) + ".tmp";
+	FILE *file = fopen(tmpPath.c_str(), "wb");
+	if (!file) {
+		return false;
+	}
+
+	// Write everything in the order of the layout, padding to the alignment before each array
+	uint64_t offset = 0;
+	fwrite(&header, sizeof(Header), 1, file);
+	offset += sizeof(Header);
+	writeAlignmentPadding(file, offset);
+	fwrite(nodes, sizeof(BvhNode), size_t(nodesCount), file);
+	offset += uint64_t(nodesCount) * sizeof(BvhNode);
+	writeAlignmentPadding(file, offset);
+	fwrite(packets, sizeof(TrianglePacket), size_t(packetsCount), file);
+	offset += uint64_t(packetsCount) * sizeof(TrianglePacket);
+	writeAlignmentPadding(file, offset);
+	fwrite(triangleRefs, sizeof(BvhTriangleRef), size_t(triangleRefsCount), file);
+
+	const bool written = !ferror(file);
+	const bool closed = fclose(file) == 0;
+	if (!written || !closed) {
+		remove(tmpPath.c_str());
+		return false;
+	}
+	// Replacing an existing file fails on some platforms, in which case another run has written it already
+	if (rename(tmpPath.c_str(), filepath.c_str()) != 0) {
+		remove(tmpPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+/// Finds the closest intersection of a ray, see Bvh::intersect
+template<IsaLevel level>
+CPU_FORCE_INLINE static bool intersectRay(const Bvh &bvh, const Ray &ray, BvhHit &hit, RayStats &stats) {
+	if (bvh.nodesCount == 0) {
+		return false;
+	}
+
+	const Vec3f invDirection = { 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+	const bool dirIsNeg[3] = { ray.direction.x < 0.f, ray.direction.y < 0.f, ray.direction.z < 0.f };
+
+	float minDist = hit.dist;
+	// Index of the closest intersected triangle's reference
+	int closestRefIdx = -1;
+
+	// Work is counted in locals and added to the stats once, at the end
+	int nodeVisits = 0;
+	int triangleTests = 0;
+	int triangleHits = 0;
+
+	// Stack of nodes that are still to be visited
+	int stack[maxDepth];
+	int stackSize = 0;
+	int nodeIdx = 0;
+	while (true) {
+		const BvhNode &node = bvh.nodes[nodeIdx];
+		nodeVisits++;
+		// Skip the node if the ray misses its box or hits it further than the closest intersection so far
+		if (rayBoxIntersection(ray, invDirection, node.box, minDist)) {
+			if (!node.isLeaf()) {
+				// Visit the child closer to the ray origin first, and the other one later
+				if (dirIsNeg[node.splitAxis]) {
+					stack[stackSize++] = nodeIdx + 1;
+					nodeIdx = node.offset;
+				} else {
+					stack[stackSize++] = node.offset;
+					nodeIdx = nodeIdx + 1;
+				}
+				continue;
+			}
+			// Intersect the ray with all packets of the leaf,
+			// here we are considering only intersections through the front side of the triangles
+			triangleTests += node.trianglesCount;
+			for (int packetIdx = node.offset; packetIdx < node.offset + node.getPacketsCount(); packetIdx++) {
+				float dist = 0.f;
+				const int lane = TrianglePacketKernels::intersectClosest<level>(ray, bvh.packets[packetIdx], minDist, dist);
+				if (lane >= 0) {
+					triangleHits++;
+					minDist = dist;
+					closestRefIdx = packetIdx * trianglePacketWidth + lane;
+				}
+			}
+		}
+		if (stackSize == 0) {
+			break;
+		}
+		nodeIdx = stack[--stackSize];
+	}
+
+	stats.nodeVisits += nodeVisits;
+	stats.triangleTests += triangleTests;
+	stats.triangleHits += triangleHits;
+	if (closestRefIdx < 0) {
+		return false;
+	}
+	hit.dist = minDist;
+	hit.refIdx = closestRefIdx;
+	return true;
+}
+
+/// Finds the closest intersection of each ray of a packet, see Bvh::intersect
+template<IsaLevel level>
+CPU_FORCE_INLINE static void intersectPacket(const Bvh &bvh, const RayPacket &packet, BvhHit *hits, bool *found, RayStats &stats) {
+	if (!packet.isCoherent || bvh.nodesCount == 0) {
+		for (int i = 0; i < packet.raysCount; i++) {
+			found[i] = intersectRay<level>(bvh, packet.rays[i], hits[i], stats);
+		}
+		return;
+	}
+
+	// The directions have the same signs, so the children are visited in the same order for all rays
+	const Vec3f &direction = packet.rays[0].direction;
+	const bool dirIsNeg[3] = { direction.x < 0.f, direction.y < 0.f, direction.z < 0.f };
+
+	float minDists[rayPacketSize];
+	int closestRefIdxs[rayPacketSize];
+	// The largest of the closest intersection distances, no ray needs anything further
+	float packetMaxDist = 0.f;
+	for (int i = 0; i < packet.raysCount; i++) {
+		minDists[i] = hits[i].dist;
+		closestRefIdxs[i] = -1;
+		packetMaxDist = getMax(packetMaxDist, minDists[i]);
+	}
+
+	// Work is counted in locals and added to the stats once, at the end
+	int nodeVisits = 0;
+	int triangleTests = 0;
+	int triangleHits = 0;
+
+	// Stack of nodes that are still to be visited, each with the first ray that may intersect it.
+	// The rays before it have missed an ancestor of the node, so they miss the node too.
+	struct StackEntry {
+		int nodeIdx;
+		int firstRayIdx;
+	};
+	StackEntry stack[maxDepth];
+	int stackSize = 0;
+	int nodeIdx = 0;
+	int firstRayIdx = 0;
+	while (true) {
+		const BvhNode &node = bvh.nodes[nodeIdx];
+		nodeVisits++;
+		// Skip the node if the whole packet surely misses it, otherwise find the first ray which hits it
+		if (packetBoxIntersection(packet, node.box, packetMaxDist)) {
+			while (
+				firstRayIdx < packet.raysCount
+				&& !rayBoxIntersection(packet.rays[firstRayIdx], packet.invDirections[firstRayIdx], node.box, minDists[firstRayIdx])
+			) {
+				firstRayIdx++;
+			}
+		} else {
+			firstRayIdx = packet.raysCount;
+		}
+
+		if (firstRayIdx < packet.raysCount) {
+			if (!node.isLeaf()) {
+				if (dirIsNeg[node.splitAxis]) {
+					stack[stackSize++] = { nodeIdx + 1, firstRayIdx };
+					nodeIdx = node.offset;
+				} else {
+					stack[stackSize++] = { node.offset, firstRayIdx };
+					nodeIdx = nodeIdx + 1;
+				}
+				continue;
+			}
+			// Intersect each ray which hits the leaf's box with all of its packets,
+			// the first active ray is already known to hit it
+			for (int i = firstRayIdx; i < packet.raysCount; i++) {
+				if (i > firstRayIdx && !rayBoxIntersection(packet.rays[i], packet.invDirections[i], node.box, minDists[i])) {
+					continue;
+				}
+				triangleTests += node.trianglesCount;
+				for (int packetIdx = node.offset; packetIdx < node.offset + node.getPacketsCount(); packetIdx++) {
+					float dist = 0.f;
+					const int lane = TrianglePacketKernels::intersectClosest<level>(packet.rays[i], bvh.packets[packetIdx], minDists[i], dist);
+					if (lane >= 0) {
+						triangleHits++;
+						minDists[i] = dist;
+						closestRefIdxs[i] = packetIdx * trianglePacketWidth + lane;
+					}
+				}
+			}
+			packetMaxDist = 0.f;
+			for (int i = 0; i < packet.raysCount; i++) {
+				packetMaxDist = getMax(packetMaxDist, minDists[i]);
+			}
+		}
+		if (stackSize == 0) {
+			break;
+		}
+		stackSize--;
+		nodeIdx = stack[stackSize].nodeIdx;
+		firstRayIdx = stack[stackSize].firstRayIdx;
+	}
+
+	stats.nodeVisits += nodeVisits;
+	stats.triangleTests += triangleTests;
+	stats.triangleHits += triangleHits;
+	for (int i = 0; i < packet.raysCount; i++) {
+		found[i] = closestRefIdxs[i] >= 0;
+		if (found[i]) {
+			hits[i].dist = minDists[i];
+			hits[i].refIdx = closestRefIdxs[i];
+		}
+	}
+}
+
+/// Checks if a ray intersects any triangle closer than some distance, see Bvh::isOccluded
+template<IsaLevel level>
+CPU_FORCE_INLINE static bool isOccludedRay(const Bvh &bvh, const Ray &ray, float maxDist, RayStats &stats) {
+	if (bvh.nodesCount == 0) {
+		return false;
+	}
+
+	const Vec3f invDirection = { 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+
+	// Work is counted in locals and added to the stats once, at the end
+	int nodeVisits = 0;
+	int triangleTests = 0;
+
+	// Stack of nodes that are still to be visited
+	int stack[maxDepth];
+	int stackSize = 0;
+	int nodeIdx = 0;
+	while (true) {
+		const BvhNode &node = bvh.nodes[nodeIdx];
+		nodeVisits++;
+		if (rayBoxIntersection(ray, invDirection, node.box, maxDist)) {
+			if (!node.isLeaf()) {
+				// Any intersection will do, so the order of the children doesn't matter
+				stack[stackSize++] = node.offset;
+				nodeIdx = nodeIdx + 1;
+				continue;
+			}
+			// Here we are considering intersections from both the front and the back side of the triangles
+			for (int packetIdx = node.offset; packetIdx < node.offset + node.getPacketsCount(); packetIdx++) {
+				triangleTests += getMin(trianglePacketWidth, node.trianglesCount - (packetIdx - node.offset) * trianglePacketWidth);
+				if (TrianglePacketKernels::intersectAny<level>(ray, bvh.packets[packetIdx], maxDist)) {
+					stats.nodeVisits += nodeVisits;
+					stats.triangleTests += triangleTests;
+					stats.triangleHits++;
+					return true;
+				}
+			}
+		}
+		if (stackSize == 0) {
+			break;
+		}
+		nodeIdx = stack[--stackSize];
+	}
+
+	stats.nodeVisits += nodeVisits;
+	stats.triangleTests += triangleTests;
+	return false;
+}
+
+/// Finds the closest intersection of a ray in the wide layout, see Bvh::intersect
+template<IsaLevel level>
+CPU_FORCE_INLINE static bool intersectRayWide(const Bvh &bvh, const Ray &ray, BvhHit &hit, RayStats &stats) {
+	const Vec3f invDirection = { 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+
+	float minDist = hit.dist;
+	// Index of the closest intersected triangle's reference
+	int closestRefIdx = -1;
+
+	// Work is counted in locals and added to the stats once, at the end
+	int nodeVisits = 0;
+	int triangleTests = 0;
+	int triangleHits = 0;
+
+	// Stack of children that are still to be visited, each with the distance at which the ray enters its box.
+	// An inner child is a node, a leaf child is its first packet with its number of triangles.
+	struct StackEntry {
+		float nearDist;
+		int index;
+		int trianglesCount;
+	};
+	StackEntry stack[wideStackSize];
+	int stackSize = 0;
+	StackEntry entry = { 0.f, 0, 0 };
+	while (true) {
+		if (entry.trianglesCount > 0) {
+			// Here we are considering only intersections through the front side of the triangles
+			triangleTests += entry.trianglesCount;
+			const int endPacketIdx = entry.index + (entry.trianglesCount + trianglePacketWidth - 1) / trianglePacketWidth;
+			for (int packetIdx = entry.index; packetIdx < endPacketIdx; packetIdx++) {
+				float dist = 0.f;
+				const int lane = TrianglePacketKernels::intersectClosest<level>(ray, bvh.packets[packetIdx], minDist, dist);
+				if (lane >= 0) {
+					triangleHits++;
+					minDist = dist;
+					closestRefIdx = packetIdx * trianglePacketWidth + lane;
+				}
+			}
+		} else {
+			const BvhWideNode &node = bvh.wideNodes[entry.index];
+			nodeVisits++;
+			float nearDists[bvhWideNodeWidth];
+			int hitMask = BvhWideKernels::intersectChildren(IsaTag<level>(), ray, invDirection, node, minDist, nearDists);
+			// Visit the closest hit child next and push the others, from the furthest to the closest.
+			// Most often one or two children are hit, which are handled without a sort,
+			// as the branches of sorting by the unpredictable distances would cost more than the box tests.
+			if (hitMask != 0) {
+				const int firstIdx = __builtin_ctz(hitMask);
+				hitMask &= hitMask - 1;
+				const StackEntry first = { nearDists[firstIdx], node.children[firstIdx], node.trianglesCounts[firstIdx] };
+				if (hitMask == 0) {
+					entry = first;
+					continue;
+				}
+				const int secondIdx = __builtin_ctz(hitMask);
+				hitMask &= hitMask - 1;
+				const StackEntry second = { nearDists[secondIdx], node.children[secondIdx], node.trianglesCounts[secondIdx] };
+				if (hitMask == 0) {
+					const bool isFirstCloser = first.nearDist < second.nearDist;
+					stack[stackSize++] = isFirstCloser ? second : first;
+					entry = isFirstCloser ? first : second;
+					continue;
+				}
+				// Three or four children, push all of them and sort them on the stack
+				const int firstPushedIdx = stackSize;
+				stack[stackSize++] = first;
+				stack[stackSize++] = second;
+				for (; hitMask != 0; hitMask &= hitMask - 1) {
+					const int childIdx = __builtin_ctz(hitMask);
+					stack[stackSize++] = { nearDists[childIdx], node.children[childIdx], node.trianglesCounts[childIdx] };
+				}
+				for (int pushedIdx = firstPushedIdx + 1; pushedIdx < stackSize; pushedIdx++) {
+					const StackEntry pushed = stack[pushedIdx];
+					int entryIdx = pushedIdx;
+					while (entryIdx > firstPushedIdx && stack[entryIdx - 1].nearDist < pushed.nearDist) {
+						stack[entryIdx] = stack[entryIdx - 1];
+						entryIdx--;
+					}
+					stack[entryIdx] = pushed;
+				}
+				entry = stack[--stackSize];
+				continue;
+			}
+		}
+
+		// Skip the children whose boxes are further than an intersection found since they were pushed
+		while (stackSize > 0 && stack[stackSize - 1].nearDist > minDist) {
+			stackSize--;
+		}
+		if (stackSize == 0) {
+			break;
+		}
+		entry = stack[--stackSize];
+	}
+
+	stats.nodeVisits += nodeVisits;
+	stats.triangleTests += triangleTests;
+	stats.triangleHits += triangleHits;
+	if (closestRefIdx < 0) {
+		return false;
+	}
+	hit.dist = minDist;
+	hit.refIdx = closestRefIdx;
+	return true;
+}
+
+/// Finds the closest intersection of each ray of a packet in the wide layout, see Bvh::intersect
+template<IsaLevel level>
+CPU_FORCE_INLINE static void intersectPacketWide(const Bvh &bvh, const RayPacket &packet, BvhHit *hits, bool *found, RayStats &stats) {
+	if (!packet.isCoherent) {
+		for (int i = 0; i < packet.raysCount; i++) {
+			found[i] = intersectRayWide<level>(bvh, packet.rays[i], hits[i], stats);
+		}
+		return;
+	}
+
+	// The children are visited in the order of their centers along the direction of the first ray
+	const Vec3f &origin = packet.rays[0].origin;
+	const Vec3f &direction = packet.rays[0].direction;
+
+	float minDists[rayPacketSize];
+	int closestRefIdxs[rayPacketSize];
+	// The largest of the closest intersection distances, no ray needs anything further
+	float packetMaxDist = 0.f;
+	for (int i = 0; i < packet.raysCount; i++) {
+		minDists[i] = hits[i].dist;
+		closestRefIdxs[i] = -1;
+		packetMaxDist = getMax(packetMaxDist, minDists[i]);
+	}
+
+	// Work is counted in locals and added to the stats once, at the end
+	int nodeVisits = 0;
+	int triangleTests = 0;
+	int triangleHits = 0;
+
+	// Stack of nodes that are still to be visited, each with the first ray that may intersect it.
+	// The rays before it have missed an ancestor of the node, so they miss the node too.
+	struct StackEntry {
+		int nodeIdx;
+		int firstRayIdx;
+	};
+	StackEntry stack[wideStackSize];
+	int stackSize = 0;
+	stack[stackSize++] = { 0, 0 };
+	while (stackSize > 0) {
+		const StackEntry entry = stack[--stackSize];
+		const BvhWideNode &node = bvh.wideNodes[entry.nodeIdx];
+		nodeVisits++;
+
+		// Find the children hit by some ray, with the first ray which hits each of them,
+		// sorted from the closest to the furthest
+		struct HitChild {
+			float order;
+			int childIdx;
+			int firstRayIdx;
+			BoundingBox box;
+		};
+		HitChild hitChildren[bvhWideNodeWidth];
+		int hitChildrenCount = 0;
+		for (int childIdx = 0; childIdx < node.childrenCount; childIdx++) {
+			const BoundingBox box = node.getChildBox(childIdx);
+			int firstRayIdx = entry.firstRayIdx;
+			if (packetBoxIntersection(packet, box, packetMaxDist)) {
+				while (
+					firstRayIdx < packet.raysCount
+					&& !rayBoxIntersection(packet.rays[firstRayIdx], packet.invDirections[firstRayIdx], box, minDists[firstRayIdx])
+				) {
+					firstRayIdx++;
+				}
+			} else {
+				firstRayIdx = packet.raysCount;
+			}
+			if (firstRayIdx == packet.raysCount) {
+				continue;
+			}
+			const HitChild hitChild = { dotProduct(box.getCenter() - origin, direction), childIdx, firstRayIdx, box };
+			int hitIdx = hitChildrenCount++;
+			while (hitIdx > 0 && hitChildren[hitIdx - 1].order > hitChild.order) {
+				hitChildren[hitIdx] = hitChildren[hitIdx - 1];
+				hitIdx--;
+			}
+			hitChildren[hitIdx] = hitChild;
+		}
+
+		// Intersect the leaves right away, from the closest
+		for (int hitIdx = 0; hitIdx < hitChildrenCount; hitIdx++) {
+			const HitChild &hitChild = hitChildren[hitIdx];
+			const int trianglesCount = node.trianglesCounts[hitChild.childIdx];
+			if (trianglesCount == 0) {
+				continue;
+			}
+			const int firstPacketIdx = node.children[hitChild.childIdx];
+			const int endPacketIdx = firstPacketIdx + node.getPacketsCount(hitChild.childIdx);
+			// The first active ray is already known to hit the leaf
+			for (int i = hitChild.firstRayIdx; i < packet.raysCount; i++) {
+				if (i > hitChild.firstRayIdx && !rayBoxIntersection(packet.rays[i], packet.invDirections[i], hitChild.box, minDists[i])) {
+					continue;
+				}
+				triangleTests += trianglesCount;
+				for (int packetIdx = firstPacketIdx; packetIdx < endPacketIdx; packetIdx++) {
+					float dist = 0.f;
+					const int lane = TrianglePacketKernels::intersectClosest<level>(packet.rays[i], bvh.packets[packetIdx], minDists[i], dist);
+					if (lane >= 0) {
+						triangleHits++;
+						minDists[i] = dist;
+						closestRefIdxs[i] = packetIdx * trianglePacketWidth + lane;
+					}
+				}
+			}
+			packetMaxDist = 0.f;
+			for (int i = 0; i < packet.raysCount; i++) {
+				packetMaxDist = getMax(packetMaxDist, minDists[i]);
+			}
+		}
+
+		// Push the inner children from the furthest, so that the closest one is visited next
+		for (int hitIdx = hitChildrenCount - 1; hitIdx >= 0; hitIdx--) {
+			const HitChild &hitChild = hitChildren[hitIdx];
+			if (node.trianglesCounts[hitChild.childIdx] == 0) {
+				stack[stackSize++] = { node.children[hitChild.childIdx], hitChild.firstRayIdx };
+			}
+		}
+	}
+
+	stats.nodeVisits += nodeVisits;
+	stats.triangleTests += triangleTests;
+	stats.triangleHits += triangleHits;
+	for (int i = 0; i < packet.raysCount; i++) {
+		found[i] = closestRefIdxs[i] >= 0;
+		if (found[i]) {
+			hits[i].dist = minDists[i];
+			hits[i].refIdx = closestRefIdxs[i];
+		}
+	}
+}
+
+/// Checks if a ray intersects any triangle closer than some distance in the wide layout, see Bvh::isOccluded
+template<IsaLevel level>
+CPU_FORCE_INLINE static bool isOccludedRayWide(const Bvh &bvh, const Ray &ray, float maxDist, RayStats &stats) {
+	const Vec3f invDirection = { 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+
+	// Work is counted in locals and added to the stats once, at the end
+	int nodeVisits = 0;
+	int triangleTests = 0;
+
+	// Stack of nodes that are still to be visited, any intersection will do so the order of the children doesn't matter
+	int stack[wideStackSize];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0) {
+		const BvhWideNode &node = bvh.wideNodes[stack[--stackSize]];
+		nodeVisits++;
+		float nearDists[bvhWideNodeWidth];
+		const int hitMask = BvhWideKernels::intersectChildren(IsaTag<level>(), ray, invDirection, node, maxDist, nearDists);
+		for (int childIdx = 0; childIdx < node.childrenCount; childIdx++) {
+			if (!(hitMask & (1 << childIdx))) {
+				continue;
+			}
+			const int trianglesCount = node.trianglesCounts[childIdx];
+			if (trianglesCount == 0) {
+				stack[stackSize++] = node.children[childIdx];
+				continue;
+			}
+			// Here we are considering intersections from both the front and the back side of the triangles
+			const int firstPacketIdx = node.children[childIdx];
+			for (int packetIdx = firstPacketIdx; packetIdx < firstPacketIdx + node.getPacketsCount(childIdx); packetIdx++) {
+				triangleTests += getMin(trianglePacketWidth, trianglesCount - (packetIdx - firstPacketIdx) * trianglePacketWidth);
+				if (TrianglePacketKernels::intersectAny<level>(ray, bvh.packets[packetIdx], maxDist)) {
+					stats.nodeVisits += nodeVisits;
+					stats.triangleTests += triangleTests;
+					stats.triangleHits++;
+					return true;
+				}
+			}
+		}
+	}
+
+	stats.nodeVisits += nodeVisits;
+	stats.triangleTests += triangleTests;
+	return false;
+}
+
+/// Traversal functions compiled for one instruction set level
+struct BvhKernels {
+	bool (*intersect)(const Bvh &bvh, const Ray &ray, BvhHit &hit, RayStats &stats);
+	void (*intersectPacket)(const Bvh &bvh, const RayPacket &packet, BvhHit *hits, bool *found, RayStats &stats);
+	bool (*isOccluded)(const Bvh &bvh, const Ray &ray, float maxDist, RayStats &stats);
+};
+
+/// Defines the traversal functions of a level, compiled with the target attribute of the level,
+/// so that the traversal and the triangle packet kernels it inlines use the level's instructions.
+/// Each function traverses the wide nodes if the hierarchy has them, and the binary ones otherwise.
+#define DEFINE_BVH_KERNELS(level, target) \
+	target static bool intersect##level(const Bvh &bvh, const Ray &ray, BvhHit &hit, RayStats &stats) { \
+		return bvh.wideNodes \
+			? intersectRayWide<IsaLevel::level>(bvh, ray, hit, stats) \
+			: intersectRay<IsaLevel::level>(bvh, ray, hit, stats); \
+	} \
+	target static void intersectPacket##level(const Bvh &bvh, const RayPacket &packet, BvhHit *hits, bool *found, RayStats &stats) { \
+		if (bvh.wideNodes) { \
+			intersectPacketWide<IsaLevel::level>(bvh, packet, hits, found, stats); \
+		} else { \
+			intersectPacket<IsaLevel::level>(bvh, packet, hits, found, stats); \
+		} \
+	} \
+	target static bool isOccluded##level(const Bvh &bvh, const Ray &ray, float maxDist, RayStats &stats) { \
+		return bvh.wideNodes \
+			? isOccludedRayWide<IsaLevel::level>(bvh, ray, maxDist, stats) \
+			: isOccludedRay<IsaLevel::level>(bvh, ray, maxDist, stats); \
+	} \
+	static const BvhKernels bvhKernels##level = { intersect##level, intersectPacket##level, isOccluded##level };
+
+DEFINE_BVH_KERNELS(Scalar, )
+#ifdef CPU_X86
+DEFINE_BVH_KERNELS(Sse42, CPU_TARGET_SSE42)
+DEFINE_BVH_KERNELS(Avx2, CPU_TARGET_AVX2)
+DEFINE_BVH_KERNELS(Avx512, CPU_TARGET_AVX512)
+#endif
+
+/// Returns the traversal functions of the level picked by CpuUtils
+static const BvhKernels& getBvhKernels() {
+	switch (CpuUtils::getIsaLevel()) {
+#ifdef CPU_X86
+	case IsaLevel::Avx512:
+		return bvhKernelsAvx512;
+	case IsaLevel::Avx2:
+		return bvhKernelsAvx2;
+	case IsaLevel::Sse42:
+		return bvhKernelsSse42;
+#endif
+	default:
+		return bvhKernelsScalar;
+	}
+}
+
+bool Bvh::intersect(const Ray &ray, BvhHit &hit, RayStats &stats) const {
+	return getBvhKernels().intersect(*this, ray, hit, stats);
+}
+
+void Bvh::intersect(const RayPacket &packet, BvhHit *hits, bool *found, RayStats &stats) const {
+	getBvhKernels().intersectPacket(*this, packet, hits, found, stats);
+}
+
+void Bvh::getIntersection(const Ray &ray, const BvhHit &hit, TriangleIntersection &intersection) const {
+	const BvhTriangleRef &ref = triangleRefs[hit.refIdx];
+	const Mesh &obj = objects[ref.meshIdx];
+	intersection.point = ray.origin + ray.direction * hit.dist;
+	intersection.mesh = &obj;
+	intersection.triangle = &obj.triangles[ref.triangleIdx];
+	intersection.normal = packets[hit.refIdx / trianglePacketWidth].getNormal(hit.refIdx % trianglePacketWidth);
+}
+
+bool Bvh::intersect(const Ray &ray, TriangleIntersection &intersection, RayStats &stats) const {
+	BvhHit hit;
+	if (!intersect(ray, hit, stats)) {
+		return false;
+	}
+	getIntersection(ray, hit, intersection);
+	return true;
+}
+
+void Bvh::intersect(const RayPacket &packet, TriangleIntersection *intersections, bool *found, RayStats &stats) const {
+	BvhHit hits[rayPacketSize];
+	intersect(packet, hits, found, stats);
+	for (int i = 0; i < packet.raysCount; i++) {
+		if (found[i]) {
+			getIntersection(packet.rays[i], hits[i], intersections[i]);
+		}
+	}
+}
+
+bool Bvh::isOccluded(const Ray &ray, float maxDist, RayStats &stats) const {
+	return getBvhKernels().isOccluded(*this, ray, maxDist, stats);
+}
\ No newline at end of file
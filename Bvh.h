@@ -0,0 +1,348 @@
+#pragma once
+
+#include "utils/MathUtils.h"
+#include "Mesh.h"
+#include "RayPacket.h"
+#include "RayStats.h"
+#include "TrianglePacket.h"
+#include "utils/FileUtils.h"
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+
+using namespace MathUtils;
+
+/// Reference to a single triangle of some mesh in the scene
+struct BvhTriangleRef {
+	/// Index of the mesh in the scene's objects array
+	int meshIdx = 0;
+	/// Index of the triangle in the mesh's triangles array
+	int triangleIdx = 0;
+};
+
+/// Node of a bounding volume hierarchy.
+/// Nodes are stored in depth-first order,
+/// so the left child of an inner node is always the node right after it.
+struct BvhNode {
+	/// Bounding box of all triangles under the node
+	BoundingBox box;
+	/// For an inner node - index of its right child.
+	/// For a leaf - index of its first packet in the packets array.
+	int offset = 0;
+	/// Number of triangles in a leaf, or of instances in a leaf of an InstanceBvh, 0 for inner nodes
+	int trianglesCount = 0;
+	/// Axis along which an inner node's children are split
+	int splitAxis = 0;
+
+	/// Checks if the node is a leaf
+	bool isLeaf() const { return trianglesCount > 0; }
+	/// Returns the number of packets of a leaf
+	int getPacketsCount() const { return (trianglesCount + trianglePacketWidth - 1) / trianglePacketWidth; }
+};
+
+/// Maximum number of children of a node of the wide layout
+static const int bvhWideNodeWidth = 4;
+
+/// Node of the compressed wide layout, made by collapsing the binary nodes into nodes with up to 4 children.
+/// The children's boxes are quantized to 8 bits on a grid over the node's own box,
+/// so that a whole node fits in a single cache line and the boxes of all its children are tested together.
+/// The quantized boxes are conservative - each contains its child's exact box.
+struct alignas(64) BvhWideNode {
+	/// Origin of the grid, the minimum corner of the node's box
+	float origin[3];
+	/// Exponent of the size of the grid's cells on each axis, a cell is 2^exponent wide
+	int8_t exponents[3];
+	/// Number of children, only the first childrenCount entries of the arrays below are used
+	uint8_t childrenCount;
+	/// Corners of the children's boxes in cells from the origin, for each axis and each child
+	uint8_t childMin[3][bvhWideNodeWidth];
+	uint8_t childMax[3][bvhWideNodeWidth];
+	/// For an inner child - index of its node.
+	/// For a leaf child - index of its first packet in the packets array.
+	int32_t children[bvhWideNodeWidth];
+	/// Number of triangles of a leaf child, 0 for inner children
+	uint16_t trianglesCounts[bvhWideNodeWidth];
+
+	/// Returns the size of the grid's cells on an axis
+	float getCellSize(int axis) const {
+		// Builds the power of two from its exponent bits, the exponents are kept in the range of normal floats
+		const uint32_t bits = uint32_t(exponents[axis] + 127) << 23;
+		float cellSize;
+		memcpy(&cellSize, &bits, sizeof(cellSize));
+		return cellSize;
+	}
+
+	/// Returns the quantized box of a child, computed in the same way as by the traversal kernels
+	BoundingBox getChildBox(int childIdx) const {
+		const float cellSizes[3] = { getCellSize(0), getCellSize(1), getCellSize(2) };
+		BoundingBox box;
+		box.min = {
+			origin[0] + float(childMin[0][childIdx]) * cellSizes[0],
+			origin[1] + float(childMin[1][childIdx]) * cellSizes[1],
+			origin[2] + float(childMin[2][childIdx]) * cellSizes[2]
+		};
+		box.max = {
+			origin[0] + float(childMax[0][childIdx]) * cellSizes[0],
+			origin[1] + float(childMax[1][childIdx]) * cellSizes[1],
+			origin[2] + float(childMax[2][childIdx]) * cellSizes[2]
+		};
+		return box;
+	}
+
+	/// Returns the number of packets of a leaf child
+	int getPacketsCount(int childIdx) const { return (trianglesCounts[childIdx] + trianglePacketWidth - 1) / trianglePacketWidth; }
+};
+
+static_assert(sizeof(BvhWideNode) == 64, "A wide node is expected to fill a cache line");
+
+/// Algorithms building the hierarchy.
+/// The values are stored in the BVH cache files, so new modes are added at the end.
+enum class BvhBuildMode {
+	/// SAH evaluated at every reference of every node, on a single thread
+	Sweep,
+	/// SAH evaluated at the borders of bins, on multiple threads
+	Binned,
+	/// Linear BVH split along a Morton curve, on multiple threads
+	Lbvh,
+	/// Binned SAH which also splits triangles between the children when it is cheaper, on a single thread.
+	/// The slowest to build and the fastest to trace.
+	Sbvh
+};
+
+/// Returns the name of a build mode, as accepted by parseBvhBuildMode
+const char *getBvhBuildModeName(BvhBuildMode mode);
+
+/// Parses the name of a build mode: sweep, binned, lbvh or sbvh
+/// @param[in] name Name of the mode
+/// @param[out] mode The parsed mode
+/// @return False if the name is unknown
+bool parseBvhBuildMode(const char *name, BvhBuildMode &mode);
+
+/// Layouts of the nodes which the rays traverse
+enum class BvhLayout {
+	/// The built nodes, with two children and full precision boxes
+	Binary,
+	/// Nodes with up to 4 children and quantized boxes, converted from the binary ones, see BvhWideNode
+	Wide
+};
+
+/// Returns the name of a layout, as accepted by parseBvhLayout
+const char *getBvhLayoutName(BvhLayout layout);
+
+/// Parses the name of a layout: binary or wide
+/// @param[in] name Name of the layout
+/// @param[out] layout The parsed layout
+/// @return False if the name is unknown
+bool parseBvhLayout(const char *name, BvhLayout &layout);
+
+/// Settings of building a hierarchy
+struct BvhBuildOptions {
+	/// Algorithm to build with
+	BvhBuildMode mode = BvhBuildMode::Binned;
+	/// Layout of the nodes traversed by the rays.
+	/// The binary nodes are always built, and kept for updates and for the cache, the wide ones are converted from them.
+	BvhLayout layout = BvhLayout::Binary;
+	/// Number of triangle references which the spatial splits of the sbvh mode may add, relative to the number of triangles.
+	/// A triangle split between several leaves is referenced, packed and intersected in each of them.
+	float spatialSplitBudget = 0.3f;
+	/// Number of threads for the parallel modes.
+	/// If it is 0 or less, the number of hardware threads is used.
+	int threadsCount = 0;
+	/// Directory of the BVH cache, where the hierarchies of the meshes are looked up before they are built,
+	/// and written to after they are built. The cache isn't used if it is empty.
+	std::string cacheDirectory;
+	/// When a hierarchy is updated after its meshes' vertices move, a subtree is rebuilt
+	/// if its SAH cost relative to its box grows to this many times its cost when it was built.
+	/// Other subtrees are only refit, to new boxes around the same triangles.
+	float rebuildThreshold = 1.3f;
+};
+
+/// Results of the last build of a hierarchy
+struct BvhBuildStats {
+	/// Mode the hierarchy was built with
+	BvhBuildMode mode = BvhBuildMode::Binned;
+	/// Spatial split budget the hierarchy was built with, used only by the sbvh mode
+	float spatialSplitBudget = 0.f;
+	/// Layout of the nodes traversed by the rays
+	BvhLayout layout = BvhLayout::Binary;
+	/// Time taken by the build, including packing the triangles
+	double seconds = 0.0;
+	/// SAH cost of the hierarchy relative to the area of the root, lower is faster to trace
+	float sahCost = 0.f;
+	/// Number of triangle references added by spatial splits, beyond one for each triangle
+	int duplicatedRefs = 0;
+	/// Numbers of the meshes' hierarchies loaded from the cache and built because they weren't in it
+	int cacheHits = 0;
+	int cacheMisses = 0;
+};
+
+/// Work done by updating hierarchies after their meshes' vertices move
+struct BvhUpdateStats {
+	/// Number of nodes refit to the moved triangles
+	int refitNodes = 0;
+	/// Number of subtrees rebuilt because their quality degraded, and the number of triangles in them
+	int rebuiltSubtrees = 0;
+	int rebuiltTriangles = 0;
+	/// Time taken by the update
+	double seconds = 0.0;
+};
+
+/// Closest intersection of a ray found so far in a hierarchy
+struct BvhHit {
+	/// Distance along the ray, only intersections closer than it are searched for
+	float dist = std::numeric_limits<float>::max();
+	/// Index of the intersected triangle's reference, -1 if none is found yet
+	int refIdx = -1;
+};
+
+/// Bounding volume hierarchy over the triangles of some meshes,
+/// built with the surface area heuristic (SAH).
+/// Used to find intersections of rays with the meshes without testing every triangle.
+/// The scene has one for each mesh, in the mesh's own space, and an InstanceBvh over the placed copies of the meshes.
+struct Bvh {
+	/// Builds the hierarchy over the triangles of some meshes.
+	/// The meshes are not copied, so they have to outlive the hierarchy.
+	/// @param[in] objects Array of meshes
+	/// @param[in] objectsCount Number of meshes in the array
+	/// @param[in] options Algorithm and number of threads to build with
+	void build(const Mesh *objects, int objectsCount, const BvhBuildOptions &options = BvhBuildOptions());
+
+	/// Finds the closest intersection of a ray with a front side of a triangle.
+	/// @param[in] ray The ray to be intersected with the scene
+	/// @param[out] intersection The closest intersection, if there is one
+	/// @param[in,out] stats Stats to which the work done is added
+	/// @return True if the ray intersects some triangle
+	bool intersect(const Ray &ray, TriangleIntersection &intersection, RayStats &stats) const;
+
+	/// Finds the closest intersection of a ray with a front side of a triangle, closer than an intersection found before.
+	/// Lets an InstanceBvh search several hierarchies for a single closest intersection.
+	/// @param[in] ray The ray to be intersected with the meshes
+	/// @param[in,out] hit The closest intersection found so far, replaced if a closer one is found
+	/// @param[in,out] stats Stats to which the work done is added
+	/// @return True if a closer intersection is found
+	bool intersect(const Ray &ray, BvhHit &hit, RayStats &stats) const;
+
+	/// Finds the closest intersection of each ray of a packet with a front side of a triangle.
+	/// A coherent packet traverses the hierarchy together, skipping nodes missed by all of its rays,
+	/// other packets are traced ray by ray. The results are the same as tracing each ray alone.
+	/// @param[in] packet The prepared packet of rays to be intersected with the scene
+	/// @param[out] intersections The closest intersection of each ray, if there is one
+	/// @param[out] found For each ray, true if it intersects some triangle
+	/// @param[in,out] stats Stats to which the work done is added, node visits are counted once per packet
+	void intersect(const RayPacket &packet, TriangleIntersection *intersections, bool *found, RayStats &stats) const;
+
+	/// Finds the closest intersection of each ray of a packet, closer than an intersection found before, see above
+	/// @param[in] packet The prepared packet of rays to be intersected with the meshes
+	/// @param[in,out] hits The closest intersection of each ray found so far, replaced if a closer one is found
+	/// @param[out] found For each ray, true if a closer intersection is found
+	/// @param[in,out] stats Stats to which the work done is added
+	void intersect(const RayPacket &packet, BvhHit *hits, bool *found, RayStats &stats) const;
+
+	/// Fills the intersection of a ray from an intersection found in the hierarchy
+	/// @param[in] ray The ray that was intersected
+	/// @param[in] hit The intersection found for the ray
+	/// @param[out] intersection The intersection's point, triangle and normal
+	void getIntersection(const Ray &ray, const BvhHit &hit, TriangleIntersection &intersection) const;
+
+	/// Checks if a ray intersects any triangle, from either side, closer than some distance.
+	/// Stops at the first intersection found, so it is cheaper than finding the closest one.
+	/// @param[in] ray The ray to be intersected with the scene
+	/// @param[in] maxDist Intersections at this distance along the ray or further are ignored
+	/// @param[in,out] stats Stats to which the work done is added
+	/// @return True if the ray intersects some triangle before maxDist
+	bool isOccluded(const Ray &ray, float maxDist, RayStats &stats) const;
+
+	/// Updates the hierarchy after the vertices of its meshes move, with the same triangles in the meshes.
+	/// The meshes' precomputed triangles have to be updated before.
+	/// Refits the boxes of all nodes bottom-up and rebuilds the subtrees whose quality degrades
+	/// past the threshold in the options, so a hierarchy updated every frame stays close to a rebuilt one.
+	/// @param[in] options Threshold of the rebuilds, algorithm and number of threads to rebuild with
+	/// @param[in,out] stats Stats to which the work done is added
+	void update(const BvhBuildOptions &options, BvhUpdateStats &stats);
+
+	/// Converts the binary nodes to the wide layout, which the rays traverse from then on instead of the binary nodes.
+	/// Each wide node takes the children of a binary node, and then repeatedly the children of its child with the largest box,
+	/// until it has 4 children or all of its children are leaves. The packets of the leaves are shared by both layouts.
+	/// Called by build and update when the options ask for the wide layout, and after loading from the cache.
+	void buildWideNodes();
+
+	/// Returns the size in bytes of the nodes traversed by the rays, in the layout they are traversed in
+	long long getNodesSize() const;
+
+	/// Frees the arrays, or unmaps the cache file they point into, leaving an empty hierarchy
+	void clear();
+
+	/// Loads the hierarchy of a single mesh from a file of the BVH cache.
+	/// The file is mapped to memory and the arrays point directly into the mapping.
+	/// Fails if the file is missing, or was written for a different geometry, build options or build of the renderer.
+	/// @param[in] filepath Path to the cache file
+	/// @param[in] mesh The mesh, which has to outlive the hierarchy
+	/// @param[in] geometryHash Hash of the mesh's geometry, see Mesh::getGeometryHash
+	/// @param[in] options Build mode and spatial split budget the hierarchy should be built with
+	/// @return True on success
+	bool loadFromCache(const std::string &filepath, const Mesh &mesh, uint64_t geometryHash, const BvhBuildOptions &options);
+
+	/// Writes the hierarchy of a single mesh to a file of the BVH cache.
+	/// The file is written under a temporary name and then renamed,
+	/// so a run reading the cache at the same time never sees a partially written file.
+	/// @param[in] filepath Path to the cache file
+	/// @param[in] mesh The mesh the hierarchy is built over
+	/// @param[in] geometryHash Hash of the mesh's geometry, see Mesh::getGeometryHash
+	/// @return True on success
+	bool saveToCache(const std::string &filepath, const Mesh &mesh, uint64_t geometryHash) const;
+
+	/// Array of nodes, the root is the first one
+	BvhNode *nodes = nullptr;
+	int nodesCount = 0;
+
+	/// Array of nodes of the wide layout, the root is the first one. Empty unless the hierarchy is traversed in the wide layout.
+	/// Points into wideNodesMemory, at the first multiple of 64 bytes, so that each node is in a single cache line.
+	BvhWideNode *wideNodes = nullptr;
+	int wideNodesCount = 0;
+	char *wideNodesMemory = nullptr;
+
+	/// Array of packets of the leaves' triangles, each leaf's packets are consecutive.
+	/// Points into packetsMemory, at the first multiple of the packets' alignment, or into the cache file.
+	TrianglePacket *packets = nullptr;
+	int packetsCount = 0;
+	char *packetsMemory = nullptr;
+
+	/// Array of triangle references, one for each lane of each packet.
+	/// The triangle in lane i of packet p is triangleRefs[p * trianglePacketWidth + i].
+	/// References of unused lanes have a mesh index of -1.
+	BvhTriangleRef *triangleRefs = nullptr;
+	int triangleRefsCount = 0;
+
+	/// Meshes over which the hierarchy is built
+	const Mesh *objects = nullptr;
+	int objectsCount = 0;
+
+	/// Results of the last build, with the SAH cost after the last update
+	BvhBuildStats buildStats;
+
+	/// Cache file mapped to memory, if the hierarchy was loaded from one
+	FileUtils::MappedFile cacheFile;
+
+	/// SAH cost of each node's subtree relative to the node's box when it was built, one for each node.
+	/// Computed by the first update, from the boxes which are still the built ones, and kept for the later ones.
+	float *builtCosts = nullptr;
+
+private: /* functions */
+	/// Frees the nodes of the wide layout, the rays traverse the binary nodes from then on
+	void clearWideNodes();
+
+	/// Recomputes the boxes of all nodes and the packets of all leaves from the meshes
+	/// @param[in,out] stats Stats to which the refit nodes are added
+	void refit(BvhUpdateStats &stats);
+
+	/// Rebuilds a subtree from the triangles in its leaves and puts it in place of the old one,
+	/// moving the nodes and packets after it if their number changes
+	/// @param[in] rootIdx Index of the subtree's root
+	/// @param[in] rootDepth Depth of the subtree's root in the whole hierarchy
+	/// @param[in] options Algorithm and number of threads to build with
+	/// @param[in,out] stats Stats to which the rebuilt subtree is added
+	/// @return False if the rebuilt subtree would make the hierarchy deeper than the traversal stack, nothing is changed then
+	bool rebuildSubtree(int rootIdx, int rootDepth, const BvhBuildOptions &options, BvhUpdateStats &stats);
+};
\ No newline at end of file
@@ -0,0 +1,1132 @@
+#include "BvhBuild.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <thread>
+
+/// Returns the number of intersection tests of a leaf with some number of primitives,
+/// which are intersected leafWidth at a time
+static int getLeafTestsCount(int primitivesCount, int leafWidth) {
+	return (primitivesCount + leafWidth - 1) / leafWidth;
+}
+
+/// Runs a function over a range split into equal chunks, one chunk per thread.
+/// The calling thread runs the first chunk. The chunks are the same for the same count and threads count.
+/// @param[in] count Size of the range
+/// @param[in] threadsCount Number of threads, and of chunks
+/// @param[in] func Function called with the index of the chunk and its range [begin, end)
+static void parallelFor(int count, int threadsCount, const std::function<void(int, int, int)> &func) {
+	std::vector<std::thread> threads;
+	for (int chunkIdx = 1; chunkIdx < threadsCount; chunkIdx++) {
+		threads.emplace_back(
+			func,
+			chunkIdx,
+			int((long long)(count) * chunkIdx / threadsCount),
+			int((long long)(count) * (chunkIdx + 1) / threadsCount)
+		);
+	}
+	func(0, 0, int((long long)(count) / threadsCount));
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+}
+
+/// Runs two tasks, the first one on a new thread if asked to, and waits for both
+static void runTasks(bool inParallel, const std::function<void()> &first, const std::function<void()> &second) {
+	if (!inParallel) {
+		first();
+		second();
+		return;
+	}
+	std::thread thread(first);
+	second();
+	thread.join();
+}
+
+/// Returns the number of levels of the hierarchy whose subtrees are built on threads of their own,
+/// a few more than needed to have a subtree per thread, so that unbalanced splits still keep all threads busy
+static int getParallelDepth(int threadsCount) {
+	int depth = 0;
+	while ((1 << depth) < threadsCount) {
+		depth++;
+	}
+	return threadsCount > 1 ? depth + 2 : 0;
+}
+
+// Full SAH sweep
+
+/// Sorts a range of build references by their centers along some axis
+static void sortBuildRefs(BvhBuildRef *refs, int count, int axis) {
+	std::sort(refs, refs + count, [axis](const BvhBuildRef &lhs, const BvhBuildRef &rhs) {
+		return getAxis(lhs.center, axis) < getAxis(rhs.center, axis);
+	});
+}
+
+/// Finds the best split of a range of build references with a full SAH sweep over all 3 axes.
+/// Leaves the references sorted along the best axis.
+/// @param[in] refs Range of build references to be split
+/// @param[in] count Number of references in the range
+/// @param[in] box Bounding box of all references in the range
+/// @param[in] leafWidth Number of primitives intersected together in a leaf
+/// @param[out] splitAxis Axis of the best split
+/// @param[out] splitIdx Number of references that go to the left child
+/// @return SAH cost of the best split, not normalized by the area of the box
+static float findBestSplit(BvhBuildRef *refs, int count, const BoundingBox &box, int leafWidth, int &splitAxis, int &splitIdx) {
+	float bestCost = std::numeric_limits<float>::max();
+	splitAxis = box.getLargestAxis();
+	splitIdx = count / 2;
+
+	// Area of the right side's box for each possible split position
+	std::vector<float> rightAreas(count);
+	for (int axis = 0; axis < 3; axis++) {
+		sortBuildRefs(refs, count, axis);
+		// Sweep from the right to find the areas of all possible right sides
+		BoundingBox rightBox;
+		for (int i = count - 1; i > 0; i--) {
+			rightBox.expand(refs[i].box);
+			rightAreas[i] = rightBox.getSurfaceArea();
+		}
+		// Sweep from the left and evaluate the cost of each split position
+		BoundingBox leftBox;
+		for (int i = 1; i < count; i++) {
+			leftBox.expand(refs[i - 1].box);
+			const float cost = leftBox.getSurfaceArea() * float(getLeafTestsCount(i, leafWidth))
+				+ rightAreas[i] * float(getLeafTestsCount(count - i, leafWidth));
+			if (cost < bestCost) {
+				bestCost = cost;
+				splitAxis = axis;
+				splitIdx = i;
+			}
+		}
+	}
+	// Leave the references sorted by the best axis, the last sort was by Z
+	if (splitAxis != 2) {
+		sortBuildRefs(refs, count, splitAxis);
+	}
+
+	return traversalCost * box.getSurfaceArea() + intersectionCost * bestCost;
+}
+
+/// Recursively builds a subtree over a range of build references
+/// @param[in] nodes Array of nodes built so far, the subtree's nodes are appended to it
+/// @param[in] refs Range of build references under the subtree
+/// @param[in] count Number of references in the range
+/// @param[in] firstRefIdx Index of the first reference of the range in the whole array of references
+/// @param[in] leafWidth Number of primitives intersected together in a leaf
+/// @param[in] depth Depth of the subtree's root
+static void buildSweepSubtree(std::vector<BvhNode> &nodes, BvhBuildRef *refs, int count, int firstRefIdx, int leafWidth, int depth) {
+	const int nodeIdx = int(nodes.size());
+	nodes.emplace_back();
+	for (int i = 0; i < count; i++) {
+		nodes[nodeIdx].box.expand(refs[i].box);
+	}
+	const BoundingBox box = nodes[nodeIdx].box;
+
+	// Make a leaf if there are too few triangles to split or the hierarchy is too deep already
+	if (count <= 1 || depth >= maxDepth - 1) {
+		nodes[nodeIdx].offset = firstRefIdx;
+		nodes[nodeIdx].trianglesCount = count;
+		return;
+	}
+
+	int splitAxis = 0;
+	int splitIdx = 0;
+	const float splitCost = findBestSplit(refs, count, box, leafWidth, splitAxis, splitIdx);
+	// Make a leaf if it is cheaper than splitting and small enough
+	const float leafCost = intersectionCost * box.getSurfaceArea() * float(getLeafTestsCount(count, leafWidth));
+	if (count <= leafWidth && leafCost <= splitCost) {
+		nodes[nodeIdx].offset = firstRefIdx;
+		nodes[nodeIdx].trianglesCount = count;
+		return;
+	}
+
+	nodes[nodeIdx].splitAxis = splitAxis;
+	// The left child is right after this node
+	buildSweepSubtree(nodes, refs, splitIdx, firstRefIdx, leafWidth, depth + 1);
+	// The right child comes after the whole left subtree
+	nodes[nodeIdx].offset = int(nodes.size());
+	buildSweepSubtree(nodes, refs + splitIdx, count - splitIdx, firstRefIdx + splitIdx, leafWidth, depth + 1);
+}
+
+void buildSweepSah(std::vector<BvhNode> &nodes, std::vector<BvhBuildRef> &refs, int leafWidth) {
+	nodes.clear();
+	nodes.reserve(refs.size() * 2);
+	buildSweepSubtree(nodes, refs.data(), int(refs.size()), 0, leafWidth, 0);
+}
+
+// Temporary tree of the parallel builders
+
+/// Node of the tree built by the parallel builders.
+/// Threads create the nodes of their subtrees in any order, so the children are linked by index,
+/// and the tree is flattened to depth-first order at the end.
+struct BuildTreeNode {
+	/// Bounding box of all triangles under the node
+	BoundingBox box;
+	/// Indices of the children of an inner node, -1 for leaves
+	int left = -1;
+	int right = -1;
+	/// Range of the build references of a leaf
+	int firstRefIdx = 0;
+	int refsCount = 0;
+	/// Axis along which an inner node's children are split
+	int splitAxis = 0;
+};
+
+/// Tree of a parallel build, shared by all threads building it
+struct BuildTree {
+	/// Creates a tree with room for the most nodes a tree over some number of references can have
+	BuildTree(int refsCount)
+		: nodes(getMax(1, 2 * refsCount - 1))
+		, nodesCount(1)
+	{}
+
+	/// Reserves 2 nodes for the children of a node
+	/// @return Index of the first of them
+	int allocateChildren() {
+		return nodesCount.fetch_add(2);
+	}
+
+	/// Appends a subtree to the nodes of a hierarchy in depth-first order
+	/// @param[in] treeIdx Index of the subtree's root in the tree
+	/// @param[in,out] bvhNodes Nodes of the hierarchy
+	void flatten(int treeIdx, std::vector<BvhNode> &bvhNodes) const {
+		const BuildTreeNode &treeNode = nodes[treeIdx];
+		const int nodeIdx = int(bvhNodes.size());
+		bvhNodes.emplace_back();
+		bvhNodes[nodeIdx].box = treeNode.box;
+		if (treeNode.left < 0) {
+			bvhNodes[nodeIdx].offset = treeNode.firstRefIdx;
+			bvhNodes[nodeIdx].trianglesCount = treeNode.refsCount;
+			return;
+		}
+		bvhNodes[nodeIdx].splitAxis = treeNode.splitAxis;
+		flatten(treeNode.left, bvhNodes);
+		bvhNodes[nodeIdx].offset = int(bvhNodes.size());
+		flatten(treeNode.right, bvhNodes);
+	}
+
+	/// All nodes, the root is the first one. Never reallocated, so threads can keep references to their nodes.
+	std::vector<BuildTreeNode> nodes;
+	std::atomic<int> nodesCount;
+};
+
+// Binned SAH
+
+/// Number of bins per axis for the binned SAH
+static const int binsCount = 32;
+/// Nodes with at least this many references are binned by all threads
+static const int parallelBinningMinRefs = 1 << 16;
+/// Subtrees with fewer references than this are built on the thread which reached them
+static const int parallelSubtreeMinRefs = 1 << 12;
+
+/// Bin of references whose centers fall into some slice of a node along some axis
+struct SahBin {
+	/// Bounding box of the bin's references
+	BoundingBox box;
+	/// Number of the bin's references
+	int count = 0;
+};
+
+/// Data shared by all threads of a binned SAH build
+struct BinnedBuildContext {
+	BuildTree &tree;
+	BvhBuildRef *refs;
+	int leafWidth;
+	int threadsCount;
+	/// Levels of the tree whose subtrees are built on new threads
+	int parallelDepth;
+};
+
+/// Bounding boxes of a range of references and of their centers
+struct RefsBounds {
+	BoundingBox box;
+	BoundingBox centerBox;
+
+	void expand(const RefsBounds &other) {
+		box.expand(other.box);
+		centerBox.expand(other.centerBox);
+	}
+};
+
+/// Computes the bounds of a range of references, with all threads if the range is large
+static RefsBounds computeRefsBounds(const BinnedBuildContext &context, int firstRefIdx, int count) {
+	const int threadsCount = count >= parallelBinningMinRefs ? context.threadsCount : 1;
+	std::vector<RefsBounds> chunksBounds(threadsCount);
+	parallelFor(count, threadsCount, [&](int chunkIdx, int begin, int end) {
+		RefsBounds &bounds = chunksBounds[chunkIdx];
+		for (int i = firstRefIdx + begin; i < firstRefIdx + end; i++) {
+			bounds.box.expand(context.refs[i].box);
+			bounds.centerBox.expand(context.refs[i].center);
+		}
+	});
+	for (int chunkIdx = 1; chunkIdx < threadsCount; chunkIdx++) {
+		chunksBounds[0].expand(chunksBounds[chunkIdx]);
+	}
+	return chunksBounds[0];
+}
+
+/// Maps centers along some axis to bins
+struct BinMapping {
+	BinMapping(const BoundingBox &centerBox, int axis)
+		: min(getAxis(centerBox.min, axis))
+		, scale(float(binsCount) / (getAxis(centerBox.max, axis) - min))
+		, axis(axis)
+	{}
+
+	/// Returns the bin of a reference
+	int getBinIdx(const BvhBuildRef &ref) const {
+		return getMin(binsCount - 1, int((getAxis(ref.center, axis) - min) * scale));
+	}
+
+	float min;
+	float scale;
+	int axis;
+};
+
+/// Recursively builds a subtree over a range of build references with the binned SAH
+/// @param[in] context Data shared by all threads of the build
+/// @param[in] treeIdx Index of the subtree's root in the tree
+/// @param[in] firstRefIdx Index of the first reference of the range
+/// @param[in] count Number of references in the range
+/// @param[in] depth Depth of the subtree's root
+static void buildBinnedSubtree(const BinnedBuildContext &context, int treeIdx, int firstRefIdx, int count, int depth) {
+	BuildTreeNode &node = context.tree.nodes[treeIdx];
+	const RefsBounds bounds = computeRefsBounds(context, firstRefIdx, count);
+	node.box = bounds.box;
+	node.firstRefIdx = firstRefIdx;
+	node.refsCount = count;
+
+	// Make a leaf if there are too few triangles to split or the hierarchy is too deep already
+	if (count <= 1 || depth >= maxDepth - 1) {
+		return;
+	}
+
+	// Bin the references along each axis on which their centers are not all the same
+	SahBin bins[3][binsCount];
+	const bool canBin[3] = {
+		bounds.centerBox.max.x > bounds.centerBox.min.x,
+		bounds.centerBox.max.y > bounds.centerBox.min.y,
+		bounds.centerBox.max.z > bounds.centerBox.min.z
+	};
+	const int threadsCount = count >= parallelBinningMinRefs ? context.threadsCount : 1;
+	std::vector<SahBin> chunksBins(threadsCount * 3 * binsCount);
+	parallelFor(count, threadsCount, [&](int chunkIdx, int begin, int end) {
+		SahBin *chunkBins = &chunksBins[chunkIdx * 3 * binsCount];
+		for (int axis = 0; axis < 3; axis++) {
+			if (!canBin[axis]) {
+				continue;
+			}
+			const BinMapping mapping(bounds.centerBox, axis);
+			for (int i = firstRefIdx + begin; i < firstRefIdx + end; i++) {
+				SahBin &bin = chunkBins[axis * binsCount + mapping.getBinIdx(context.refs[i])];
+				bin.box.expand(context.refs[i].box);
+				bin.count++;
+			}
+		}
+	});
+	for (int chunkIdx = 0; chunkIdx < threadsCount; chunkIdx++) {
+		for (int axis = 0; axis < 3; axis++) {
+			for (int binIdx = 0; binIdx < binsCount; binIdx++) {
+				const SahBin &chunkBin = chunksBins[(chunkIdx * 3 + axis) * binsCount + binIdx];
+				bins[axis][binIdx].box.expand(chunkBin.box);
+				bins[axis][binIdx].count += chunkBin.count;
+			}
+		}
+	}
+
+	// Evaluate the SAH at the borders between the bins
+	float bestCost = std::numeric_limits<float>::max();
+	int splitAxis = -1;
+	int splitBinIdx = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		if (!canBin[axis]) {
+			continue;
+		}
+		// Sweep from the right to find the areas and counts of all possible right sides
+		float rightAreas[binsCount];
+		int rightCounts[binsCount];
+		BoundingBox rightBox;
+		int rightCount = 0;
+		for (int binIdx = binsCount - 1; binIdx > 0; binIdx--) {
+			rightBox.expand(bins[axis][binIdx].box);
+			rightCount += bins[axis][binIdx].count;
+			rightAreas[binIdx] = rightBox.getSurfaceArea();
+			rightCounts[binIdx] = rightCount;
+		}
+		// Sweep from the left and evaluate the cost of each border
+		BoundingBox leftBox;
+		int leftCount = 0;
+		for (int binIdx = 1; binIdx < binsCount; binIdx++) {
+			leftBox.expand(bins[axis][binIdx - 1].box);
+			leftCount += bins[axis][binIdx - 1].count;
+			if (leftCount == 0 || rightCounts[binIdx] == 0) {
+				continue;
+			}
+			const float cost = leftBox.getSurfaceArea() * float(getLeafTestsCount(leftCount, context.leafWidth))
+				+ rightAreas[binIdx] * float(getLeafTestsCount(rightCounts[binIdx], context.leafWidth));
+			if (cost < bestCost) {
+				bestCost = cost;
+				splitAxis = axis;
+				splitBinIdx = binIdx;
+			}
+		}
+	}
+
+	// Make a leaf if it is cheaper than splitting and small enough
+	const float splitCost = traversalCost * node.box.getSurfaceArea() + intersectionCost * bestCost;
+	const float leafCost = intersectionCost * node.box.getSurfaceArea() * float(getLeafTestsCount(count, context.leafWidth));
+	if (count <= context.leafWidth && leafCost <= splitCost) {
+		return;
+	}
+
+	BvhBuildRef *refs = context.refs + firstRefIdx;
+	int splitIdx = 0;
+	if (splitAxis >= 0) {
+		const BinMapping mapping(bounds.centerBox, splitAxis);
+		splitIdx = int(std::partition(refs, refs + count, [&mapping, splitBinIdx](const BvhBuildRef &ref) {
+			return mapping.getBinIdx(ref) < splitBinIdx;
+		}) - refs);
+	} else {
+		// All centers are the same, any split is as good as any other
+		splitAxis = node.box.getLargestAxis();
+		splitIdx = count / 2;
+	}
+
+	node.splitAxis = splitAxis;
+	node.left = context.tree.allocateChildren();
+	node.right = node.left + 1;
+	const int leftIdx = node.left;
+	const int rightIdx = node.right;
+	runTasks(
+		depth < context.parallelDepth && count >= parallelSubtreeMinRefs,
+		[&]() { buildBinnedSubtree(context, leftIdx, firstRefIdx, splitIdx, depth + 1); },
+		[&]() { buildBinnedSubtree(context, rightIdx, firstRefIdx + splitIdx, count - splitIdx, depth + 1); }
+	);
+}
+
+void buildBinnedSah(std::vector<BvhNode> &nodes, std::vector<BvhBuildRef> &refs, int leafWidth, int threadsCount) {
+	BuildTree tree(int(refs.size()));
+	const BinnedBuildContext context = { tree, refs.data(), leafWidth, threadsCount, getParallelDepth(threadsCount) };
+	buildBinnedSubtree(context, 0, 0, int(refs.size()), 0);
+
+	nodes.clear();
+	nodes.reserve(tree.nodesCount);
+	tree.flatten(0, nodes);
+}
+
+// Spatial split BVH
+
+/// Spatial splits are tried only in nodes whose best object split has children overlapping by at least
+/// this fraction of the root's area, elsewhere they can't gain enough to be worth the duplicated references
+static const float spatialSplitMinOverlap = 1e-5f;
+/// Margin by which the clipped boxes grow on the axes other than the clipping one, relative to their coordinates,
+/// so that they cover the rounding of the points where the triangles' edges cross the planes
+static const float clippedBoxMargin = 1e-6f;
+
+/// Returns a copy of a point with the coordinate along some axis replaced
+static Vec3f withAxis(const Vec3f &point, int axis, float value) {
+	return {
+		axis == 0 ? value : point.x,
+		axis == 1 ? value : point.y,
+		axis == 2 ? value : point.z
+	};
+}
+
+/// Returns the intersection of two boxes, empty if they don't overlap
+static BoundingBox intersectBoxes(const BoundingBox &a, const BoundingBox &b) {
+	return BoundingBox(
+		{ getMax(a.min.x, b.min.x), getMax(a.min.y, b.min.y), getMax(a.min.z, b.min.z) },
+		{ getMin(a.max.x, b.max.x), getMin(a.max.y, b.max.y), getMin(a.max.z, b.max.z) }
+	);
+}
+
+/// Checks if a box contains no points
+static bool isBoxEmpty(const BoundingBox &box) {
+	return box.min.x > box.max.x || box.min.y > box.max.y || box.min.z > box.max.z;
+}
+
+/// Returns the box of the part of a reference's triangle between two planes perpendicular to an axis.
+/// The box is within the reference's box, which is already clipped if the reference is a part of a split triangle.
+/// @param[in] ref The reference
+/// @param[in] objects Meshes of the references
+/// @param[in] axis Axis of the planes
+/// @param[in] slabMin Position of the lower plane
+/// @param[in] slabMax Position of the upper plane
+/// @return The box, empty if the triangle doesn't reach between the planes within the reference's box
+static BoundingBox clipBuildRef(const BvhBuildRef &ref, const Mesh *objects, int axis, float slabMin, float slabMax) {
+	const Mesh &mesh = objects[ref.ref.meshIdx];
+	const Vec3i &triangle = mesh.triangles[ref.ref.triangleIdx];
+	const Vec3f vertices[3] = { mesh.vertices[triangle.x], mesh.vertices[triangle.y], mesh.vertices[triangle.z] };
+
+	// The clipped polygon's corners are the vertices between the planes and the points where the edges cross the planes
+	BoundingBox box;
+	for (int i = 0; i < 3; i++) {
+		const Vec3f &a = vertices[i];
+		const Vec3f &b = vertices[(i + 1) % 3];
+		const float aPos = getAxis(a, axis);
+		const float bPos = getAxis(b, axis);
+		if (aPos >= slabMin && aPos <= slabMax) {
+			box.expand(a);
+		}
+		for (const float plane : { slabMin, slabMax }) {
+			if ((aPos < plane && bPos > plane) || (aPos > plane && bPos < plane)) {
+				const float t = (plane - aPos) / (bPos - aPos);
+				box.expand(withAxis(a + (b - a) * t, axis, plane));
+			}
+		}
+	}
+	if (isBoxEmpty(box)) {
+		return box;
+	}
+
+	const Vec3f margin = {
+		clippedBoxMargin * getMax(std::abs(box.min.x), std::abs(box.max.x)),
+		clippedBoxMargin * getMax(std::abs(box.min.y), std::abs(box.max.y)),
+		clippedBoxMargin * getMax(std::abs(box.min.z), std::abs(box.max.z))
+	};
+	box.min = withAxis(box.min - margin, axis, getAxis(box.min, axis));
+	box.max = withAxis(box.max + margin, axis, getAxis(box.max, axis));
+	return intersectBoxes(box, ref.box);
+}
+
+/// Bin of a spatial split, a slice of a node's box along some axis
+struct SpatialBin {
+	/// Bounding box of the parts of the references clipped to the slice
+	BoundingBox box;
+	/// Numbers of references which start and which end in the slice
+	int entries = 0;
+	int exits = 0;
+};
+
+/// Expands the boxes of spatial bins by the parts of a reference's triangle in them,
+/// in a single pass over the triangle's edges, for a reference that spans several bins.
+/// The parts are clipped only along the bins' axis and to the reference's box,
+/// they are used for the cost of the splits, and the references are clipped exactly when they are split.
+/// @param[in] ref The reference
+/// @param[in] objects Meshes of the references
+/// @param[in] axis Axis of the bins
+/// @param[in] min Position of the first bin's lower border
+/// @param[in] binSize Size of each bin along the axis
+/// @param[in] firstBinIdx Bin in which the reference starts
+/// @param[in] lastBinIdx Bin in which the reference ends
+/// @param[in,out] bins The bins
+static void binSpanningBuildRef(
+	const BvhBuildRef &ref,
+	const Mesh *objects,
+	int axis,
+	float min,
+	float binSize,
+	int firstBinIdx,
+	int lastBinIdx,
+	SpatialBin *bins
+) {
+	const Mesh &mesh = objects[ref.ref.meshIdx];
+	const Vec3i &triangle = mesh.triangles[ref.ref.triangleIdx];
+	const Vec3f vertices[3] = { mesh.vertices[triangle.x], mesh.vertices[triangle.y], mesh.vertices[triangle.z] };
+
+	// Planes between the parts, the first and the last one are the sides of the reference's box
+	const int partsCount = lastBinIdx - firstBinIdx + 1;
+	float planes[binsCount + 1];
+	planes[0] = getAxis(ref.box.min, axis);
+	for (int planeIdx = 1; planeIdx < partsCount; planeIdx++) {
+		planes[planeIdx] = min + float(firstBinIdx + planeIdx) * binSize;
+	}
+	planes[partsCount] = getAxis(ref.box.max, axis);
+
+	BoundingBox partBoxes[binsCount];
+	for (int i = 0; i < 3; i++) {
+		const Vec3f &a = vertices[i];
+		const Vec3f &b = vertices[(i + 1) % 3];
+		const float aPos = getAxis(a, axis);
+		const float bPos = getAxis(b, axis);
+		if (aPos >= planes[0] && aPos <= planes[partsCount]) {
+			const int partIdx = getMax(0, getMin(partsCount - 1, int((aPos - min) / binSize) - firstBinIdx));
+			partBoxes[partIdx].expand(a);
+		}
+		// A point where the edge crosses a plane is in the parts on both sides of the plane
+		for (int planeIdx = 0; planeIdx <= partsCount; planeIdx++) {
+			const float plane = planes[planeIdx];
+			if ((aPos < plane && bPos > plane) || (aPos > plane && bPos < plane)) {
+				const Vec3f point = withAxis(a + (b - a) * ((plane - aPos) / (bPos - aPos)), axis, plane);
+				if (planeIdx > 0) {
+					partBoxes[planeIdx - 1].expand(point);
+				}
+				if (planeIdx < partsCount) {
+					partBoxes[planeIdx].expand(point);
+				}
+			}
+		}
+	}
+	for (int partIdx = 0; partIdx < partsCount; partIdx++) {
+		const BoundingBox partBox = intersectBoxes(partBoxes[partIdx], ref.box);
+		if (!isBoxEmpty(partBox)) {
+			bins[firstBinIdx + partIdx].box.expand(partBox);
+		}
+	}
+}
+
+/// Best split of a node's references found so far
+struct BinnedSplit {
+	/// SAH cost of the split, not normalized by the area of the node's box
+	float cost = std::numeric_limits<float>::max();
+	/// Axis of the split, -1 if no split is found
+	int axis = -1;
+	/// Border between the bins at which the references are split
+	int binIdx = 0;
+	/// Bounding boxes of the children
+	BoundingBox leftBox;
+	BoundingBox rightBox;
+};
+
+/// Evaluates the SAH at the borders between bins along an axis, and keeps the best border in a split if it is cheaper
+/// @param[in] binBoxes Bounding box of the references in each bin
+/// @param[in] entries Number of references starting in each bin, which are on the left of the borders after the bin
+/// @param[in] exits Number of references ending in each bin, which are on the right of the borders before the bin
+/// @param[in] refsCount Number of references in all bins, references crossing a border are on both of its sides
+/// @param[in] maxDuplicates Borders crossed by more references than this are skipped
+/// @param[in] axis Axis of the bins
+/// @param[in] leafWidth Number of primitives intersected together in a leaf
+/// @param[in,out] split The best split so far
+static void evaluateBinBorders(
+	const BoundingBox *binBoxes,
+	const int *entries,
+	const int *exits,
+	int refsCount,
+	int maxDuplicates,
+	int axis,
+	int leafWidth,
+	BinnedSplit &split
+) {
+	// Sweep from the right to find the boxes and counts of all possible right sides
+	BoundingBox rightBoxes[binsCount];
+	int rightCounts[binsCount];
+	BoundingBox rightBox;
+	int rightCount = 0;
+	for (int binIdx = binsCount - 1; binIdx > 0; binIdx--) {
+		rightBox.expand(binBoxes[binIdx]);
+		rightCount += exits[binIdx];
+		rightBoxes[binIdx] = rightBox;
+		rightCounts[binIdx] = rightCount;
+	}
+	// Sweep from the left and evaluate the cost of each border
+	BoundingBox leftBox;
+	int leftCount = 0;
+	for (int binIdx = 1; binIdx < binsCount; binIdx++) {
+		leftBox.expand(binBoxes[binIdx - 1]);
+		leftCount += entries[binIdx - 1];
+		if (leftCount == 0 || rightCounts[binIdx] == 0 || leftCount + rightCounts[binIdx] - refsCount > maxDuplicates) {
+			continue;
+		}
+		const float cost = leftBox.getSurfaceArea() * float(getLeafTestsCount(leftCount, leafWidth))
+			+ rightBoxes[binIdx].getSurfaceArea() * float(getLeafTestsCount(rightCounts[binIdx], leafWidth));
+		if (cost < split.cost) {
+			split.cost = cost;
+			split.axis = axis;
+			split.binIdx = binIdx;
+			split.leftBox = leftBox;
+			split.rightBox = rightBoxes[binIdx];
+		}
+	}
+}
+
+/// Data shared by all nodes of a spatial split build
+struct SpatialBuildContext {
+	std::vector<BvhNode> &nodes;
+	/// References of the leaves built so far, in the order of the leaves
+	std::vector<BvhBuildRef> &leafRefs;
+	/// Meshes of the references, whose triangles are clipped
+	const Mesh *objects;
+	int leafWidth;
+	/// Area of the overlap of an object split's children from which spatial splits are tried
+	float minOverlapArea;
+};
+
+/// Finds the best split of references by the bins of their centers, in the same way as the binned SAH
+/// @param[in] refs The references
+/// @param[in] centerBox Bounding box of the references' centers
+/// @param[in] leafWidth Number of primitives intersected together in a leaf
+static BinnedSplit findObjectSplit(const std::vector<BvhBuildRef> &refs, const BoundingBox &centerBox, int leafWidth) {
+	BinnedSplit split;
+	for (int axis = 0; axis < 3; axis++) {
+		if (!(getAxis(centerBox.max, axis) > getAxis(centerBox.min, axis))) {
+			continue;
+		}
+		BoundingBox binBoxes[binsCount];
+		int binCounts[binsCount] = {};
+		const BinMapping mapping(centerBox, axis);
+		for (const BvhBuildRef &ref : refs) {
+			const int binIdx = mapping.getBinIdx(ref);
+			binBoxes[binIdx].expand(ref.box);
+			binCounts[binIdx]++;
+		}
+		// Each reference is in a single bin, so it starts and ends there
+		evaluateBinBorders(binBoxes, binCounts, binCounts, int(refs.size()), 0, axis, leafWidth, split);
+	}
+	return split;
+}
+
+/// Finds the best split of references by planes between uniform bins of a node's box.
+/// References crossing a plane are clipped to each side of it, so both children get a box around only their part.
+/// @param[in] context Data shared by the whole build
+/// @param[in] refs The references
+/// @param[in] box Bounding box of the references
+/// @param[in] maxDuplicates Splits crossed by more references than this are skipped
+static BinnedSplit findSpatialSplit(const SpatialBuildContext &context, const std::vector<BvhBuildRef> &refs, const BoundingBox &box, int maxDuplicates) {
+	BinnedSplit split;
+	for (int axis = 0; axis < 3; axis++) {
+		const float min = getAxis(box.min, axis);
+		const float binSize = (getAxis(box.max, axis) - min) / float(binsCount);
+		if (!(binSize > 0.f)) {
+			continue;
+		}
+		auto getBinIdx = [min, binSize](float position) {
+			return getMax(0, getMin(binsCount - 1, int((position - min) / binSize)));
+		};
+
+		SpatialBin bins[binsCount];
+		for (const BvhBuildRef &ref : refs) {
+			const int firstBinIdx = getBinIdx(getAxis(ref.box.min, axis));
+			const int lastBinIdx = getMax(firstBinIdx, getBinIdx(getAxis(ref.box.max, axis)));
+			if (firstBinIdx == lastBinIdx) {
+				bins[firstBinIdx].box.expand(ref.box);
+			} else {
+				binSpanningBuildRef(ref, context.objects, axis, min, binSize, firstBinIdx, lastBinIdx, bins);
+			}
+			bins[firstBinIdx].entries++;
+			bins[lastBinIdx].exits++;
+		}
+
+		BoundingBox binBoxes[binsCount];
+		int entries[binsCount];
+		int exits[binsCount];
+		for (int binIdx = 0; binIdx < binsCount; binIdx++) {
+			binBoxes[binIdx] = bins[binIdx].box;
+			entries[binIdx] = bins[binIdx].entries;
+			exits[binIdx] = bins[binIdx].exits;
+		}
+		evaluateBinBorders(binBoxes, entries, exits, int(refs.size()), maxDuplicates, axis, context.leafWidth, split);
+	}
+	return split;
+}
+
+/// Returns the position of a spatial split's plane
+static float getSpatialSplitPosition(const BinnedSplit &split, const BoundingBox &box) {
+	const float min = getAxis(box.min, split.axis);
+	const float binSize = (getAxis(box.max, split.axis) - min) / float(binsCount);
+	return min + float(split.binIdx) * binSize;
+}
+
+/// Distributes references to the children of a spatial split, splitting the ones which cross the plane.
+/// A crossing reference is kept whole on one side instead when that is cheaper (reference unsplitting),
+/// or when the budget of duplicated references is used up.
+/// @param[in] context Data shared by the whole build
+/// @param[in] refs The references
+/// @param[in] axis Axis of the split
+/// @param[in] position Position of the split's plane
+/// @param[in] maxDuplicates Number of references which may be split
+/// @param[out] leftRefs References of the left child
+/// @param[out] rightRefs References of the right child
+/// @return Number of split references, which are in both children
+static int partitionSpatialSplit(
+	const SpatialBuildContext &context,
+	const std::vector<BvhBuildRef> &refs,
+	int axis,
+	float position,
+	int maxDuplicates,
+	std::vector<BvhBuildRef> &leftRefs,
+	std::vector<BvhBuildRef> &rightRefs
+) {
+	// The references on one side of the plane go to it, and make the children's boxes to which the crossing ones are compared
+	BoundingBox leftBox;
+	BoundingBox rightBox;
+	std::vector<const BvhBuildRef *> crossingRefs;
+	for (const BvhBuildRef &ref : refs) {
+		if (getAxis(ref.box.max, axis) <= position) {
+			leftRefs.push_back(ref);
+			leftBox.expand(ref.box);
+		} else if (getAxis(ref.box.min, axis) >= position) {
+			rightRefs.push_back(ref);
+			rightBox.expand(ref.box);
+		} else {
+			crossingRefs.push_back(&ref);
+		}
+	}
+
+	// Counts of the children's references if all crossing ones are split
+	float leftCount = float(leftRefs.size() + crossingRefs.size());
+	float rightCount = float(rightRefs.size() + crossingRefs.size());
+	int splitRefsCount = 0;
+	for (const BvhBuildRef *ref : crossingRefs) {
+		BvhBuildRef leftPart = *ref;
+		leftPart.box = clipBuildRef(*ref, context.objects, axis, getAxis(ref->box.min, axis), position);
+		BvhBuildRef rightPart = *ref;
+		rightPart.box = clipBuildRef(*ref, context.objects, axis, position, getAxis(ref->box.max, axis));
+
+		// The triangle may not reach to one of the sides within the reference's box
+		const bool isLeftEmpty = isBoxEmpty(leftPart.box);
+		const bool isRightEmpty = isBoxEmpty(rightPart.box);
+		bool toLeft = isRightEmpty;
+		bool toRight = isLeftEmpty;
+		if (!isLeftEmpty && !isRightEmpty) {
+			BoundingBox leftWithPart = leftBox;
+			leftWithPart.expand(leftPart.box);
+			BoundingBox rightWithPart = rightBox;
+			rightWithPart.expand(rightPart.box);
+			BoundingBox leftWithRef = leftBox;
+			leftWithRef.expand(ref->box);
+			BoundingBox rightWithRef = rightBox;
+			rightWithRef.expand(ref->box);
+			const float splitCost = leftWithPart.getSurfaceArea() * leftCount + rightWithPart.getSurfaceArea() * rightCount;
+			const float leftCost = leftWithRef.getSurfaceArea() * leftCount + rightBox.getSurfaceArea() * (rightCount - 1.f);
+			const float rightCost = leftBox.getSurfaceArea() * (leftCount - 1.f) + rightWithRef.getSurfaceArea() * rightCount;
+			if (splitRefsCount >= maxDuplicates || getMin(leftCost, rightCost) <= splitCost) {
+				toLeft = leftCost <= rightCost;
+				toRight = !toLeft;
+			}
+		}
+
+		if (toLeft) {
+			leftRefs.push_back(*ref);
+			leftBox.expand(ref->box);
+			rightCount -= 1.f;
+		} else if (toRight) {
+			rightRefs.push_back(*ref);
+			rightBox.expand(ref->box);
+			leftCount -= 1.f;
+		} else {
+			leftPart.center = leftPart.box.getCenter();
+			rightPart.center = rightPart.box.getCenter();
+			leftRefs.push_back(leftPart);
+			leftBox.expand(leftPart.box);
+			rightRefs.push_back(rightPart);
+			rightBox.expand(rightPart.box);
+			splitRefsCount++;
+		}
+	}
+	return splitRefsCount;
+}
+
+/// Recursively builds a subtree over some references with object and spatial splits
+/// @param[in] context Data shared by the whole build
+/// @param[in,out] refs References under the subtree, freed once they are distributed to the children
+/// @param[in] maxDuplicates Number of references which splits in the subtree may add
+/// @param[in] depth Depth of the subtree's root
+static void buildSpatialSubtree(const SpatialBuildContext &context, std::vector<BvhBuildRef> &refs, int maxDuplicates, int depth) {
+	const int nodeIdx = int(context.nodes.size());
+	context.nodes.emplace_back();
+	BoundingBox box;
+	BoundingBox centerBox;
+	for (const BvhBuildRef &ref : refs) {
+		box.expand(ref.box);
+		centerBox.expand(ref.center);
+	}
+	context.nodes[nodeIdx].box = box;
+	const int count = int(refs.size());
+
+	auto makeLeaf = [&]() {
+		context.nodes[nodeIdx].offset = int(context.leafRefs.size());
+		context.nodes[nodeIdx].trianglesCount = count;
+		context.leafRefs.insert(context.leafRefs.end(), refs.begin(), refs.end());
+	};
+
+	// Make a leaf if there are too few triangles to split or the hierarchy is too deep already
+	if (count <= 1 || depth >= maxDepth - 1) {
+		makeLeaf();
+		return;
+	}
+
+	// Try a spatial split only where the object split's children overlap, or where there is no object split at all
+	BinnedSplit split = findObjectSplit(refs, centerBox, context.leafWidth);
+	bool isSpatial = false;
+	if (maxDuplicates > 0 && (split.axis < 0 || intersectBoxes(split.leftBox, split.rightBox).getSurfaceArea() >= context.minOverlapArea)) {
+		const BinnedSplit spatialSplit = findSpatialSplit(context, refs, box, maxDuplicates);
+		if (spatialSplit.cost < split.cost) {
+			split = spatialSplit;
+			isSpatial = true;
+		}
+	}
+
+	// Make a leaf if it is cheaper than splitting and small enough
+	const float splitCost = traversalCost * box.getSurfaceArea() + intersectionCost * split.cost;
+	const float leafCost = intersectionCost * box.getSurfaceArea() * float(getLeafTestsCount(count, context.leafWidth));
+	if (count <= context.leafWidth && leafCost <= splitCost) {
+		makeLeaf();
+		return;
+	}
+
+	std::vector<BvhBuildRef> leftRefs;
+	std::vector<BvhBuildRef> rightRefs;
+	int duplicatedRefs = 0;
+	if (isSpatial) {
+		duplicatedRefs = partitionSpatialSplit(context, refs, split.axis, getSpatialSplitPosition(split, box), maxDuplicates, leftRefs, rightRefs);
+		// All references may end up whole on one side, then the object split is taken after all
+		if (leftRefs.empty() || rightRefs.empty()) {
+			leftRefs.clear();
+			rightRefs.clear();
+			duplicatedRefs = 0;
+			split = findObjectSplit(refs, centerBox, context.leafWidth);
+			isSpatial = false;
+		}
+	}
+	if (!isSpatial) {
+		int splitIdx = 0;
+		if (split.axis >= 0) {
+			const BinMapping mapping(centerBox, split.axis);
+			const int splitBinIdx = split.binIdx;
+			splitIdx = int(std::partition(refs.begin(), refs.end(), [&mapping, splitBinIdx](const BvhBuildRef &ref) {
+				return mapping.getBinIdx(ref) < splitBinIdx;
+			}) - refs.begin());
+		} else {
+			// All centers are the same, any split is as good as any other
+			split.axis = box.getLargestAxis();
+			splitIdx = count / 2;
+		}
+		leftRefs.assign(refs.begin(), refs.begin() + splitIdx);
+		rightRefs.assign(refs.begin() + splitIdx, refs.end());
+	}
+	// The node's references are in its children from now on
+	std::vector<BvhBuildRef>().swap(refs);
+
+	// What is left of the budget is shared by the children in proportion to their references
+	const int remainingDuplicates = maxDuplicates - duplicatedRefs;
+	const int leftMaxDuplicates = int((long long)(remainingDuplicates) * (long long)(leftRefs.size()) / (long long)(leftRefs.size() + rightRefs.size()));
+	context.nodes[nodeIdx].splitAxis = split.axis;
+	// The left child is right after this node
+	buildSpatialSubtree(context, leftRefs, leftMaxDuplicates, depth + 1);
+	// The right child comes after the whole left subtree
+	context.nodes[nodeIdx].offset = int(context.nodes.size());
+	buildSpatialSubtree(context, rightRefs, remainingDuplicates - leftMaxDuplicates, depth + 1);
+}
+
+void buildSpatialSah(std::vector<BvhNode> &nodes, std::vector<BvhBuildRef> &refs, const Mesh *objects, int leafWidth, float duplicationBudget) {
+	nodes.clear();
+	nodes.reserve(refs.size() * 2);
+	BoundingBox rootBox;
+	for (const BvhBuildRef &ref : refs) {
+		rootBox.expand(ref.box);
+	}
+	const int maxDuplicates = int(float(refs.size()) * getMax(0.f, duplicationBudget));
+
+	std::vector<BvhBuildRef> leafRefs;
+	leafRefs.reserve(refs.size() + maxDuplicates);
+	const SpatialBuildContext context = { nodes, leafRefs, objects, leafWidth, spatialSplitMinOverlap * rootBox.getSurfaceArea() };
+	buildSpatialSubtree(context, refs, maxDuplicates, 0);
+	refs.swap(leafRefs);
+}
+
+// Linear BVH
+
+/// Number of bits of each coordinate in a Morton code
+static const int mortonBitsPerAxis = 10;
+/// Number of bits sorted by each pass of the radix sort
+static const int radixBits = 10;
+static const int radixBucketsCount = 1 << radixBits;
+
+/// Build reference with its Morton code, sorted by the code
+struct MortonRef {
+	uint32_t code;
+	int refIdx;
+};
+
+/// Spreads the lowest 10 bits of a number so that there are 2 zero bits between each 2 of them
+static uint32_t spreadBits(uint32_t bits) {
+	bits = (bits | (bits << 16)) & 0x030000FFu;
+	bits = (bits | (bits << 8)) & 0x0300F00Fu;
+	bits = (bits | (bits << 4)) & 0x030C30C3u;
+	bits = (bits | (bits << 2)) & 0x09249249u;
+	return bits;
+}
+
+/// Computes the Morton code of a point, interleaving the bits of its quantized coordinates as XYZXYZ...
+/// @param[in] point The point, with coordinates in range [0, 1]
+/// @return Morton code of 3 * mortonBitsPerAxis bits
+static uint32_t getMortonCode(const Vec3f &point) {
+	const float cellsCount = float(1 << mortonBitsPerAxis);
+	const uint32_t x = uint32_t(getMin(getMax(point.x * cellsCount, 0.f), cellsCount - 1.f));
+	const uint32_t y = uint32_t(getMin(getMax(point.y * cellsCount, 0.f), cellsCount - 1.f));
+	const uint32_t z = uint32_t(getMin(getMax(point.z * cellsCount, 0.f), cellsCount - 1.f));
+	return (spreadBits(x) << 2) | (spreadBits(y) << 1) | spreadBits(z);
+}
+
+/// Sorts references by their Morton codes with a least significant digit radix sort.
+/// Each pass counts the digits of a chunk per thread, and scatters each chunk to its own offsets.
+/// @param[in,out] mortonRefs References to be sorted
+/// @param[in] threadsCount Number of threads to sort with
+static void radixSort(std::vector<MortonRef> &mortonRefs, int threadsCount) {
+	const int count = int(mortonRefs.size());
+	std::vector<MortonRef> sorted(count);
+	std::vector<int> offsets(threadsCount * radixBucketsCount);
+	for (int shift = 0; shift < 3 * mortonBitsPerAxis; shift += radixBits) {
+		// Count the digits in each chunk
+		std::fill(offsets.begin(), offsets.end(), 0);
+		parallelFor(count, threadsCount, [&](int chunkIdx, int begin, int end) {
+			int *chunkCounts = &offsets[chunkIdx * radixBucketsCount];
+			for (int i = begin; i < end; i++) {
+				chunkCounts[(mortonRefs[i].code >> shift) & (radixBucketsCount - 1)]++;
+			}
+		});
+		// Turn the counts into offsets, by digit and then by chunk, so that the sort is stable
+		int offset = 0;
+		for (int digit = 0; digit < radixBucketsCount; digit++) {
+			for (int chunkIdx = 0; chunkIdx < threadsCount; chunkIdx++) {
+				const int digitCount = offsets[chunkIdx * radixBucketsCount + digit];
+				offsets[chunkIdx * radixBucketsCount + digit] = offset;
+				offset += digitCount;
+			}
+		}
+		// Scatter each chunk to its offsets
+		parallelFor(count, threadsCount, [&](int chunkIdx, int begin, int end) {
+			int *chunkOffsets = &offsets[chunkIdx * radixBucketsCount];
+			for (int i = begin; i < end; i++) {
+				sorted[chunkOffsets[(mortonRefs[i].code >> shift) & (radixBucketsCount - 1)]++] = mortonRefs[i];
+			}
+		});
+		mortonRefs.swap(sorted);
+	}
+}
+
+/// Data shared by all threads of a linear BVH build
+struct LbvhBuildContext {
+	BuildTree &tree;
+	const BvhBuildRef *refs;
+	/// Morton codes of the references, sorted
+	const uint32_t *codes;
+	int leafWidth;
+	int parallelDepth;
+};
+
+/// Recursively builds a subtree over a range of references sorted by their Morton codes
+/// @param[in] context Data shared by all threads of the build
+/// @param[in] treeIdx Index of the subtree's root in the tree
+/// @param[in] firstRefIdx Index of the first reference of the range
+/// @param[in] count Number of references in the range
+/// @param[in] depth Depth of the subtree's root
+static void buildLbvhSubtree(const LbvhBuildContext &context, int treeIdx, int firstRefIdx, int count, int depth) {
+	BuildTreeNode &node = context.tree.nodes[treeIdx];
+	node.firstRefIdx = firstRefIdx;
+	node.refsCount = count;
+	if (count <= context.leafWidth || depth >= maxDepth - 1) {
+		for (int i = firstRefIdx; i < firstRefIdx + count; i++) {
+			node.box.expand(context.refs[i].box);
+		}
+		return;
+	}
+
+	// Split where the highest bit in which the first and the last code differ changes from 0 to 1.
+	// The codes are sorted, so all codes before that point have the bit unset and all after it have it set.
+	const uint32_t firstCode = context.codes[firstRefIdx];
+	const uint32_t lastCode = context.codes[firstRefIdx + count - 1];
+	int splitIdx = count / 2;
+	if (firstCode != lastCode) {
+		int highestBit = 31;
+		while (!((firstCode ^ lastCode) & (1u << highestBit))) {
+			highestBit--;
+		}
+		const uint32_t *codes = context.codes + firstRefIdx;
+		splitIdx = int(std::partition_point(codes, codes + count, [highestBit](uint32_t code) {
+			return !(code & (1u << highestBit));
+		}) - codes);
+		// The bits are interleaved as XYZ, from the highest
+		node.splitAxis = 2 - highestBit % 3;
+	}
+
+	node.left = context.tree.allocateChildren();
+	node.right = node.left + 1;
+	const int leftIdx = node.left;
+	const int rightIdx = node.right;
+	runTasks(
+		depth < context.parallelDepth && count >= parallelSubtreeMinRefs,
+		[&]() { buildLbvhSubtree(context, leftIdx, firstRefIdx, splitIdx, depth + 1); },
+		[&]() { buildLbvhSubtree(context, rightIdx, firstRefIdx + splitIdx, count - splitIdx, depth + 1); }
+	);
+	// The children's boxes are known only after they are built
+	node.box = context.tree.nodes[leftIdx].box;
+	node.box.expand(context.tree.nodes[rightIdx].box);
+	if (firstCode == lastCode) {
+		node.splitAxis = node.box.getLargestAxis();
+	}
+}
+
+void buildLbvh(std::vector<BvhNode> &nodes, std::vector<BvhBuildRef> &refs, int leafWidth, int threadsCount) {
+	const int count = int(refs.size());
+
+	// Bounds of the centers, to which the Morton codes' grid is fit
+	std::vector<BoundingBox> chunksCenterBoxes(threadsCount);
+	parallelFor(count, threadsCount, [&](int chunkIdx, int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			chunksCenterBoxes[chunkIdx].expand(refs[i].center);
+		}
+	});
+	BoundingBox centerBox;
+	for (const BoundingBox &chunkCenterBox : chunksCenterBoxes) {
+		centerBox.expand(chunkCenterBox);
+	}
+	const Vec3f extent = centerBox.max - centerBox.min;
+	// Flat axes map to 0
+	const Vec3f invExtent = {
+		extent.x > 0.f ? 1.f / extent.x : 0.f,
+		extent.y > 0.f ? 1.f / extent.y : 0.f,
+		extent.z > 0.f ? 1.f / extent.z : 0.f
+	};
+
+	std::vector<MortonRef> mortonRefs(count);
+	parallelFor(count, threadsCount, [&](int /*chunkIdx*/, int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			const Vec3f offset = refs[i].center - centerBox.min;
+			mortonRefs[i].code = getMortonCode({ offset.x * invExtent.x, offset.y * invExtent.y, offset.z * invExtent.z });
+			mortonRefs[i].refIdx = i;
+		}
+	});
+	radixSort(mortonRefs, threadsCount);
+
+	// Reorder the references along the curve
+	std::vector<BvhBuildRef> sortedRefs(count);
+	std::vector<uint32_t> codes(count);
+	parallelFor(count, threadsCount, [&](int /*chunkIdx*/, int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			sortedRefs[i] = refs[mortonRefs[i].refIdx];
+			codes[i] = mortonRefs[i].code;
+		}
+	});
+	refs.swap(sortedRefs);
+
+	BuildTree tree(count);
+	const LbvhBuildContext context = { tree, refs.data(), codes.data(), leafWidth, getParallelDepth(threadsCount) };
+	buildLbvhSubtree(context, 0, 0, count, 0);
+
+	nodes.clear();
+	nodes.reserve(tree.nodesCount);
+	tree.flatten(0, nodes);
+}
+
+float computeSahCost(const BvhNode *nodes, int nodesCount, int leafWidth) {
+	if (nodesCount == 0) {
+		return 0.f;
+	}
+	double cost = 0.0;
+	for (int nodeIdx = 0; nodeIdx < nodesCount; nodeIdx++) {
+		const BvhNode &node = nodes[nodeIdx];
+		const double area = node.box.getSurfaceArea();
+		cost += node.isLeaf()
+			? intersectionCost * area * getLeafTestsCount(node.trianglesCount, leafWidth)
+			: traversalCost * area;
+	}
+	return float(cost / getMax(double(nodes[0].box.getSurfaceArea()), 1e-30));
+}
+
+void computeRelativeCosts(const BvhNode *nodes, int nodesCount, int leafWidth, float *costs) {
+	// Children are after their parents, so going backwards gives the children's costs first
+	std::vector<double> subtreeCosts(nodesCount);
+	for (int nodeIdx = nodesCount - 1; nodeIdx >= 0; nodeIdx--) {
+		const BvhNode &node = nodes[nodeIdx];
+		const double area = node.box.getSurfaceArea();
+		subtreeCosts[nodeIdx] = node.isLeaf()
+			? intersectionCost * area * getLeafTestsCount(node.trianglesCount, leafWidth)
+			: traversalCost * area + subtreeCosts[nodeIdx + 1] + subtreeCosts[node.offset];
+		costs[nodeIdx] = float(subtreeCosts[nodeIdx] / getMax(area, 1e-30));
+	}
+}
\ No newline at end of file
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "Bvh.h"
+
+#include <vector>
+
+// Builders of the hierarchy, used by Bvh::build and InstanceBvh::build.
+// Each builder produces the nodes in depth-first order, with each leaf's offset
+// pointing to its first reference in the reordered array of build references.
+// The spatial split builder also splits triangles between leaves, so its array has a reference for each part of a split triangle.
+// The leaf width is the number of primitives intersected together: leaves hold at most that many,
+// and cost the same for any number up to it. It is trianglePacketWidth for triangles and 1 for instances.
+
+/// Maximum depth of the hierarchy, it limits the size of the traversal stack
+static const int maxDepth = 64;
+/// Cost of traversing an inner node relative to the cost of intersecting a triangle
+static const float traversalCost = 1.f;
+/// Cost of intersecting a packet of triangles, which is about the same for any number of triangles in it
+static const float intersectionCost = 2.f;
+
+/// Triangle reference with cached data needed during the build
+struct BvhBuildRef {
+	/// The referenced triangle, or for a hierarchy over instances, the instance's index in place of the mesh index
+	BvhTriangleRef ref;
+	/// Bounding box of the triangle
+	BoundingBox box;
+	/// Center of the triangle's bounding box
+	Vec3f center;
+};
+
+/// Builds the hierarchy with a full SAH sweep over the sorted references of each node, on a single thread
+/// @param[out] nodes The built nodes
+/// @param[in,out] refs The build references, reordered so that each leaf's references are consecutive
+/// @param[in] leafWidth Number of primitives intersected together in a leaf
+void buildSweepSah(std::vector<BvhNode> &nodes, std::vector<BvhBuildRef> &refs, int leafWidth);
+
+/// Builds the hierarchy with the SAH evaluated at the borders of a fixed number of bins per axis.
+/// Subtrees are built in parallel, and so is the binning of the largest nodes.
+/// @param[out] nodes The built nodes
+/// @param[in,out] refs The build references, reordered so that each leaf's references are consecutive
+/// @param[in] leafWidth Number of primitives intersected together in a leaf
+/// @param[in] threadsCount Number of threads to build with
+void buildBinnedSah(std::vector<BvhNode> &nodes, std::vector<BvhBuildRef> &refs, int leafWidth, int threadsCount);
+
+/// Builds a spatial split BVH (SBVH), on a single thread. Each node takes the cheaper of the best binned split of its references' centers
+/// and, where the children of that split overlap, the best split by a plane between uniform bins of the node's box.
+/// A triangle crossing that plane is clipped to both sides, and each child gets a reference with a box around only its part,
+/// unless keeping the whole triangle on one side is cheaper.
+/// @param[out] nodes The built nodes
+/// @param[in,out] refs The build references, replaced by the references of the leaves in their order
+/// @param[in] objects Meshes of the references, whose triangles are clipped
+/// @param[in] leafWidth Number of primitives intersected together in a leaf
+/// @param[in] duplicationBudget Number of references the splits may add, relative to the number of the references
+void buildSpatialSah(std::vector<BvhNode> &nodes, std::vector<BvhBuildRef> &refs, const Mesh *objects, int leafWidth, float duplicationBudget);
+
+/// Builds a linear BVH: sorts the references along a Morton curve with a parallel radix sort,
+/// and splits each node where the highest bit of the Morton codes of its references changes
+/// @param[out] nodes The built nodes
+/// @param[in,out] refs The build references, reordered so that each leaf's references are consecutive
+/// @param[in] leafWidth Number of primitives intersected together in a leaf
+/// @param[in] threadsCount Number of threads to build with
+void buildLbvh(std::vector<BvhNode> &nodes, std::vector<BvhBuildRef> &refs, int leafWidth, int threadsCount);
+
+/// Computes the SAH cost of a built hierarchy, relative to the area of the root's box
+/// @param[in] nodes Array of nodes in depth-first order
+/// @param[in] nodesCount Number of nodes in the array
+/// @param[in] leafWidth Number of primitives intersected together in a leaf
+/// @return Expected cost of tracing a ray through the hierarchy, in the units of traversalCost and intersectionCost
+float computeSahCost(const BvhNode *nodes, int nodesCount, int leafWidth);
+
+/// Computes the SAH cost of each node's subtree, relative to the node's box
+/// @param[in] nodes Array of nodes in depth-first order, with the children's offsets relative to the start of the array
+/// @param[in] nodesCount Number of nodes in the array
+/// @param[in] leafWidth Number of primitives intersected together in a leaf
+/// @param[out] costs Array of a cost for each node
+void computeRelativeCosts(const BvhNode *nodes, int nodesCount, int leafWidth, float *costs);
\ No newline at end of file
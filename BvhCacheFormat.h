@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+
+/// Layout of the files of the BVH cache (.crtbvh), each holding the hierarchy of a single mesh.
+/// The file starts with a header, followed by the arrays of nodes, triangle packets and triangle references,
+/// stored exactly as the arrays of a Bvh, so that a loader can point the hierarchy directly into a memory mapping of the file.
+/// Nodes and references hold only indices, never pointers, so the file is valid wherever it is mapped.
+/// All offsets are in bytes from the start of the file, and all arrays start at a multiple of the alignment.
+/// Numbers are stored in the byte order of the machine that wrote the file, which is expected to be little-endian.
+namespace BvhCacheFormat {
+
+/// Magic bytes at the start of every file
+static const char magic[8] = { 'C', 'R', 'T', 'B', 'V', 'H', '\0', '\0' };
+/// Version of the format, incremented on every change of the layout or of the builders' output
+static const uint32_t version = 1;
+/// Alignment of the arrays in the file, in bytes
+static const uint64_t alignment = 64;
+/// Extension of the cache files
+static const char extension[] = ".crtbvh";
+
+/// Header at the start of the file, identifying the mesh and the build the hierarchy comes from
+struct Header {
+	char magic[8];
+	uint32_t version;
+	/// Size of the header, for validation
+	uint32_t headerSize;
+	/// Number of triangles in a packet and size of a packet, which depend on the build of the renderer
+	uint32_t packetWidth;
+	uint32_t packetSize;
+
+	/// Hash of the mesh's vertices and triangles, see Mesh::getGeometryHash
+	uint64_t geometryHash;
+	/// Counts of the mesh's vertices and triangles, checked along with the hash
+	uint32_t verticesCount;
+	uint32_t trianglesCount;
+	/// Build mode the hierarchy was built with
+	uint32_t buildMode;
+	/// SAH cost of the hierarchy
+	float sahCost;
+
+	uint32_t nodesCount;
+	uint32_t packetsCount;
+	uint32_t triangleRefsCount;
+	/// Spatial split budget of the sbvh build mode, 0 for the other modes
+	float spatialSplitBudget;
+	/// Offset of the array of nodes
+	uint64_t nodesOffset;
+	/// Offset of the array of triangle packets
+	uint64_t packetsOffset;
+	/// Offset of the array of triangle references
+	uint64_t triangleRefsOffset;
+};
+
+static_assert(sizeof(Header) == 88, "Unexpected size of the BVH cache header");
+
+/// Rounds an offset up to the alignment of the arrays
+inline uint64_t alignOffset(uint64_t offset) {
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+} // namespace BvhCacheFormat
\ No newline at end of file
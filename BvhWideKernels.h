@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Bvh.h"
+#include "utils/CpuUtils.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+/// The ray/box tests of the children of a wide node compiled for each instruction set level.
+/// Included by the code which dispatches on the level, so that the kernels inline into its per-level functions.
+/// All levels decode the boxes and compute the distances with the same operations in the same order as
+/// BvhWideNode::getChildBox and rayBoxIntersection, so that the results are identical.
+namespace BvhWideKernels {
+
+using CpuUtils::IsaLevel;
+using CpuUtils::IsaTag;
+
+// Each intersectChildren overload tests a ray against the boxes of all children of a node.
+// nearDists is filled with the distances along the ray at which it enters the boxes.
+// Returns a bit mask of the children whose boxes the ray intersects before maxDist.
+
+/// One child at a time
+inline int intersectChildren(IsaTag<IsaLevel::Scalar>, const Ray &ray, const Vec3f &invDirection, const BvhWideNode &node, float maxDist, float *nearDists) {
+	int hitMask = 0;
+	for (int childIdx = 0; childIdx < node.childrenCount; childIdx++) {
+		const BoundingBox box = node.getChildBox(childIdx);
+		const float tx1 = (box.min.x - ray.origin.x) * invDirection.x;
+		const float tx2 = (box.max.x - ray.origin.x) * invDirection.x;
+		const float ty1 = (box.min.y - ray.origin.y) * invDirection.y;
+		const float ty2 = (box.max.y - ray.origin.y) * invDirection.y;
+		const float tz1 = (box.min.z - ray.origin.z) * invDirection.z;
+		const float tz2 = (box.max.z - ray.origin.z) * invDirection.z;
+		const float tNear = getMax(getMax(getMin(tx1, tx2), getMin(ty1, ty2)), getMax(getMin(tz1, tz2), 0.f));
+		const float tFar = getMin(getMin(getMax(tx1, tx2), getMax(ty1, ty2)), getMin(getMax(tz1, tz2), maxDist));
+		nearDists[childIdx] = tNear;
+		if (tNear <= tFar) {
+			hitMask |= 1 << childIdx;
+		}
+	}
+	return hitMask;
+}
+
+#ifdef CPU_X86
+
+/// All 4 children at once.
+/// min and max of SSE return their second operand when either is NaN, just like getMin and getMax.
+CPU_TARGET_SSE42 inline int intersectChildren(IsaTag<IsaLevel::Sse42>, const Ray &ray, const Vec3f &invDirection, const BvhWideNode &node, float maxDist, float *nearDists) {
+	const float rayOrigin[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+	const float rayInvDirection[3] = { invDirection.x, invDirection.y, invDirection.z };
+	__m128 slabNear[3];
+	__m128 slabFar[3];
+	for (int axis = 0; axis < 3; axis++) {
+		const __m128 origin = _mm_set1_ps(node.origin[axis]);
+		const __m128 cellSize = _mm_set1_ps(node.getCellSize(axis));
+		const __m128 rayOriginAxis = _mm_set1_ps(rayOrigin[axis]);
+		const __m128 invDir = _mm_set1_ps(rayInvDirection[axis]);
+
+		// The 4 bytes of the children's corners widened to floats
+		int minBytes;
+		int maxBytes;
+		memcpy(&minBytes, node.childMin[axis], sizeof(minBytes));
+		memcpy(&maxBytes, node.childMax[axis], sizeof(maxBytes));
+		const __m128 cellsMin = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(minBytes)));
+		const __m128 cellsMax = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(maxBytes)));
+		const __m128 boxMin = _mm_add_ps(origin, _mm_mul_ps(cellsMin, cellSize));
+		const __m128 boxMax = _mm_add_ps(origin, _mm_mul_ps(cellsMax, cellSize));
+
+		const __m128 t1 = _mm_mul_ps(_mm_sub_ps(boxMin, rayOriginAxis), invDir);
+		const __m128 t2 = _mm_mul_ps(_mm_sub_ps(boxMax, rayOriginAxis), invDir);
+		slabNear[axis] = _mm_min_ps(t1, t2);
+		slabFar[axis] = _mm_max_ps(t1, t2);
+	}
+	const __m128 tNear = _mm_max_ps(_mm_max_ps(slabNear[0], slabNear[1]), _mm_max_ps(slabNear[2], _mm_setzero_ps()));
+	const __m128 tFar = _mm_min_ps(_mm_min_ps(slabFar[0], slabFar[1]), _mm_min_ps(slabFar[2], _mm_set1_ps(maxDist)));
+	_mm_storeu_ps(nearDists, tNear);
+	// The entries after the last child are not boxes, so they are masked out
+	return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar)) & ((1 << node.childrenCount) - 1);
+}
+
+/// The 4 children of a node fill a single SSE register, so the wider levels run the same code with their encodings
+CPU_TARGET_AVX2 inline int intersectChildren(IsaTag<IsaLevel::Avx2>, const Ray &ray, const Vec3f &invDirection, const BvhWideNode &node, float maxDist, float *nearDists) {
+	return intersectChildren(IsaTag<IsaLevel::Sse42>(), ray, invDirection, node, maxDist, nearDists);
+}
+
+CPU_TARGET_AVX512 inline int intersectChildren(IsaTag<IsaLevel::Avx512>, const Ray &ray, const Vec3f &invDirection, const BvhWideNode &node, float maxDist, float *nearDists) {
+	return intersectChildren(IsaTag<IsaLevel::Sse42>(), ray, invDirection, node, maxDist, nearDists);
+}
+
+#endif
+
+} // namespace BvhWideKernels
\ No newline at end of file
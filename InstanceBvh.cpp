@@ -0,0 +1,472 @@
+#include "InstanceBvh.h"
+#include "BvhBuild.h"
+#include "BvhCacheFormat.h"
+
+#include "utils/ProfileUtils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+/// Objects with at least this many triangles are built with all threads, smaller ones with one thread each
+static const int parallelObjectMinTriangles = 1 << 16;
+
+void InstanceBvh::build(
+	const Mesh *objects,
+	int objectsCount,
+	const MeshInstance *instances,
+	int instancesCount,
+	const BvhBuildOptions &options
+) {
+	PROFILE_SCOPE("InstanceBvh::build");
+	const auto startTime = std::chrono::steady_clock::now();
+	buildStats = BvhBuildStats();
+	buildStats.mode = options.mode;
+	buildStats.spatialSplitBudget = options.spatialSplitBudget;
+	buildStats.layout = options.layout;
+	for (int objIdx = 0; objIdx < objectBvhsCount; objIdx++) {
+		objectBvhs[objIdx].clear();
+	}
+	delete[] objectBvhs;
+	objectBvhs = nullptr;
+	objectBvhsCount = 0;
+	this->objects = objects;
+	this->instances = instances;
+
+	this->instancesCount = instancesCount;
+
+	const int threadsCount = options.threadsCount > 0
+		? options.threadsCount
+		: getMax(1, int(std::thread::hardware_concurrency()));
+	objectBvhsCount = objectsCount;
+	objectBvhs = (objectsCount > 0) ? new Bvh[objectsCount] : nullptr;
+	buildObjectBvhs(options, threadsCount);
+	buildTopLevel(options, threadsCount);
+	for (int objIdx = 0; objIdx < objectBvhsCount; objIdx++) {
+		buildStats.duplicatedRefs += objectBvhs[objIdx].buildStats.duplicatedRefs;
+	}
+
+	buildStats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	buildStats.sahCost = computeSahCost();
+}
+
+void InstanceBvh::buildTopLevel(const BvhBuildOptions &options, int threadsCount) {
+	delete[] nodes;
+	nodes = nullptr;
+	nodesCount = 0;
+	delete[] instanceIdxs;
+	instanceIdxs = nullptr;
+	instanceIdxsCount = 0;
+	topLevelBuiltCost = 0.f;
+
+	// Create a build reference for each instance of an object with triangles, with the instance's world space box
+	std::vector<BvhBuildRef> buildRefs;
+	for (int instanceIdx = 0; instanceIdx < instancesCount; instanceIdx++) {
+		const MeshInstance &instance = instances[instanceIdx];
+		assert(instance.meshIdx >= 0 && instance.meshIdx < objectBvhsCount);
+		const Bvh &objectBvh = objectBvhs[instance.meshIdx];
+		if (objectBvh.nodesCount == 0) {
+			continue;
+		}
+		BvhBuildRef buildRef;
+		buildRef.ref = { instanceIdx, 0 };
+		buildRef.box = instance.boxToWorldSpace(objectBvh.nodes[0].box);
+		buildRef.center = buildRef.box.getCenter();
+		buildRefs.push_back(buildRef);
+	}
+	if (buildRefs.empty()) {
+		return;
+	}
+
+	// Each instance is traced on its own, so the leaves hold a single instance unless the hierarchy gets too deep
+	std::vector<BvhNode> buildNodes;
+	// Instances aren't split, so the spatial split mode builds the top level with the full sweep
+	switch (options.mode) {
+	case BvhBuildMode::Sweep:
+	case BvhBuildMode::Sbvh:
+		buildSweepSah(buildNodes, buildRefs, 1);
+		break;
+	case BvhBuildMode::Binned:
+		buildBinnedSah(buildNodes, buildRefs, 1, threadsCount);
+		break;
+	case BvhBuildMode::Lbvh:
+		buildLbvh(buildNodes, buildRefs, 1, threadsCount);
+		break;
+	}
+
+	nodesCount = int(buildNodes.size());
+	nodes = new BvhNode[nodesCount];
+	std::copy(buildNodes.begin(), buildNodes.end(), nodes);
+	instanceIdxsCount = int(buildRefs.size());
+	instanceIdxs = new int[instanceIdxsCount];
+	for (int i = 0; i < instanceIdxsCount; i++) {
+		instanceIdxs[i] = buildRefs[i].ref.meshIdx;
+	}
+	topLevelBuiltCost = ::computeSahCost(nodes, nodesCount, 1);
+}
+
+long long InstanceBvh::getNodesSize() const {
+	long long size = (long long)(nodesCount) * (long long)(sizeof(BvhNode));
+	for (int objIdx = 0; objIdx < objectBvhsCount; objIdx++) {
+		size += objectBvhs[objIdx].getNodesSize();
+	}
+	return size;
+}
+
+float InstanceBvh::computeSahCost() const {
+	if (nodesCount == 0) {
+		return 0.f;
+	}
+	// The SAH cost of each instance's object hierarchy is relative to its root's box,
+	// which is about the instance's box, so it is the expected cost of tracing a ray that reaches the instance
+	double cost = 0.0;
+	for (int nodeIdx = 0; nodeIdx < nodesCount; nodeIdx++) {
+		const BvhNode &node = nodes[nodeIdx];
+		const double area = node.box.getSurfaceArea();
+		if (!node.isLeaf()) {
+			cost += traversalCost * area;
+			continue;
+		}
+		for (int i = node.offset; i < node.offset + node.trianglesCount; i++) {
+			cost += area * objectBvhs[instances[instanceIdxs[i]].meshIdx].buildStats.sahCost;
+		}
+	}
+	return float(cost / getMax(double(nodes[0].box.getSurfaceArea()), 1e-30));
+}
+
+void InstanceBvh::update(const int *objIdxs, int objIdxsCount, const BvhBuildOptions &options, BvhUpdateStats &stats) {
+	PROFILE_SCOPE("InstanceBvh::update");
+	const auto startTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < objIdxsCount; i++) {
+		assert(objIdxs[i] >= 0 && objIdxs[i] < objectBvhsCount);
+		objectBvhs[objIdxs[i]].update(options, stats);
+	}
+
+	// Refit the top level to the moved objects and instances, children are after their parents so they go first
+	for (int nodeIdx = nodesCount - 1; nodeIdx >= 0; nodeIdx--) {
+		BvhNode &node = nodes[nodeIdx];
+		if (!node.isLeaf()) {
+			node.box = nodes[nodeIdx + 1].box;
+			node.box.expand(nodes[node.offset].box);
+			continue;
+		}
+		node.box = BoundingBox();
+		for (int i = node.offset; i < node.offset + node.trianglesCount; i++) {
+			const MeshInstance &instance = instances[instanceIdxs[i]];
+			node.box.expand(instance.boxToWorldSpace(objectBvhs[instance.meshIdx].nodes[0].box));
+		}
+	}
+	stats.refitNodes += nodesCount;
+
+	// The top level is small, so it is rebuilt whole when it degrades
+	if (nodesCount > 0 && ::computeSahCost(nodes, nodesCount, 1) > options.rebuildThreshold * topLevelBuiltCost) {
+		const int threadsCount = options.threadsCount > 0
+			? options.threadsCount
+			: getMax(1, int(std::thread::hardware_concurrency()));
+		buildTopLevel(options, threadsCount);
+		stats.rebuiltSubtrees++;
+	}
+
+	buildStats.sahCost = computeSahCost();
+	stats.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+bool InstanceBvh::buildObjectBvh(int objIdx, const BvhBuildOptions &options) {
+	const Mesh &mesh = objects[objIdx];
+	Bvh &bvh = objectBvhs[objIdx];
+	if (options.cacheDirectory.empty() || mesh.trianglesCount == 0) {
+		bvh.build(&mesh, 1, options);
+		return false;
+	}
+
+	// The file is named after the geometry, the build mode and, for spatial splits, the duplication budget,
+	// so that builds with different budgets don't replace each other's files. Its header is checked against all of them.
+	const uint64_t geometryHash = mesh.getGeometryHash();
+	char hashHex[17];
+	snprintf(hashHex, sizeof(hashHex), "%016llx", (unsigned long long)(geometryHash));
+	std::string modeName = getBvhBuildModeName(options.mode);
+	if (options.mode == BvhBuildMode::Sbvh) {
+		char budget[32];
+		snprintf(budget, sizeof(budget), "-%g", options.spatialSplitBudget);
+		modeName += budget;
+	}
+	const std::string filepath = options.cacheDirectory + "/" + hashHex + "-" + modeName + BvhCacheFormat::extension;
+	if (bvh.loadFromCache(filepath, mesh, geometryHash, options)) {
+		// The cache holds only the binary nodes, the wide ones are converted from them like after a build
+		if (options.layout == BvhLayout::Wide) {
+			bvh.buildWideNodes();
+		}
+		return true;
+	}
+	bvh.build(&mesh, 1, options);
+	if (!bvh.saveToCache(filepath, mesh, geometryHash)) {
+		std::cout << "Warning: Cannot write the BVH cache file " << filepath << "\n";
+	}
+	return false;
+}
+
+void InstanceBvh::buildObjectBvhs(const BvhBuildOptions &options, int threadsCount) {
+	if (!options.cacheDirectory.empty() && !FileUtils::createDirectory(options.cacheDirectory)) {
+		std::cout << "Warning: Cannot create the BVH cache directory " << options.cacheDirectory << "\n";
+	}
+
+	std::atomic<int> cacheHits(0);
+	std::atomic<int> cacheMisses(0);
+	auto buildObject = [&](int objIdx, const BvhBuildOptions &objectOptions) {
+		if (buildObjectBvh(objIdx, objectOptions)) {
+			cacheHits++;
+		} else if (!options.cacheDirectory.empty() && objects[objIdx].trianglesCount > 0) {
+			cacheMisses++;
+		}
+	};
+
+	BvhBuildOptions objectOptions = options;
+	objectOptions.threadsCount = threadsCount;
+	std::vector<int> smallObjectIdxs;
+	for (int objIdx = 0; objIdx < objectBvhsCount; objIdx++) {
+		if (objects[objIdx].trianglesCount >= parallelObjectMinTriangles) {
+			buildObject(objIdx, objectOptions);
+		} else {
+			smallObjectIdxs.push_back(objIdx);
+		}
+	}
+
+	// Each thread takes the next small object until there are none left
+	BvhBuildOptions smallObjectOptions = options;
+	smallObjectOptions.threadsCount = 1;
+	std::atomic<int> nextIdx(0);
+	auto buildSmallObjects = [&]() {
+		for (int i = nextIdx++; i < int(smallObjectIdxs.size()); i = nextIdx++) {
+			buildObject(smallObjectIdxs[i], smallObjectOptions);
+		}
+	};
+	std::vector<std::thread> threads;
+	for (int threadIdx = 1; threadIdx < getMin(threadsCount, int(smallObjectIdxs.size())); threadIdx++) {
+		threads.emplace_back(buildSmallObjects);
+	}
+	buildSmallObjects();
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+	buildStats.cacheHits = cacheHits;
+	buildStats.cacheMisses = cacheMisses;
+}
+
+void InstanceBvh::getIntersection(const Ray &ray, const BvhHit &hit, int instanceIdx, TriangleIntersection &intersection) const {
+	const MeshInstance &instance = instances[instanceIdx];
+	// Distances along the mesh space ray are the same as along the world space one,
+	// so the point is found along the world space ray
+	objectBvhs[instance.meshIdx].getIntersection(ray, hit, intersection);
+	if (!instance.isIdentity) {
+		intersection.normal = instance.normalToWorldSpace(intersection.normal);
+	}
+}
+
+bool InstanceBvh::intersect(const Ray &ray, TriangleIntersection &intersection, RayStats &stats) const {
+	if (nodesCount == 0) {
+		return false;
+	}
+
+	const Vec3f invDirection = { 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+	const bool dirIsNeg[3] = { ray.direction.x < 0.f, ray.direction.y < 0.f, ray.direction.z < 0.f };
+
+	// The closest intersection over all instances so far, and its instance
+	BvhHit hit;
+	int hitInstanceIdx = -1;
+	int nodeVisits = 0;
+
+	// Stack of nodes that are still to be visited
+	int stack[maxDepth];
+	int stackSize = 0;
+	int nodeIdx = 0;
+	while (true) {
+		const BvhNode &node = nodes[nodeIdx];
+		nodeVisits++;
+		if (rayBoxIntersection(ray, invDirection, node.box, hit.dist)) {
+			if (!node.isLeaf()) {
+				// Visit the child closer to the ray origin first, and the other one later
+				if (dirIsNeg[node.splitAxis]) {
+					stack[stackSize++] = nodeIdx + 1;
+					nodeIdx = node.offset;
+				} else {
+					stack[stackSize++] = node.offset;
+					nodeIdx = nodeIdx + 1;
+				}
+				continue;
+			}
+			for (int i = node.offset; i < node.offset + node.trianglesCount; i++) {
+				const MeshInstance &instance = instances[instanceIdxs[i]];
+				const Bvh &objectBvh = objectBvhs[instance.meshIdx];
+				const bool isCloser = instance.isIdentity
+					? objectBvh.intersect(ray, hit, stats)
+					: objectBvh.intersect(instance.rayToMeshSpace(ray), hit, stats);
+				if (isCloser) {
+					hitInstanceIdx = instanceIdxs[i];
+				}
+			}
+		}
+		if (stackSize == 0) {
+			break;
+		}
+		nodeIdx = stack[--stackSize];
+	}
+
+	stats.nodeVisits += nodeVisits;
+	if (hitInstanceIdx < 0) {
+		return false;
+	}
+	getIntersection(ray, hit, hitInstanceIdx, intersection);
+	return true;
+}
+
+void InstanceBvh::intersectInstance(int instanceIdx, const RayPacket &packet, BvhHit *hits, int *hitInstanceIdxs, RayStats &stats) const {
+	const MeshInstance &instance = instances[instanceIdx];
+	const Bvh &objectBvh = objectBvhs[instance.meshIdx];
+	bool isCloser[rayPacketSize];
+	if (instance.isIdentity) {
+		objectBvh.intersect(packet, hits, isCloser, stats);
+	} else {
+		// The transformed rays share their origin, but the signs of their directions may differ from the world space ones
+		RayPacket meshPacket;
+		meshPacket.raysCount = packet.raysCount;
+		for (int i = 0; i < packet.raysCount; i++) {
+			meshPacket.rays[i] = instance.rayToMeshSpace(packet.rays[i]);
+		}
+		meshPacket.prepare();
+		objectBvh.intersect(meshPacket, hits, isCloser, stats);
+	}
+	for (int i = 0; i < packet.raysCount; i++) {
+		if (isCloser[i]) {
+			hitInstanceIdxs[i] = instanceIdx;
+		}
+	}
+}
+
+void InstanceBvh::intersect(const RayPacket &packet, TriangleIntersection *intersections, bool *found, RayStats &stats) const {
+	if (!packet.isCoherent || nodesCount == 0) {
+		for (int i = 0; i < packet.raysCount; i++) {
+			found[i] = intersect(packet.rays[i], intersections[i], stats);
+		}
+		return;
+	}
+
+	// The directions have the same signs, so the children are visited in the same order for all rays
+	const Vec3f &direction = packet.rays[0].direction;
+	const bool dirIsNeg[3] = { direction.x < 0.f, direction.y < 0.f, direction.z < 0.f };
+
+	BvhHit hits[rayPacketSize];
+	int hitInstanceIdxs[rayPacketSize];
+	for (int i = 0; i < packet.raysCount; i++) {
+		hitInstanceIdxs[i] = -1;
+	}
+	// The largest of the closest intersection distances, no ray needs anything further
+	float packetMaxDist = std::numeric_limits<float>::max();
+	int nodeVisits = 0;
+
+	// Stack of nodes that are still to be visited, each with the first ray that may intersect it, as in Bvh
+	struct StackEntry {
+		int nodeIdx;
+		int firstRayIdx;
+	};
+	StackEntry stack[maxDepth];
+	int stackSize = 0;
+	int nodeIdx = 0;
+	int firstRayIdx = 0;
+	while (true) {
+		const BvhNode &node = nodes[nodeIdx];
+		nodeVisits++;
+		if (packetBoxIntersection(packet, node.box, packetMaxDist)) {
+			while (
+				firstRayIdx < packet.raysCount
+				&& !rayBoxIntersection(packet.rays[firstRayIdx], packet.invDirections[firstRayIdx], node.box, hits[firstRayIdx].dist)
+			) {
+				firstRayIdx++;
+			}
+		} else {
+			firstRayIdx = packet.raysCount;
+		}
+
+		if (firstRayIdx < packet.raysCount) {
+			if (!node.isLeaf()) {
+				if (dirIsNeg[node.splitAxis]) {
+					stack[stackSize++] = { nodeIdx + 1, firstRayIdx };
+					nodeIdx = node.offset;
+				} else {
+					stack[stackSize++] = { node.offset, firstRayIdx };
+					nodeIdx = nodeIdx + 1;
+				}
+				continue;
+			}
+			// The object hierarchies cull the rays that miss them on their own
+			for (int i = node.offset; i < node.offset + node.trianglesCount; i++) {
+				intersectInstance(instanceIdxs[i], packet, hits, hitInstanceIdxs, stats);
+			}
+			packetMaxDist = 0.f;
+			for (int i = 0; i < packet.raysCount; i++) {
+				packetMaxDist = getMax(packetMaxDist, hits[i].dist);
+			}
+		}
+		if (stackSize == 0) {
+			break;
+		}
+		stackSize--;
+		nodeIdx = stack[stackSize].nodeIdx;
+		firstRayIdx = stack[stackSize].firstRayIdx;
+	}
+
+	stats.nodeVisits += nodeVisits;
+	for (int i = 0; i < packet.raysCount; i++) {
+		found[i] = hitInstanceIdxs[i] >= 0;
+		if (found[i]) {
+			getIntersection(packet.rays[i], hits[i], hitInstanceIdxs[i], intersections[i]);
+		}
+	}
+}
+
+bool InstanceBvh::isOccluded(const Ray &ray, float maxDist, RayStats &stats) const {
+	if (nodesCount == 0) {
+		return false;
+	}
+
+	const Vec3f invDirection = { 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+	int nodeVisits = 0;
+
+	// Stack of nodes that are still to be visited
+	int stack[maxDepth];
+	int stackSize = 0;
+	int nodeIdx = 0;
+	while (true) {
+		const BvhNode &node = nodes[nodeIdx];
+		nodeVisits++;
+		if (rayBoxIntersection(ray, invDirection, node.box, maxDist)) {
+			if (!node.isLeaf()) {
+				// Any intersection will do, so the order of the children doesn't matter
+				stack[stackSize++] = node.offset;
+				nodeIdx = nodeIdx + 1;
+				continue;
+			}
+			for (int i = node.offset; i < node.offset + node.trianglesCount; i++) {
+				const MeshInstance &instance = instances[instanceIdxs[i]];
+				const Bvh &objectBvh = objectBvhs[instance.meshIdx];
+				const bool isOccluded = instance.isIdentity
+					? objectBvh.isOccluded(ray, maxDist, stats)
+					: objectBvh.isOccluded(instance.rayToMeshSpace(ray), maxDist, stats);
+				if (isOccluded) {
+					stats.nodeVisits += nodeVisits;
+					return true;
+				}
+			}
+		}
+		if (stackSize == 0) {
+			break;
+		}
+		nodeIdx = stack[--stackSize];
+	}
+
+	stats.nodeVisits += nodeVisits;
+	return false;
+}
\ No newline at end of file
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "Bvh.h"
+#include "MeshInstance.h"
+
+/// Two-level acceleration structure over the instances of the scene's mesh objects.
+/// Each object has a bottom-level Bvh over its triangles in its own space,
+/// and the top-level hierarchy is built over the world space boxes of the instances.
+/// A ray reaching an instance is transformed to the instance's mesh space and traced through the object's Bvh,
+/// so an object placed many times is stored and built only once.
+struct InstanceBvh {
+	/// Builds the hierarchy of each object and the hierarchy over the instances.
+	/// The objects and the instances are not copied, so they have to outlive the hierarchy.
+	/// @param[in] objects Array of meshes
+	/// @param[in] objectsCount Number of meshes in the array
+	/// @param[in] instances Array of instances of the meshes
+	/// @param[in] instancesCount Number of instances in the array
+	/// @param[in] options Algorithm and number of threads to build both levels with
+	void build(
+		const Mesh *objects,
+		int objectsCount,
+		const MeshInstance *instances,
+		int instancesCount,
+		const BvhBuildOptions &options = BvhBuildOptions()
+	);
+
+	/// Updates the hierarchies after the vertices of some objects or the transforms of some instances move,
+	/// with the same triangles in the objects.
+	/// The objects' precomputed triangles and the instances' precomputed transforms have to be updated before.
+	/// Updates the hierarchies of the moved objects, see Bvh::update, and refits the top level,
+	/// which is rebuilt if it degrades past the threshold in the options.
+	/// @param[in] objIdxs Indices of the objects whose vertices moved
+	/// @param[in] objIdxsCount Number of the indices
+	/// @param[in] options Threshold of the rebuilds, algorithm and number of threads to rebuild with
+	/// @param[in,out] stats Stats to which the work done is added
+	void update(const int *objIdxs, int objIdxsCount, const BvhBuildOptions &options, BvhUpdateStats &stats);
+
+	/// Finds the closest intersection of a ray with a front side of a triangle of any instance.
+	/// @param[in] ray The ray to be intersected with the scene
+	/// @param[out] intersection The closest intersection in world space, if there is one
+	/// @param[in,out] stats Stats to which the work done is added
+	/// @return True if the ray intersects some triangle
+	bool intersect(const Ray &ray, TriangleIntersection &intersection, RayStats &stats) const;
+
+	/// Finds the closest intersection of each ray of a packet with a front side of a triangle of any instance.
+	/// A coherent packet traverses both levels together, other packets are traced ray by ray.
+	/// @param[in] packet The prepared packet of rays to be intersected with the scene
+	/// @param[out] intersections The closest intersection of each ray in world space, if there is one
+	/// @param[out] found For each ray, true if it intersects some triangle
+	/// @param[in,out] stats Stats to which the work done is added, node visits are counted once per packet
+	void intersect(const RayPacket &packet, TriangleIntersection *intersections, bool *found, RayStats &stats) const;
+
+	/// Checks if a ray intersects any triangle of any instance, from either side, closer than some distance.
+	/// @param[in] ray The ray to be intersected with the scene
+	/// @param[in] maxDist Intersections at this distance along the ray or further are ignored
+	/// @param[in,out] stats Stats to which the work done is added
+	/// @return True if the ray intersects some triangle before maxDist
+	bool isOccluded(const Ray &ray, float maxDist, RayStats &stats) const;
+
+	/// Returns the size in bytes of the nodes traversed by the rays, of the top level and of all objects' hierarchies
+	long long getNodesSize() const;
+
+	/// Hierarchy of each object over its triangles, in the object's space
+	Bvh *objectBvhs = nullptr;
+	int objectBvhsCount = 0;
+
+	/// Array of top-level nodes, the root is the first one.
+	/// A leaf's offset is the index of its first instance in the instanceIdxs array.
+	BvhNode *nodes = nullptr;
+	int nodesCount = 0;
+
+	/// Indices of the instances in the leaves, each leaf's instances are consecutive.
+	/// Instances of objects without triangles are left out.
+	int *instanceIdxs = nullptr;
+	int instanceIdxsCount = 0;
+
+	/// Meshes and instances over which the hierarchy is built
+	const Mesh *objects = nullptr;
+	const MeshInstance *instances = nullptr;
+	int instancesCount = 0;
+
+	/// Results of the last build, with the time of both levels, the use of the cache by the objects' hierarchies
+	/// and the SAH cost of the top level with each instance costing as much as its object's hierarchy
+	BvhBuildStats buildStats;
+
+private: /* functions */
+	/// Builds the hierarchy of each object, or loads it from the cache.
+	/// Small objects are built on a single thread each, several at once, and large ones with all threads.
+	void buildObjectBvhs(const BvhBuildOptions &options, int threadsCount);
+
+	/// Loads the hierarchy of an object from the cache, if it is enabled and has it.
+	/// Otherwise builds the hierarchy and writes it to the cache.
+	/// @param[in] objIdx Index of the object
+	/// @param[in] options Options of the build, with the number of threads for this object
+	/// @return True if the hierarchy is loaded from the cache
+	bool buildObjectBvh(int objIdx, const BvhBuildOptions &options);
+
+	/// Builds the top-level hierarchy over the instances, after the objects' hierarchies are built
+	void buildTopLevel(const BvhBuildOptions &options, int threadsCount);
+
+	/// Returns the SAH cost of the top level, with each instance costing as much as its object's hierarchy
+	float computeSahCost() const;
+
+	/// Intersects a packet with an instance, transforming the packet to the instance's mesh space
+	/// @param[in] instanceIdx Index of the instance
+	/// @param[in] packet The world space packet
+	/// @param[in,out] hits The closest intersection of each ray found so far
+	/// @param[in,out] hitInstanceIdxs Instance of each ray's closest intersection, updated for closer intersections
+	/// @param[in,out] stats Stats to which the work done is added
+	void intersectInstance(int instanceIdx, const RayPacket &packet, BvhHit *hits, int *hitInstanceIdxs, RayStats &stats) const;
+
+	/// Fills the world space intersection of a ray from an intersection found in the hierarchy of an instance's object
+	void getIntersection(const Ray &ray, const BvhHit &hit, int instanceIdx, TriangleIntersection &intersection) const;
+
+private: /* variables */
+	/// SAH cost of the top level alone when it was built, against which updates compare it
+	float topLevelBuiltCost = 0.f;
+};
\ No newline at end of file
@@ -1,11 +1,17 @@
 #include "Mesh.h"
 
+#include "utils/ProfileUtils.h"
+
+#include <cstring>
+
 Mesh::Mesh(Vec3f *vertices, int verticesCount, Vec3i *triangles, int trianglesCount)
 	: vertices(vertices)
 	, verticesCount(verticesCount)
 	, triangles(triangles)
 	, trianglesCount(trianglesCount)
-{}
+{
+	precomputeTriangles();
+}
 
 static void readVerticesFromJsonArr(Vec3f* &vertices, int &verticesCount, const rapidjson::Value::ConstArray &arr) {
 	assert(arr.Size() % 3 == 0);
@@ -76,4 +82,64 @@ void Mesh::readFromJson(const rapidjson::Value &json) {
 		assert(trianglesVal.IsArray());
 		readTrianglesFromJsonArr(triangles, trianglesCount, trianglesVal.GetArray());
 	}
+
+	precomputeTriangles();
+}
+
+void Mesh::precomputeTriangles() {
+	PROFILE_SCOPE("Mesh::precomputeTriangles");
+	delete[] precomputedTriangles;
+	precomputedTriangles = nullptr;
+	if (trianglesCount <= 0) {
+		return;
+	}
+
+	precomputedTriangles = new PrecomputedTriangle[trianglesCount];
+	for (int trIdx = 0; trIdx < trianglesCount; trIdx++) {
+		precomputedTriangles[trIdx] = precomputeTriangle(
+			vertices[triangles[trIdx].x],
+			vertices[triangles[trIdx].y],
+			vertices[triangles[trIdx].z]
+		);
+	}
+}
+
+/// Mixes a 64-bit word into a hash, with the steps of MurmurHash3
+static uint64_t mixHash(uint64_t hash, uint64_t word) {
+	word *= 0x87c37b91114253d5ULL;
+	word = (word << 31) | (word >> 33);
+	word *= 0x4cf5ad432745937fULL;
+	hash ^= word;
+	hash = (hash << 27) | (hash >> 37);
+	return hash * 5 + 0x52dce729;
+}
+
+/// Mixes the bytes of an array into a hash, 8 at a time
+static uint64_t mixHashBytes(uint64_t hash, const void *data, size_t size) {
+	const char *bytes = static_cast<const char *>(data);
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, bytes + i, sizeof(uint64_t));
+		hash = mixHash(hash, word);
+	}
+	uint64_t tail = 0;
+	if (i < size) {
+		memcpy(&tail, bytes + i, size - i);
+	}
+	return mixHash(hash, tail ^ uint64_t(size));
+}
+
+uint64_t Mesh::getGeometryHash() const {
+	PROFILE_SCOPE("Mesh::getGeometryHash");
+	uint64_t hash = 0x9e3779b97f4a7c15ULL;
+	hash = mixHashBytes(hash, vertices, size_t(verticesCount) * sizeof(Vec3f));
+	hash = mixHashBytes(hash, triangles, size_t(trianglesCount) * sizeof(Vec3i));
+	// Finalize the hash so that all of its bits depend on all of the input
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9f53fe49a53ULL;
+	hash ^= hash >> 33;
+	return hash;
 }
\ No newline at end of file
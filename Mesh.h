@@ -3,6 +3,8 @@
 #include "utils/MathUtils.h"
 #include "rapidjson/document.h"
 
+#include <cstdint>
+
 using namespace MathUtils;
 
 /// Class representing a single mesh object
@@ -17,6 +19,13 @@ struct Mesh {
 	/// Reads the mesh from a JSON value
 	void readFromJson(const rapidjson::Value &json);
 
+	/// Precomputes the intersection data of all triangles from the vertices and triangles arrays
+	void precomputeTriangles();
+
+	/// Returns a 64-bit hash of the vertices and triangles arrays,
+	/// which identifies the mesh's geometry in the BVH cache
+	uint64_t getGeometryHash() const;
+
 	/// Array of vertices represented with their 3 coordinates
 	Vec3f *vertices = nullptr;
 	int verticesCount = 0;
@@ -24,6 +33,9 @@ struct Mesh {
 	/// Array of triangles represented with the indices of their 3 vertices
 	Vec3i *triangles = nullptr;
 	int trianglesCount = 0;
+
+	/// Array of precomputed intersection data, one for each triangle in the triangles array
+	PrecomputedTriangle *precomputedTriangles = nullptr;
 };
 
 /// Class representing an intersection of a triangle
@@ -34,4 +46,6 @@ struct TriangleIntersection {
 	const Mesh *mesh = nullptr;
 	/// Pointer to the triangle that is intersected
 	const Vec3i *triangle = nullptr;
+	/// Unit normal of the intersected triangle
+	Vec3f normal = { 0.f, 0.f, 0.f };
 };
\ No newline at end of file
@@ -0,0 +1,59 @@
+#include "MeshInstance.h"
+
+#include "utils/JsonUtils.h"
+
+MeshInstance::MeshInstance(int meshIdx, const Matrix3f &matrix, const Vec3f &position)
+	: meshIdx(meshIdx)
+	, matrix(matrix)
+	, position(position)
+{
+	precomputeTransform();
+}
+
+void MeshInstance::readFromJson(const rapidjson::Value &json) {
+	assert(json.IsObject());
+
+	rapidjson::Value::ConstMemberIterator meshIt = json.FindMember("mesh");
+	assert(meshIt != json.MemberEnd() && meshIt->value.IsInt());
+	meshIdx = meshIt->value.GetInt();
+
+	rapidjson::Value::ConstMemberIterator matrixIt = json.FindMember("matrix");
+	if (matrixIt != json.MemberEnd() && !matrixIt->value.IsNull()) {
+		assert(matrixIt->value.IsArray());
+		matrix = JsonUtils::getMatrix3fFromJsonArr(matrixIt->value.GetArray());
+	}
+
+	rapidjson::Value::ConstMemberIterator positionIt = json.FindMember("position");
+	if (positionIt != json.MemberEnd() && !positionIt->value.IsNull()) {
+		assert(positionIt->value.IsArray());
+		position = JsonUtils::getVec3fFromJsonArr(positionIt->value.GetArray());
+	}
+
+	precomputeTransform();
+}
+
+/// Checks if two vectors are exactly equal
+static bool isEqual(const Vec3f &lhs, const Vec3f &rhs) {
+	return lhs.x == rhs.x && lhs.y == rhs.y && lhs.z == rhs.z;
+}
+
+void MeshInstance::precomputeTransform() {
+	const Matrix3f identity;
+	isIdentity = isEqual(matrix.xCol, identity.xCol) && isEqual(matrix.yCol, identity.yCol) && isEqual(matrix.zCol, identity.zCol)
+		&& isEqual(position, { 0.f, 0.f, 0.f });
+	invMatrix = matrix.getInverse();
+	normalMatrix = invMatrix.getTranspose();
+}
+
+BoundingBox MeshInstance::boxToWorldSpace(const BoundingBox &box) const {
+	BoundingBox worldBox;
+	for (int corner = 0; corner < 8; corner++) {
+		const Vec3f point = {
+			(corner & 1) ? box.max.x : box.min.x,
+			(corner & 2) ? box.max.y : box.min.y,
+			(corner & 4) ? box.max.z : box.min.z
+		};
+		worldBox.expand(matrix * point + position);
+	}
+	return worldBox;
+}
\ No newline at end of file
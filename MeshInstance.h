@@ -0,0 +1,62 @@
+#pragma once
+
+#include "utils/MathUtils.h"
+#include "rapidjson/document.h"
+
+using namespace MathUtils;
+
+/// Placed copy of a mesh object.
+/// The mesh's vertices are in the mesh's own space, and the instance's transform places them in world space,
+/// so a mesh repeated all over the scene is stored and its hierarchy built only once.
+struct MeshInstance {
+	/// Creates an instance of the first mesh with the identity transform
+	MeshInstance(){}
+
+	/// Creates an instance of a mesh with some transform
+	/// @param[in] meshIdx Index of the mesh in the scene's objects array
+	/// @param[in] matrix Linear part of the transform, it can rotate, scale and shear
+	/// @param[in] position Translation part of the transform, the world space position of the mesh's origin
+	MeshInstance(int meshIdx, const Matrix3f &matrix, const Vec3f &position);
+
+	/// Reads the instance from a JSON value
+	void readFromJson(const rapidjson::Value &json);
+
+	/// Precomputes the inverse transform, should be called after the transform changes
+	void precomputeTransform();
+
+	/// Transforms a world space ray to the mesh's space. The direction is not normalized,
+	/// so distances along the transformed ray are the same as along the world space one.
+	Ray rayToMeshSpace(const Ray &ray) const;
+
+	/// Transforms a unit normal from the mesh's space to world space
+	Vec3f normalToWorldSpace(const Vec3f &normal) const;
+
+	/// Transforms a box from the mesh's space to world space
+	/// @return The world space box around the transformed box
+	BoundingBox boxToWorldSpace(const BoundingBox &box) const;
+
+	/// Index of the mesh in the scene's objects array
+	int meshIdx = 0;
+
+	/// Linear part of the transform from the mesh's space to world space
+	Matrix3f matrix;
+	/// Translation part of the transform
+	Vec3f position = { 0.f, 0.f, 0.f };
+
+	/// Inverse of the matrix, transforms world space directions to the mesh's space
+	Matrix3f invMatrix;
+	/// Transposed inverse of the matrix, transforms normals to world space
+	Matrix3f normalMatrix;
+	/// Indicates whether the transform is the identity, so that rays and normals are used as they are
+	bool isIdentity = true;
+};
+
+// Called per ray and per visited instance, so defined in the header to be inlined
+
+inline Ray MeshInstance::rayToMeshSpace(const Ray &ray) const {
+	return { invMatrix * (ray.origin - position), invMatrix * ray.direction };
+}
+
+inline Vec3f MeshInstance::normalToWorldSpace(const Vec3f &normal) const {
+	return (normalMatrix * normal).getNormal();
+}
\ No newline at end of file
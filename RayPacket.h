@@ -0,0 +1,93 @@
+#pragma once
+
+#include "utils/MathUtils.h"
+
+#include <cmath>
+
+using namespace MathUtils;
+
+/// Width and height of the square block of pixels whose camera rays are traced together
+static const int rayPacketDim = 4;
+/// Maximum number of rays in a packet
+static const int rayPacketSize = rayPacketDim * rayPacketDim;
+
+/// Rays traced through the hierarchy together, like the camera rays of a block of neighbouring pixels.
+/// Fill the rays, set the count and call prepare() before tracing the packet.
+struct RayPacket {
+	/// Computes the inverse directions and the bounds used to cull nodes for the whole packet.
+	/// The packet is coherent if all rays start at the same point and their directions have the same signs.
+	/// Packets which are not are traced ray by ray.
+	void prepare() {
+		isCoherent = raysCount > 0;
+		minInvDirection = { INFINITY, INFINITY, INFINITY };
+		maxInvDirection = { -INFINITY, -INFINITY, -INFINITY };
+		for (int i = 0; i < raysCount; i++) {
+			const Vec3f &dir = rays[i].direction;
+			invDirections[i] = { 1.f / dir.x, 1.f / dir.y, 1.f / dir.z };
+			minInvDirection = {
+				getMin(minInvDirection.x, invDirections[i].x),
+				getMin(minInvDirection.y, invDirections[i].y),
+				getMin(minInvDirection.z, invDirections[i].z)
+			};
+			maxInvDirection = {
+				getMax(maxInvDirection.x, invDirections[i].x),
+				getMax(maxInvDirection.y, invDirections[i].y),
+				getMax(maxInvDirection.z, invDirections[i].z)
+			};
+			const Vec3f &firstDir = rays[0].direction;
+			isCoherent = isCoherent
+				&& rays[i].origin.x == rays[0].origin.x
+				&& rays[i].origin.y == rays[0].origin.y
+				&& rays[i].origin.z == rays[0].origin.z
+				&& (dir.x < 0.f) == (firstDir.x < 0.f)
+				&& (dir.y < 0.f) == (firstDir.y < 0.f)
+				&& (dir.z < 0.f) == (firstDir.z < 0.f)
+				&& std::isfinite(invDirections[i].x)
+				&& std::isfinite(invDirections[i].y)
+				&& std::isfinite(invDirections[i].z);
+		}
+	}
+
+	/// The rays of the packet, only the first raysCount are used
+	Ray rays[rayPacketSize];
+	int raysCount = 0;
+
+	/// Per-coordinate inverse of each ray's direction
+	Vec3f invDirections[rayPacketSize];
+	/// Per-coordinate minimum and maximum of the inverse directions of all rays
+	Vec3f minInvDirection;
+	Vec3f maxInvDirection;
+	/// Indicates whether the rays share their origin and the signs of their directions
+	bool isCoherent = false;
+};
+
+/// Checks if a coherent packet may intersect a box, with interval arithmetic over the inverse directions of its rays.
+/// It is conservative - it can return true when no ray intersects the box, but never false when some does.
+/// @param[in] packet The coherent packet of rays
+/// @param[in] box The bounding box to be intersected
+/// @param[in] maxDist Intersections further than this distance along any ray are ignored
+/// @return False if no ray of the packet intersects the box between its origin and maxDist
+inline bool packetBoxIntersection(const RayPacket &packet, const BoundingBox &box, float maxDist) {
+	const Vec3f &origin = packet.rays[0].origin;
+	const Vec3f &minInv = packet.minInvDirection;
+	const Vec3f &maxInv = packet.maxInvDirection;
+	// For each slab, the smallest entry and the largest exit distance of any ray.
+	// The distance to a plane is monotonic in the inverse direction, so the extremes come from its bounds.
+	float tNear = 0.f;
+	float tFar = maxDist;
+	const float slabs[3][2] = {
+		{ box.min.x - origin.x, box.max.x - origin.x },
+		{ box.min.y - origin.y, box.max.y - origin.y },
+		{ box.min.z - origin.z, box.max.z - origin.z }
+	};
+	const float invBounds[3][2] = { { minInv.x, maxInv.x }, { minInv.y, maxInv.y }, { minInv.z, maxInv.z } };
+	for (int axis = 0; axis < 3; axis++) {
+		const float t1 = slabs[axis][0] * invBounds[axis][0];
+		const float t2 = slabs[axis][0] * invBounds[axis][1];
+		const float t3 = slabs[axis][1] * invBounds[axis][0];
+		const float t4 = slabs[axis][1] * invBounds[axis][1];
+		tNear = getMax(tNear, getMin(getMin(t1, t2), getMin(t3, t4)));
+		tFar = getMin(tFar, getMax(getMax(t1, t2), getMax(t3, t4)));
+	}
+	return tNear <= tFar;
+}
\ No newline at end of file
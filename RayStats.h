@@ -0,0 +1,32 @@
+#pragma once
+
+/// Counters of the work done while tracing rays.
+/// Each thread counts into its own instance, and the instances are summed when the threads are done,
+/// so counting needs no atomics.
+struct RayStats {
+	/// Number of camera rays traced
+	long long primaryRays = 0;
+	/// Number of shadow rays traced
+	long long shadowRays = 0;
+	/// Number of ray/triangle intersection tests
+	long long triangleTests = 0;
+	/// Number of ray/triangle intersection tests that found an intersection
+	long long triangleHits = 0;
+	/// Number of acceleration structure nodes visited
+	long long nodeVisits = 0;
+
+	/// Adds the counters of other stats to these stats
+	RayStats& operator+=(const RayStats &other) {
+		primaryRays += other.primaryRays;
+		shadowRays += other.shadowRays;
+		triangleTests += other.triangleTests;
+		triangleHits += other.triangleHits;
+		nodeVisits += other.nodeVisits;
+		return *this;
+	}
+
+	/// Returns the cost of the work counted, as the number of triangle tests and node visits
+	long long getCost() const {
+		return triangleTests + nodeVisits;
+	}
+};
@@ -1,9 +1,26 @@
 #include "RayTracer.h"
 
+#include "utils/CpuUtils.h"
+#include "utils/ProfileUtils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <functional>
 #include <cmath>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
 
 static const int maxColorComponent = 255;
+/// Width and height of the square tiles in which the image is split for tracing, in pixels
+static const int tileSize = 32;
 
 RayTracer::RayTracer(const Scene &scene)
 	: scene(scene)
@@ -11,129 +28,199 @@ RayTracer::RayTracer(const Scene &scene)
 	if (scene.imageResolution.x > 0 && scene.imageResolution.y > 0) {
 		const int totalPixels = scene.imageResolution.x * scene.imageResolution.y;
 
-		rays = new Ray[totalPixels];
-		generateRays();
+		pixels = new Color[totalPixels];
+		precomputeRayGeneration();
 	}
 }
 
 RayTracer::~RayTracer() {
-	delete[] rays;
+	delete[] pixels;
+	delete[] pixelCosts;
 }
 
-bool RayTracer::renderImage(const char *filepath) const {
-	if (!rays) {
+bool RayTracer::renderImage(const char *filepath, const RenderOptions &options) const {
+	PROFILE_SCOPE("RayTracer::renderImage");
+	if (!pixels) {
 		return false;
 	}
 
-	const int totalPixels = scene.imageResolution.x * scene.imageResolution.y;
-	pixels = new Color[totalPixels];
-	traceRays();
+	int threadsCount = options.threadsCount;
+	if (threadsCount <= 0) {
+		threadsCount = getMax(1, int(std::thread::hardware_concurrency()));
+	}
+	// Pixel costs are counted only for a heatmap
+	if (options.heatmapFilepath && !pixelCosts) {
+		pixelCosts = new long long[scene.imageResolution.x * scene.imageResolution.y];
+	}
 
-	return writePixelsToFile(filepath);
-}
+	const auto traceStart = std::chrono::steady_clock::now();
+	traceRays(threadsCount, options.rayPackets);
+	const std::chrono::duration<double> traceTime = std::chrono::steady_clock::now() - traceStart;
 
-void RayTracer::generateRays() const {
-	// Traverse pixels of the image
-	for (Vec2i pixel = { 0, 0 }; pixel.y < scene.imageResolution.y; pixel.y++) {
-		for (pixel.x = 0; pixel.x < scene.imageResolution.x; pixel.x++) {
-			// Index of the ray in the rays array - same as the pixel index
-			const int rayIdx = pixel.y * scene.imageResolution.x + pixel.x;
-			// Generate a ray for this pixel and save it in the rays array
-			rays[rayIdx] = generateRay(pixel);
+	if (options.printStats) {
+		printStats(traceTime.count());
+	}
+	if (options.heatmapFilepath) {
+		const bool isHeatmapWritten = writeHeatmapToFile(options.heatmapFilepath, options.imageFormat);
+		// Free the costs, so that later renders without a heatmap don't count them
+		delete[] pixelCosts;
+		pixelCosts = nullptr;
+		if (!isHeatmapWritten) {
+			return false;
 		}
 	}
+	return writePixelsToFile(pixels, filepath, options.imageFormat);
+}
+
+void RayTracer::precomputeRayGeneration() {
+	PROFILE_SCOPE("RayTracer::precomputeRayGeneration");
+	// A pixel's center maps to a point on the image plane in camera space:
+	//   X = ((pixel.x + 0.5) / width * 2 - 1) * viewWidth / 2
+	//   Y = (1 - (pixel.y + 0.5) / height * 2) * viewHeight / 2
+	//   Z = -viewDepth
+	// which is linear in the pixel coordinates, and so is its rotation to world space.
+	// So the world space direction is an origin plus a step per pixel along X and Y.
+	const Vec2f pixelSize = {
+		scene.camera.viewSize.x / float(scene.imageResolution.x),
+		scene.camera.viewSize.y / float(scene.imageResolution.y)
+	};
+	const Vec3f topLeftPixelCenter = {
+		(0.5f - float(scene.imageResolution.x) * 0.5f) * pixelSize.x,
+		(float(scene.imageResolution.y) * 0.5f - 0.5f) * pixelSize.y,
+		-scene.camera.viewDepth
+	};
+	rayDirectionOrigin = scene.camera.rotation * topLeftPixelCenter;
+	rayDirectionStepX = scene.camera.rotation.xCol * pixelSize.x;
+	rayDirectionStepY = scene.camera.rotation.yCol * -pixelSize.y;
 }
 
 Ray RayTracer::generateRay(const Vec2i &pixel) const {
 	Ray ray;
+	ray.origin = scene.camera.position;
+	ray.direction = (rayDirectionOrigin + rayDirectionStepX * float(pixel.x) + rayDirectionStepY * float(pixel.y)).getNormal();
+	return ray;
+}
 
-	const Vec2f pixelCenter = {
-		float(pixel.x) + 0.5f,
-		float(pixel.y) + 0.5f
-	};
+void RayTracer::traceRays(int threadsCount, bool rayPackets) const {
+	PROFILE_SCOPE("RayTracer::traceRays");
+	const int tilesCountX = (scene.imageResolution.x + tileSize - 1) / tileSize;
+	const int tilesCountY = (scene.imageResolution.y + tileSize - 1) / tileSize;
+	const int tilesCount = tilesCountX * tilesCountY;
 
-	const Vec2f ndcPoint = {
-		pixelCenter.x / float(scene.imageResolution.x),
-		pixelCenter.y / float(scene.imageResolution.y)
+	// Index of the next tile that is not yet taken by any thread
+	std::atomic<int> nextTileIdx(0);
+	// Each thread keeps taking the next free tile and tracing it until there are no tiles left.
+	// Every pixel is traced the same way regardless of which thread takes its tile,
+	// so the result doesn't depend on the number of threads.
+	// Each thread counts the work it does in its own stats, kept on its own stack while tracing,
+	// so that the threads don't write to the same cache lines for every ray.
+	auto traceTiles = [this, &nextTileIdx, tilesCount, rayPackets](RayStats &threadStats) {
+		RayStats localStats;
+		for (int tileIdx = nextTileIdx++; tileIdx < tilesCount; tileIdx = nextTileIdx++) {
+			traceTile(tileIdx, rayPackets, localStats);
+		}
+		threadStats = localStats;
 	};
 
-	const Vec2f screenPoint = {
-		ndcPoint.x * 2.f - 1.f,
-		1.f - ndcPoint.y * 2.f
-	};
+	threadsCount = getMax(1, getMin(threadsCount, tilesCount));
+	std::vector<RayStats> threadsStats(threadsCount);
+	std::vector<std::thread> threads;
+	for (int threadIdx = 1; threadIdx < threadsCount; threadIdx++) {
+		threads.emplace_back(traceTiles, std::ref(threadsStats[threadIdx]));
+	}
+	// The calling thread traces tiles too
+	traceTiles(threadsStats[0]);
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
 
-	const Vec2f worldPoint = {
-		screenPoint.x * scene.camera.viewSize.x * 0.5f,
-		screenPoint.y * scene.camera.viewSize.y * 0.5f
-	};
+	stats = RayStats();
+	for (const RayStats &threadStats : threadsStats) {
+		stats += threadStats;
+	}
+}
 
-	const Vec3f cameraToPixel = {
-		worldPoint.x,
-		worldPoint.y,
-		-scene.camera.viewDepth
+void RayTracer::traceTile(int tileIdx, bool rayPackets, RayStats &stats) const {
+	PROFILE_SCOPE_ARG("RayTracer::traceTile", tileIdx);
+	const int tilesCountX = (scene.imageResolution.x + tileSize - 1) / tileSize;
+	// Pixel range covered by the tile, clipped by the image borders
+	const Vec2i tileMin = { (tileIdx % tilesCountX) * tileSize, (tileIdx / tilesCountX) * tileSize };
+	const Vec2i tileMax = {
+		getMin(tileMin.x + tileSize, scene.imageResolution.x),
+		getMin(tileMin.y + tileSize, scene.imageResolution.y)
 	};
+	if (rayPackets) {
+		// Traverse blocks of pixels of the tile, the blocks at its right and bottom edges may be smaller
+		for (Vec2i blockMin = tileMin; blockMin.y < tileMax.y; blockMin.y += rayPacketDim) {
+			for (blockMin.x = tileMin.x; blockMin.x < tileMax.x; blockMin.x += rayPacketDim) {
+				const Vec2i blockMax = {
+					getMin(blockMin.x + rayPacketDim, tileMax.x),
+					getMin(blockMin.y + rayPacketDim, tileMax.y)
+				};
+				tracePacket(blockMin, blockMax, stats);
+			}
+		}
+		return;
+	}
+	// Traverse pixels of the tile
+	for (Vec2i pixel = tileMin; pixel.y < tileMax.y; pixel.y++) {
+		for (pixel.x = tileMin.x; pixel.x < tileMax.x; pixel.x++) {
+			// Index of the pixel in the pixels array
+			const int pixIdx = pixel.y * scene.imageResolution.x + pixel.x;
+			const long long costBefore = stats.getCost();
+			// Generate a ray for the pixel, trace it and save the calculated color to the pixels array
+			stats.primaryRays++;
+			pixels[pixIdx] = traceRay(generateRay(pixel), stats);
+			if (pixelCosts) {
+				pixelCosts[pixIdx] = stats.getCost() - costBefore;
+			}
+		}
+	}
+}
 
-	ray.origin = scene.camera.position;
-	ray.direction = scene.camera.rotation * cameraToPixel.getNormal();
+void RayTracer::tracePacket(const Vec2i &blockMin, const Vec2i &blockMax, RayStats &stats) const {
+	RayPacket packet;
+	int pixIdxs[rayPacketSize];
+	for (Vec2i pixel = blockMin; pixel.y < blockMax.y; pixel.y++) {
+		for (pixel.x = blockMin.x; pixel.x < blockMax.x; pixel.x++) {
+			pixIdxs[packet.raysCount] = pixel.y * scene.imageResolution.x + pixel.x;
+			packet.rays[packet.raysCount++] = generateRay(pixel);
+		}
+	}
+	packet.prepare();
+	stats.primaryRays += packet.raysCount;
 
-	return ray;
-}
+	const long long costBefore = stats.getCost();
+	TriangleIntersection intersections[rayPacketSize];
+	bool found[rayPacketSize];
+	scene.bvh.intersect(packet, intersections, found, stats);
+	const long long packetCost = (stats.getCost() - costBefore) / packet.raysCount;
 
-void RayTracer::traceRays() const {
-	// Traverse rays
-	for (int rayIdx = 0; rayIdx < scene.imageResolution.x * scene.imageResolution.y; rayIdx++) {
-		// Trace each ray and save the calculated color to the corresponding pixel in the pixels array
-		pixels[rayIdx] = traceRay(rays[rayIdx]);
+	for (int i = 0; i < packet.raysCount; i++) {
+		const long long shadingCostBefore = stats.getCost();
+		pixels[pixIdxs[i]] = found[i] ? shadeIntersection(intersections[i], stats) : scene.backgroundColor;
+		if (pixelCosts) {
+			pixelCosts[pixIdxs[i]] = packetCost + stats.getCost() - shadingCostBefore;
+		}
 	}
 }
 
-Color RayTracer::traceRay(const Ray &ray) const {
+Color RayTracer::traceRay(const Ray &ray, RayStats &stats) const {
 	// Find the closest intersection of a triangle with the ray
 	TriangleIntersection closestIntersection;
-	float minDist = -1.f;
-	// Traverse all objects in the scene
-	for (int objIdx = 0; objIdx < scene.objectsCount; objIdx++) {
-		const Mesh &obj = scene.objects[objIdx];
-		// Traverse all triangles of the object
-		for (int trIdx = 0; trIdx < obj.trianglesCount; trIdx++) {
-			// Check for an intersection between the ray and the current triangle.
-			const RayTriangleIntersectionResult intersectionResult = rayTriangleIntersection(
-				ray,
-				obj.vertices[obj.triangles[trIdx].x],
-				obj.vertices[obj.triangles[trIdx].y],
-				obj.vertices[obj.triangles[trIdx].z]
-			);
-			// Here we are considering only intersections through the front side of the triangle
-			if (!intersectionResult.doesIntersect || !intersectionResult.frontSide) {
-				continue;
-			}
-			// If this is the first intersection found,
-			// or it is closer than the currently closest,
-			// than update the closest with the current one.
-			if (minDist == -1 || intersectionResult.distAlongRay < minDist) {
-				minDist = intersectionResult.distAlongRay;
-				closestIntersection.point = intersectionResult.point;
-				closestIntersection.mesh = &obj;
-				closestIntersection.triangle = &obj.triangles[trIdx];
-			}
-		}
-	}
-
-	if (minDist == -1.f) {
+	if (!scene.bvh.intersect(ray, closestIntersection, stats)) {
 		return scene.backgroundColor;
 	}
 
-	return shadeIntersection(closestIntersection);
+	return shadeIntersection(closestIntersection, stats);
 }
 
-Color RayTracer::shadeIntersection(const TriangleIntersection &intersection) const {
+Color RayTracer::shadeIntersection(const TriangleIntersection &intersection, RayStats &stats) const {
+	// Called for every hit, so only its total time is accumulated, without a span per call
+	PROFILE_ACCUMULATE("RayTracer::shadeIntersection");
 	Color result = { 0.f, 0.f, 0.f };
-	// Calculate intersected triangle's normal
-	const Vec3f trNormal = getTriangleNormal(
-		intersection.mesh->vertices[intersection.triangle->x],
-		intersection.mesh->vertices[intersection.triangle->y],
-		intersection.mesh->vertices[intersection.triangle->z]
-	);
+	// Intersected triangle's normal, precomputed with the mesh
+	const Vec3f &trNormal = intersection.normal;
 	// Traverse lights in the scene
 	for (int lIdx = 0; lIdx < scene.lightsCount; lIdx++) {
 		const Light &light = scene.lights[lIdx];
@@ -148,37 +235,16 @@ Color RayTracer::shadeIntersection(const TriangleIntersection &intersection) con
 			intersection.point + trNormal * scene.shadowBias,
 			lightDir
 		};
+		// Calculate the distance to the light
+		const float lightDist = lightVec.getLength();
 		// Check if the intersection point is in shadow.
-		// It's in shadow if the shadow ray intersects any triangles in the scene.
-		bool inShadow = false;
-		// Traverse all objects in the scene
-		for (int objIdx = 0; objIdx < scene.objectsCount; objIdx++) {
-			const Mesh &obj = scene.objects[objIdx];
-			// Traverse all triangles of the object
-			for (int trIdx = 0; trIdx < obj.trianglesCount; trIdx++) {
-				// Check for intersection between the shadow ray and the current triangle.
-				const RayTriangleIntersectionResult intersectionResult = rayTriangleIntersection(
-					shadowRay,
-					obj.vertices[obj.triangles[trIdx].x],
-					obj.vertices[obj.triangles[trIdx].y],
-					obj.vertices[obj.triangles[trIdx].z]
-				);
-				// If there is an intersection,
-				// then the point is in shadow and we can stop looking for other intersections.
-				// Here we are considering both intersections from the front and from the back side of the triangle.
-				if (intersectionResult.doesIntersect) {
-					inShadow = true;
-					break;
-				}
-			}
-			if (inShadow) {
-				break;
-			}
-		}
+		// It's in shadow if the shadow ray intersects any triangle in the scene before reaching the light.
+		stats.shadowRays++;
+		const bool inShadow = scene.bvh.isOccluded(shadowRay, lightDist, stats);
 		// If the point is not in shadow, then the current light contributes to the final result
 		if (!inShadow) {
 			// Calculate the radius and area of the sphere centered at the light and passing through the intersection point
-			const float sphRadius = lightVec.getLength();
+			const float sphRadius = lightDist;
 			const float sphArea = 4 * M_PI * sphRadius * sphRadius;
 			// Calculate the cosine law for the light direction and triangle's normal
 			const float cosLaw = getMax(0.f, dotProduct(lightDir, trNormal));
@@ -189,11 +255,180 @@ Color RayTracer::shadeIntersection(const TriangleIntersection &intersection) con
 	return result;
 }
 
-bool RayTracer::writePixelsToFile(const char *filepath) const {
-	if (!pixels) {
+void RayTracer::printStats(double seconds) const {
+	const long long raysCount = stats.primaryRays + stats.shadowRays;
+	// Avoid division by zero for empty renders
+	const double raysDivisor = double(getMax(1LL, raysCount));
+	std::cout << "Traced " << stats.primaryRays << " primary and " << stats.shadowRays << " shadow rays in " << seconds << "s"
+		<< " (" << double(raysCount) / getMax(seconds, 1e-9) / 1e6 << " Mrays/s)\n";
+	std::cout << "  triangle tests: " << stats.triangleTests << " (" << double(stats.triangleTests) / raysDivisor << " per ray)\n";
+	std::cout << "  triangle hits:  " << stats.triangleHits << " (" << double(stats.triangleHits) / raysDivisor << " per ray)\n";
+	std::cout << "  node visits:    " << stats.nodeVisits << " (" << double(stats.nodeVisits) / raysDivisor << " per ray)\n";
+	std::cout << "  kernels:        " << CpuUtils::getIsaLevelName(CpuUtils::getIsaLevel()) << "\n";
+	const BvhBuildStats &buildStats = scene.bvh.buildStats;
+	std::cout << "  bvh:            " << getBvhBuildModeName(buildStats.mode) << ", built in " << buildStats.seconds << "s"
+		<< ", SAH cost " << buildStats.sahCost << ", " << scene.bvh.nodesCount << " nodes"
+		<< " over " << scene.instancesCount << " instances of " << scene.objectsCount << " objects\n";
+	long long trianglesCount = 0;
+	for (int objIdx = 0; objIdx < scene.objectsCount; objIdx++) {
+		trianglesCount += scene.objects[objIdx].trianglesCount;
+	}
+	if (buildStats.mode == BvhBuildMode::Sbvh) {
+		std::cout << "  spatial splits: " << buildStats.duplicatedRefs << " references added"
+			<< " (" << 100.0 * double(buildStats.duplicatedRefs) / double(getMax(1LL, trianglesCount)) << "% of the triangles,"
+			<< " budget " << 100.0 * buildStats.spatialSplitBudget << "%)\n";
+	}
+	std::cout << "  bvh layout:     " << getBvhLayoutName(buildStats.layout) << ", " << scene.bvh.getNodesSize() << " bytes of nodes"
+		<< " (" << double(scene.bvh.getNodesSize()) / double(getMax(1LL, trianglesCount)) << " per triangle)\n";
+}
+
+/// Maps a value in range [0, 1] to a color of a heatmap,
+/// going through dark blue, blue, cyan, yellow and red as the value grows
+static Color heatmapColor(float value) {
+	static const Color ramp[] = {
+		{ 0.f, 0.f, 0.2f },
+		{ 0.f, 0.f, 1.f },
+		{ 0.f, 1.f, 1.f },
+		{ 1.f, 1.f, 0.f },
+		{ 1.f, 0.f, 0.f }
+	};
+	static const int rampSegments = int(sizeof(ramp) / sizeof(ramp[0])) - 1;
+	const float pos = getMin(getMax(value, 0.f), 1.f) * float(rampSegments);
+	const int segment = getMin(int(pos), rampSegments - 1);
+	const float t = pos - float(segment);
+	return ramp[segment] * (1.f - t) + ramp[segment + 1] * t;
+}
+
+bool RayTracer::writeHeatmapToFile(const char *filepath, ImageFormat format) const {
+	PROFILE_SCOPE("RayTracer::writeHeatmapToFile");
+	if (!pixelCosts) {
+		return false;
+	}
+
+	const int totalPixels = scene.imageResolution.x * scene.imageResolution.y;
+	const long long maxCost = getMax(1LL, *std::max_element(pixelCosts, pixelCosts + totalPixels));
+	std::vector<Color> heatmap(totalPixels);
+	for (int pixIdx = 0; pixIdx < totalPixels; pixIdx++) {
+		heatmap[pixIdx] = heatmapColor(float(double(pixelCosts[pixIdx]) / double(maxCost)));
+	}
+	return writePixelsToFile(heatmap.data(), filepath, format);
+}
+
+/// Converts a color component in range [0, 1] to an integer in range [0, maxColorComponent].
+/// Components outside the range are clamped, so that bright pixels don't overflow.
+static int colorComponentToInt(float component) {
+	return int(getMin(getMax(component, 0.f), 1.f) * float(maxColorComponent));
+}
+
+// Each componentsToBytes function converts a prefix of an array of color components to bytes,
+// as many components as its registers fit, and returns the number of converted components.
+// The rest are converted one by one.
+
+#ifdef CPU_X86
+
+/// 16 components at a time
+CPU_TARGET_SSE42 static int componentsToBytesSse42(const float *components, int componentsCount, unsigned char *bytes) {
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 scale = _mm_set1_ps(float(maxColorComponent));
+	int i = 0;
+	for (; i + 16 <= componentsCount; i += 16) {
+		// Clamp and scale 4 groups of 4 components and convert them to 32-bit integers
+		__m128i ints[4];
+		for (int j = 0; j < 4; j++) {
+			const __m128 clamped = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(components + i + j * 4), zero), one);
+			ints[j] = _mm_cvttps_epi32(_mm_mul_ps(clamped, scale));
+		}
+		// Pack the integers, which are all in range [0, 255], down to 16 bytes
+		const __m128i shorts0 = _mm_packs_epi32(ints[0], ints[1]);
+		const __m128i shorts1 = _mm_packs_epi32(ints[2], ints[3]);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(bytes + i), _mm_packus_epi16(shorts0, shorts1));
+	}
+	return i;
+}
+
+/// 32 components at a time
+CPU_TARGET_AVX2 static int componentsToBytesAvx2(const float *components, int componentsCount, unsigned char *bytes) {
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.f);
+	const __m256 scale = _mm256_set1_ps(float(maxColorComponent));
+	// The packs work within each 128-bit half, which leaves groups of 4 bytes interleaved between the halves
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	int i = 0;
+	for (; i + 32 <= componentsCount; i += 32) {
+		__m256i ints[4];
+		for (int j = 0; j < 4; j++) {
+			const __m256 clamped = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(components + i + j * 8), zero), one);
+			ints[j] = _mm256_cvttps_epi32(_mm256_mul_ps(clamped, scale));
+		}
+		const __m256i shorts0 = _mm256_packs_epi32(ints[0], ints[1]);
+		const __m256i shorts1 = _mm256_packs_epi32(ints[2], ints[3]);
+		const __m256i packed = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(shorts0, shorts1), order);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(bytes + i), packed);
+	}
+	return i;
+}
+
+/// 16 components at a time, narrowed straight to bytes
+CPU_TARGET_AVX512 static int componentsToBytesAvx512(const float *components, int componentsCount, unsigned char *bytes) {
+	const __m512 zero = _mm512_setzero_ps();
+	const __m512 one = _mm512_set1_ps(1.f);
+	const __m512 scale = _mm512_set1_ps(float(maxColorComponent));
+	int i = 0;
+	for (; i + 16 <= componentsCount; i += 16) {
+		const __m512 clamped = _mm512_min_ps(_mm512_max_ps(_mm512_loadu_ps(components + i), zero), one);
+		const __m512i ints = _mm512_cvttps_epi32(_mm512_mul_ps(clamped, scale));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(bytes + i), _mm512_cvtusepi32_epi8(ints));
+	}
+	return i;
+}
+
+#endif
+
+/// Converts an array of colors to an array of bytes, one per color component.
+/// Uses the SIMD instructions of the level picked by CpuUtils for most of the components.
+/// @param[in] colors Array of colors
+/// @param[in] colorsCount Number of colors in the array
+/// @param[out] bytes Array of 3 * colorsCount bytes to be filled
+static void colorsToBytes(const Color *colors, int colorsCount, unsigned char *bytes) {
+	static_assert(sizeof(Color) == 3 * sizeof(float), "Colors are expected to be 3 tightly packed floats");
+	const float *components = &colors[0].x;
+	const int componentsCount = colorsCount * 3;
+	int i = 0;
+	switch (CpuUtils::getIsaLevel()) {
+#ifdef CPU_X86
+	case CpuUtils::IsaLevel::Avx512:
+		i = componentsToBytesAvx512(components, componentsCount, bytes);
+		break;
+	case CpuUtils::IsaLevel::Avx2:
+		i = componentsToBytesAvx2(components, componentsCount, bytes);
+		break;
+	case CpuUtils::IsaLevel::Sse42:
+		i = componentsToBytesSse42(components, componentsCount, bytes);
+		break;
+#endif
+	default:
+		break;
+	}
+	// Convert the remaining components one by one
+	for (; i < componentsCount; i++) {
+		bytes[i] = (unsigned char)(colorComponentToInt(components[i]));
+	}
+}
+
+bool RayTracer::writePixelsToFile(const Color *image, const char *filepath, ImageFormat format) const {
+	PROFILE_SCOPE("RayTracer::writePixelsToFile");
+	if (!image) {
 		return false;
 	}
 
+	if (format == ImageFormat::PpmText) {
+		return writePixelsToPpmText(image, filepath);
+	}
+	return writePixelsToPpmBinary(image, filepath);
+}
+
+bool RayTracer::writePixelsToPpmText(const Color *image, const char *filepath) const {
 	// Open stream to the output file
 	std::ofstream ppmFileStream(filepath, std::ios::out | std::ios::binary);
 	if (!ppmFileStream.is_open()) {
@@ -209,12 +444,12 @@ bool RayTracer::writePixelsToFile(const char *filepath) const {
 		for (pixel.x = 0; pixel.x < scene.imageResolution.x; pixel.x++) {
 			// Index of the pixel in the pixels array
 			const int pixIdx = pixel.y * scene.imageResolution.x + pixel.x;
-			// Use the pixel's color from the pixels array
-			const Color color = pixels[pixIdx];
+			// Use the pixel's color from the image
+			const Color color = image[pixIdx];
 			// Write the color to the output image file for the current pixel
-			ppmFileStream << int(color.x * maxColorComponent)
-				<< " " << int(color.y * maxColorComponent)
-				<< " " << int(color.z * maxColorComponent)
+			ppmFileStream << colorComponentToInt(color.x)
+				<< " " << colorComponentToInt(color.y)
+				<< " " << colorComponentToInt(color.z)
 				<< "\t";
 		}
 		ppmFileStream << "\n";
@@ -223,4 +458,28 @@ bool RayTracer::writePixelsToFile(const char *filepath) const {
     ppmFileStream.close();
 
 	return true;
+}
+
+bool RayTracer::writePixelsToPpmBinary(const Color *image, const char *filepath) const {
+	// Open stream to the output file
+	std::ofstream ppmFileStream(filepath, std::ios::out | std::ios::binary);
+	if (!ppmFileStream.is_open()) {
+		return false;
+	}
+
+	// PPM metadata about PPM version, image resolution and max color component
+	const std::string header = "P6\n"
+		+ std::to_string(scene.imageResolution.x) + " " + std::to_string(scene.imageResolution.y) + "\n"
+		+ std::to_string(maxColorComponent) + "\n";
+
+	// Put the metadata and the converted pixels in a single buffer, so that the whole file is written at once
+	const int totalPixels = scene.imageResolution.x * scene.imageResolution.y;
+	std::vector<unsigned char> buffer(header.size() + size_t(totalPixels) * 3);
+	std::copy(header.begin(), header.end(), buffer.begin());
+	colorsToBytes(image, totalPixels, buffer.data() + header.size());
+
+	ppmFileStream.write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+	ppmFileStream.close();
+
+	return bool(ppmFileStream);
 }
\ No newline at end of file
@@ -1,11 +1,37 @@
 #pragma once
 
 #include "Camera.h"
+#include "RayStats.h"
 #include "Scene.h"
 #include "utils/MathUtils.h"
 
 using namespace MathUtils;
 
+/// Formats in which the rendered image can be written
+enum class ImageFormat {
+	/// Plain text PPM (P3), one formatted number per color component
+	PpmText,
+	/// Binary PPM (P6), one byte per color component
+	PpmBinary
+};
+
+/// Options controlling how a single image is rendered
+struct RenderOptions {
+	/// Number of threads tracing rays in parallel.
+	/// If it is 0 or less, the number of hardware threads is used.
+	int threadsCount = 0;
+	/// Format of the output image file
+	ImageFormat imageFormat = ImageFormat::PpmBinary;
+	/// Indicates whether to trace the camera rays of blocks of pixels as packets, or each ray alone.
+	/// The image is the same either way.
+	bool rayPackets = true;
+	/// Indicates whether to print the ray stats and the rays per second after the render
+	bool printStats = false;
+	/// Path to an image file for a heatmap of the cost of each pixel.
+	/// If it is null, no heatmap is written.
+	const char *heatmapFilepath = nullptr;
+};
+
 /// Class representing the ray tracer,
 /// capable of generating and tracing rays based on the pixels of some image,
 /// and using them to generate an output image file.
@@ -19,46 +45,108 @@ struct RayTracer {
 
 	/// Renders an image and writes it to an image file.
 	/// @param[in] filepath Path to the output image
+	/// @param[in] options Options for the render
 	/// @return True on success
-	bool renderImage(const char *filepath) const;
+	bool renderImage(const char *filepath, const RenderOptions &options = RenderOptions()) const;
+
+	/// Returns the stats of the work done by the last render
+	const RayStats& getStats() const { return stats; }
 
 private: /* functions */
-	/// Generates rays for all pixels of the image.
-	/// Saves them to the member array of rays.
-	void generateRays() const;
-	
+	/// Precomputes the camera data needed to generate rays for the pixels of the image.
+	/// Saves it to the member ray generation variables.
+	void precomputeRayGeneration();
+
 	/// Generates a single ray for a single pixel of the image.
+	/// Uses only the precomputed ray generation data, with no matrix multiplication and no division by the resolution.
 	/// @param[in] pixel Index of a pixel from the image
 	/// @return Generated ray through the given pixel
 	Ray generateRay(const Vec2i &pixel) const;
 
-	/// Traces all generated rays for all pixels of the image.
+	/// Traces rays for all pixels of the image.
+	/// The image is split into tiles which are traced in parallel by a number of threads.
 	/// Saves the results to the pixels member array.
-	void traceRays() const;
+	/// Sums the work done by all threads to the stats member.
+	/// @param[in] threadsCount Number of threads to trace the tiles
+	/// @param[in] rayPackets Indicates whether to trace the camera rays as packets
+	void traceRays(int threadsCount, bool rayPackets) const;
+
+	/// Generates and traces rays for the pixels of a single tile of the image.
+	/// Saves the results to the pixels member array.
+	/// If the pixel costs array is allocated, saves the cost of each pixel to it too.
+	/// @param[in] tileIdx Index of the tile, tiles are ordered left to right and top to bottom
+	/// @param[in] rayPackets Indicates whether to trace the camera rays as packets
+	/// @param[in,out] stats Stats of the tracing thread, to which the work done is added
+	void traceTile(int tileIdx, bool rayPackets, RayStats &stats) const;
+
+	/// Generates and traces a packet of rays for a block of pixels of the image, and shades each ray alone.
+	/// Saves the results to the pixels member array.
+	/// If the pixel costs array is allocated, the cost of tracing the packet is split evenly between its pixels.
+	/// @param[in] blockMin The top left pixel of the block
+	/// @param[in] blockMax The pixel after the bottom right pixel of the block, at most rayPacketDim pixels away
+	/// @param[in,out] stats Stats to which the work done is added
+	void tracePacket(const Vec2i &blockMin, const Vec2i &blockMax, RayStats &stats) const;
 
 	/// Traces a single ray.
 	/// Finds where the ray intersects the scene and what color should that ray be.
 	/// @param[in] ray The ray to be traced
+	/// @param[in,out] stats Stats to which the work done is added
 	/// @return Calculated color for the ray
-	Color traceRay(const Ray &ray) const;
+	Color traceRay(const Ray &ray, RayStats &stats) const;
 
 	/// Shades a point of intersection on a triangle's surface.
 	/// Returns the shaded color.
 	/// @param[in] intersection Intersection of a camera ray with a triangle
+	/// @param[in,out] stats Stats to which the work done is added
 	/// @return Shaded color
-	Color shadeIntersection(const TriangleIntersection &intersection) const;
+	Color shadeIntersection(const TriangleIntersection &intersection, RayStats &stats) const;
+
+	/// Prints the stats of the last render
+	/// @param[in] seconds Time it took to trace the rays, in seconds
+	void printStats(double seconds) const;
 
-	/// Writes the pixels of the ray tracer to a PPM image file
+	/// Writes a heatmap of the pixel costs to an image file.
+	/// The costs are normalized by the largest one and mapped from blue for the cheapest pixels to red for the most expensive ones.
+	/// @param[in] filepath Path to the output image file
+	/// @param[in] format Format of the output image file
+	/// @return True on success
+	bool writeHeatmapToFile(const char *filepath, ImageFormat format) const;
+
+	/// Writes an image with the ray tracer's resolution to an image file
+	/// @param[in] image Array of the colors of all pixels of the image
+	/// @param[in] filepath Path to the output image file
+	/// @param[in] format Format of the output image file
+	/// @return True on success
+	bool writePixelsToFile(const Color *image, const char *filepath, ImageFormat format) const;
+
+	/// Writes an image with the ray tracer's resolution to a plain text PPM (P3) image file
+	/// @param[in] image Array of the colors of all pixels of the image
 	/// @param[in] filepath Path to the output PPM image file
 	/// @return True on success
-	bool writePixelsToFile(const char *filepath) const;
+	bool writePixelsToPpmText(const Color *image, const char *filepath) const;
+
+	/// Writes an image with the ray tracer's resolution to a binary PPM (P6) image file, with a single write
+	/// @param[in] image Array of the colors of all pixels of the image
+	/// @param[in] filepath Path to the output PPM image file
+	/// @return True on success
+	bool writePixelsToPpmBinary(const Color *image, const char *filepath) const;
 
 private: /* variables */
 	/// The scene to be rendered
 	Scene scene;
 
-	/// Array of generated rays
-	mutable Ray *rays = nullptr;
+	/// Direction, in world space and not normalized, of the ray through the center of the top left pixel
+	Vec3f rayDirectionOrigin;
+	/// Change of the ray direction, in world space, when moving one pixel to the right
+	Vec3f rayDirectionStepX;
+	/// Change of the ray direction, in world space, when moving one pixel down
+	Vec3f rayDirectionStepY;
+
 	/// Array of results of traced rays
 	mutable Color *pixels = nullptr;
+	/// Array of the costs of the traced pixels, as the number of triangle tests and node visits.
+	/// Allocated only for the duration of a render with a heatmap.
+	mutable long long *pixelCosts = nullptr;
+	/// Stats of the work done by the last render
+	mutable RayStats stats;
 };
\ No newline at end of file
@@ -1,6 +1,20 @@
 #include "Scene.h"
 
+#include "SceneBinaryFormat.h"
+#include "SceneJsonHandler.h"
 #include "utils/JsonUtils.h"
+#include "utils/ProfileUtils.h"
+
+#include "rapidjson/error/en.h"
+#include "rapidjson/filereadstream.h"
+#include "rapidjson/filewritestream.h"
+#include "rapidjson/writer.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
 
 static void readSceneSettingsFromJson(Scene &scene, const rapidjson::Value &json) {
 	if (!json.IsNull()) {
@@ -31,7 +45,8 @@ static void readSceneSettingsFromJson(Scene &scene, const rapidjson::Value &json
 	}
 }
 
-void Scene::readFromJson(const rapidjson::Value &json) {
+bool Scene::readFromJson(const rapidjson::Value &json) {
+	PROFILE_SCOPE("Scene::readFromJson");
 	const rapidjson::Value &settingsVal = json.FindMember("settings")->value;
 	readSceneSettingsFromJson(*this, settingsVal);
 
@@ -49,6 +64,24 @@ void Scene::readFromJson(const rapidjson::Value &json) {
 			objects[i].readFromJson(objectsVal[i]);
 		}
 	}
+	rapidjson::Value::ConstMemberIterator instancesIt = json.FindMember("instances");
+	if (instancesIt != json.MemberEnd() && !instancesIt->value.IsNull()) {
+		const rapidjson::Value &instancesVal = instancesIt->value;
+		assert(instancesVal.IsArray());
+
+		instancesCount = instancesVal.Size();
+		instances = new MeshInstance[instancesCount];
+
+		for (int i = 0; i < instancesCount; i++) {
+			instances[i].readFromJson(instancesVal[i]);
+			if (instances[i].meshIdx < 0 || instances[i].meshIdx >= objectsCount) {
+				std::cout << "Error: Instance " << i << " refers to mesh " << instances[i].meshIdx << ", the scene has " << objectsCount << " meshes\n";
+				instancesCount = i;
+				return false;
+			}
+		}
+	}
+	buildBvh();
 
 	const rapidjson::Value &lightsVal = json.FindMember("lights")->value;
 	if (!lightsVal.IsNull()) {
@@ -61,4 +94,426 @@ void Scene::readFromJson(const rapidjson::Value &json) {
 			lights[i].readFromJson(lightsVal[i]);
 		}
 	}
+	return true;
+}
+
+bool Scene::readFromJsonFile(const std::string &filepath) {
+	PROFILE_SCOPE("Scene::readFromJsonFile");
+	FILE *file = fopen(filepath.c_str(), "rb");
+	if (!file) {
+		return false;
+	}
+	// Read the file through a fixed size buffer, so that memory use doesn't depend on the file size
+	static const size_t bufferSize = 1 << 16;
+	char *buffer = new char[bufferSize];
+	rapidjson::FileReadStream stream(file, buffer, bufferSize);
+
+	SceneJsonHandler handler(*this);
+	rapidjson::Reader reader;
+	const rapidjson::ParseResult result = reader.Parse(stream, handler);
+	delete[] buffer;
+	fclose(file);
+	if (!result) {
+		std::cout << "Error: " << rapidjson::GetParseError_En(result.Code()) << "\n";
+		std::cout << "Offset: " << result.Offset() << "\n";
+		return false;
+	}
+
+	if (!handler.finish()) {
+		return false;
+	}
+	buildBvh();
+	return true;
+}
+
+bool Scene::readFromBinaryFile(const std::string &filepath) {
+	PROFILE_SCOPE("Scene::readFromBinaryFile");
+	using namespace SceneBinaryFormat;
+	static_assert(sizeof(Vec3f) == 3 * sizeof(float) && sizeof(Vec3i) == 3 * sizeof(int32_t),
+		"Vertices and triangles are expected to be stored as tightly packed 3 numbers");
+
+	if (!binaryFile.map(filepath)) {
+		std::cout << "Error: Cannot map " << filepath << "\n";
+		return false;
+	}
+	const char *data = binaryFile.data;
+	const uint64_t fileSize = binaryFile.size;
+
+	// Checks if an array of some size at some offset is within the file and properly aligned
+	auto isValidArray = [fileSize](uint64_t offset, uint64_t count, uint64_t elementSize) {
+		return offset % alignment == 0 && offset <= fileSize && count <= (fileSize - offset) / elementSize;
+	};
+
+	if (fileSize < sizeof(Header)) {
+		std::cout << "Error: " << filepath << " is too small to be a binary scene file\n";
+		return false;
+	}
+	const Header &header = *reinterpret_cast<const Header *>(data);
+	if (memcmp(header.magic, magic, sizeof(magic)) != 0 || header.headerSize != sizeof(Header)) {
+		std::cout << "Error: " << filepath << " is not a binary scene file\n";
+		return false;
+	}
+	if (header.version != version) {
+		std::cout << "Error: " << filepath << " has version " << header.version << ", expected " << version << "\n";
+		return false;
+	}
+	if (!isValidArray(header.lightsOffset, header.lightsCount, sizeof(LightRecord))
+		|| !isValidArray(header.meshesOffset, header.meshesCount, sizeof(MeshRecord))
+		|| !isValidArray(header.instancesOffset, header.instancesCount, sizeof(InstanceRecord))
+	) {
+		std::cout << "Error: " << filepath << " is corrupted\n";
+		return false;
+	}
+
+	backgroundColor = Color(header.backgroundColor[0], header.backgroundColor[1], header.backgroundColor[2]);
+	imageResolution = Vec2i(header.imageWidth, header.imageHeight);
+	shadowBias = header.shadowBias;
+
+	camera.position = Vec3f(header.cameraPosition[0], header.cameraPosition[1], header.cameraPosition[2]);
+	camera.rotation = Matrix3f(
+		{ header.cameraRotation[0], header.cameraRotation[1], header.cameraRotation[2] },
+		{ header.cameraRotation[3], header.cameraRotation[4], header.cameraRotation[5] },
+		{ header.cameraRotation[6], header.cameraRotation[7], header.cameraRotation[8] }
+	);
+	camera.viewSize = Vec2f(header.cameraViewSize[0], header.cameraViewSize[1]);
+	camera.viewDepth = header.cameraViewDepth;
+
+	lightsCount = int(header.lightsCount);
+	lights = (lightsCount > 0) ? new Light[lightsCount] : nullptr;
+	const LightRecord *lightRecords = reinterpret_cast<const LightRecord *>(data + header.lightsOffset);
+	for (int i = 0; i < lightsCount; i++) {
+		const LightRecord &record = lightRecords[i];
+		lights[i] = Light(
+			Vec3f(record.position[0], record.position[1], record.position[2]),
+			record.intensity,
+			Color(record.albedo[0], record.albedo[1], record.albedo[2])
+		);
+	}
+
+	objectsCount = int(header.meshesCount);
+	objects = (objectsCount > 0) ? new Mesh[objectsCount] : nullptr;
+	const MeshRecord *meshRecords = reinterpret_cast<const MeshRecord *>(data + header.meshesOffset);
+	for (int i = 0; i < objectsCount; i++) {
+		const MeshRecord &record = meshRecords[i];
+		if (!isValidArray(record.verticesOffset, record.verticesCount, sizeof(Vec3f))
+			|| !isValidArray(record.trianglesOffset, record.trianglesCount, sizeof(Vec3i))
+		) {
+			std::cout << "Error: " << filepath << " is corrupted\n";
+			objectsCount = i;
+			return false;
+		}
+		// The vertex indices are used without checks from now on, so check them once here
+		const Vec3i *triangles = reinterpret_cast<const Vec3i *>(data + record.trianglesOffset);
+		const int verticesCount = int(record.verticesCount);
+		for (uint32_t j = 0; j < record.trianglesCount; j++) {
+			const Vec3i &triangle = triangles[j];
+			if (triangle.x < 0 || triangle.x >= verticesCount
+				|| triangle.y < 0 || triangle.y >= verticesCount
+				|| triangle.z < 0 || triangle.z >= verticesCount
+			) {
+				std::cout << "Error: " << filepath << " is corrupted, triangle " << j << " of mesh " << i << " has a vertex index out of range\n";
+				objectsCount = i;
+				return false;
+			}
+		}
+		// Point the mesh directly into the mapping
+		objects[i] = Mesh(
+			reinterpret_cast<Vec3f *>(binaryFile.data + record.verticesOffset),
+			int(record.verticesCount),
+			reinterpret_cast<Vec3i *>(binaryFile.data + record.trianglesOffset),
+			int(record.trianglesCount)
+		);
+	}
+
+	instancesCount = int(header.instancesCount);
+	instances = (instancesCount > 0) ? new MeshInstance[instancesCount] : nullptr;
+	const InstanceRecord *instanceRecords = reinterpret_cast<const InstanceRecord *>(data + header.instancesOffset);
+	for (int i = 0; i < instancesCount; i++) {
+		const InstanceRecord &record = instanceRecords[i];
+		if (record.meshIdx < 0 || record.meshIdx >= objectsCount) {
+			std::cout << "Error: " << filepath << " is corrupted\n";
+			instancesCount = i;
+			return false;
+		}
+		instances[i] = MeshInstance(
+			record.meshIdx,
+			Matrix3f(
+				{ record.matrix[0], record.matrix[1], record.matrix[2] },
+				{ record.matrix[3], record.matrix[4], record.matrix[5] },
+				{ record.matrix[6], record.matrix[7], record.matrix[8] }
+			),
+			Vec3f(record.position[0], record.position[1], record.position[2])
+		);
+	}
+
+	buildBvh();
+	return true;
+}
+
+void Scene::buildBvh() {
+	if (instancesCount == 0 && objectsCount > 0) {
+		instancesCount = objectsCount;
+		instances = new MeshInstance[instancesCount];
+		for (int i = 0; i < instancesCount; i++) {
+			instances[i].meshIdx = i;
+		}
+	}
+	bvh.build(objects, objectsCount, instances, instancesCount, bvhBuildOptions);
+}
+
+void Scene::updateObjects(const int *objIdxs, int objIdxsCount, BvhUpdateStats &stats) {
+	PROFILE_SCOPE("Scene::updateObjects");
+	const auto startTime = std::chrono::steady_clock::now();
+	stats = BvhUpdateStats();
+	for (int i = 0; i < objIdxsCount; i++) {
+		assert(objIdxs[i] >= 0 && objIdxs[i] < objectsCount);
+		objects[objIdxs[i]].precomputeTriangles();
+	}
+	bvh.update(objIdxs, objIdxsCount, bvhBuildOptions, stats);
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+/// Writes zeros to a file until its size reaches the alignment of the binary scene format
+static void writeAlignmentPadding(FILE *file, uint64_t &offset) {
+	static const char zeros[SceneBinaryFormat::alignment] = {};
+	const uint64_t alignedOffset = SceneBinaryFormat::alignOffset(offset);
+	fwrite(zeros, 1, size_t(alignedOffset - offset), file);
+	offset = alignedOffset;
+}
+
+bool Scene::writeToBinaryFile(const std::string &filepath) const {
+	using namespace SceneBinaryFormat;
+
+	FILE *file = fopen(filepath.c_str(), "wb");
+	if (!file) {
+		return false;
+	}
+
+	// Lay out the records and arrays after the header
+	Header header = {};
+	memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	header.headerSize = sizeof(Header);
+	header.backgroundColor[0] = backgroundColor.x;
+	header.backgroundColor[1] = backgroundColor.y;
+	header.backgroundColor[2] = backgroundColor.z;
+	header.imageWidth = imageResolution.x;
+	header.imageHeight = imageResolution.y;
+	header.shadowBias = shadowBias;
+	header.cameraPosition[0] = camera.position.x;
+	header.cameraPosition[1] = camera.position.y;
+	header.cameraPosition[2] = camera.position.z;
+	const Vec3f rotationCols[3] = { camera.rotation.xCol, camera.rotation.yCol, camera.rotation.zCol };
+	for (int col = 0; col < 3; col++) {
+		header.cameraRotation[col * 3 + 0] = rotationCols[col].x;
+		header.cameraRotation[col * 3 + 1] = rotationCols[col].y;
+		header.cameraRotation[col * 3 + 2] = rotationCols[col].z;
+	}
+	header.cameraViewSize[0] = camera.viewSize.x;
+	header.cameraViewSize[1] = camera.viewSize.y;
+	header.cameraViewDepth = camera.viewDepth;
+	header.lightsCount = uint32_t(lightsCount);
+	header.meshesCount = uint32_t(objectsCount);
+	header.instancesCount = uint32_t(instancesCount);
+	header.lightsOffset = alignOffset(sizeof(Header));
+	header.meshesOffset = alignOffset(header.lightsOffset + uint64_t(lightsCount) * sizeof(LightRecord));
+	header.instancesOffset = alignOffset(header.meshesOffset + uint64_t(objectsCount) * sizeof(MeshRecord));
+
+	std::vector<MeshRecord> meshRecords(objectsCount);
+	uint64_t arraysOffset = header.instancesOffset + uint64_t(instancesCount) * sizeof(InstanceRecord);
+	for (int i = 0; i < objectsCount; i++) {
+		meshRecords[i].verticesCount = uint32_t(objects[i].verticesCount);
+		meshRecords[i].trianglesCount = uint32_t(objects[i].trianglesCount);
+		meshRecords[i].verticesOffset = alignOffset(arraysOffset);
+		arraysOffset = meshRecords[i].verticesOffset + uint64_t(objects[i].verticesCount) * sizeof(Vec3f);
+		meshRecords[i].trianglesOffset = alignOffset(arraysOffset);
+		arraysOffset = meshRecords[i].trianglesOffset + uint64_t(objects[i].trianglesCount) * sizeof(Vec3i);
+	}
+
+	// Write everything in the order of the layout, padding to the alignment before each array
+	uint64_t offset = 0;
+	fwrite(&header, sizeof(Header), 1, file);
+	offset += sizeof(Header);
+
+	writeAlignmentPadding(file, offset);
+	for (int i = 0; i < lightsCount; i++) {
+		const Light &light = lights[i];
+		const LightRecord record = {
+			{ light.position.x, light.position.y, light.position.z },
+			light.intensity,
+			{ light.albedo.x, light.albedo.y, light.albedo.z },
+			0.f
+		};
+		fwrite(&record, sizeof(LightRecord), 1, file);
+		offset += sizeof(LightRecord);
+	}
+
+	writeAlignmentPadding(file, offset);
+	fwrite(meshRecords.data(), sizeof(MeshRecord), meshRecords.size(), file);
+	offset += uint64_t(meshRecords.size()) * sizeof(MeshRecord);
+
+	writeAlignmentPadding(file, offset);
+	for (int i = 0; i < instancesCount; i++) {
+		const MeshInstance &instance = instances[i];
+		InstanceRecord record = {};
+		const Vec3f matrixCols[3] = { instance.matrix.xCol, instance.matrix.yCol, instance.matrix.zCol };
+		for (int col = 0; col < 3; col++) {
+			record.matrix[col * 3 + 0] = matrixCols[col].x;
+			record.matrix[col * 3 + 1] = matrixCols[col].y;
+			record.matrix[col * 3 + 2] = matrixCols[col].z;
+		}
+		record.position[0] = instance.position.x;
+		record.position[1] = instance.position.y;
+		record.position[2] = instance.position.z;
+		record.meshIdx = instance.meshIdx;
+		fwrite(&record, sizeof(InstanceRecord), 1, file);
+		offset += sizeof(InstanceRecord);
+	}
+
+	for (int i = 0; i < objectsCount; i++) {
+		writeAlignmentPadding(file, offset);
+		fwrite(objects[i].vertices, sizeof(Vec3f), size_t(objects[i].verticesCount), file);
+		offset += uint64_t(objects[i].verticesCount) * sizeof(Vec3f);
+		writeAlignmentPadding(file, offset);
+		fwrite(objects[i].triangles, sizeof(Vec3i), size_t(objects[i].trianglesCount), file);
+		offset += uint64_t(objects[i].trianglesCount) * sizeof(Vec3i);
+	}
+
+	const bool success = !ferror(file);
+	fclose(file);
+	return success;
+}
+
+/// Writes a float as a JSON number with the fewest digits that still read back as exactly the same float.
+/// Writing it as a double would often need 17 digits.
+template <typename Writer>
+static void writeFloatToJson(Writer &writer, float value) {
+	char str[32];
+	// 9 significant digits are always enough, but hand written values like 0.1 read back exactly with fewer
+	int length = snprintf(str, sizeof(str), "%.6g", value);
+	if (strtof(str, nullptr) != value) {
+		length = snprintf(str, sizeof(str), "%.9g", value);
+	}
+	writer.RawValue(str, size_t(length), rapidjson::kNumberType);
+}
+
+/// Writes a vector as a JSON array of its 3 coordinates
+template <typename Writer>
+static void writeVec3fToJson(Writer &writer, const Vec3f &vec) {
+	writer.StartArray();
+	writeFloatToJson(writer, vec.x);
+	writeFloatToJson(writer, vec.y);
+	writeFloatToJson(writer, vec.z);
+	writer.EndArray();
+}
+
+bool Scene::writeToJsonFile(const std::string &filepath) const {
+	PROFILE_SCOPE("Scene::writeToJsonFile");
+	FILE *file = fopen(filepath.c_str(), "wb");
+	if (!file) {
+		return false;
+	}
+	char buffer[1 << 16];
+	rapidjson::FileWriteStream stream(file, buffer, sizeof(buffer));
+	rapidjson::Writer<rapidjson::FileWriteStream> writer(stream);
+
+	writer.StartObject();
+
+	writer.Key("settings");
+	writer.StartObject();
+	writer.Key("background_color");
+	writeVec3fToJson(writer, backgroundColor);
+	writer.Key("image_settings");
+	writer.StartObject();
+	writer.Key("width");
+	writer.Int(imageResolution.x);
+	writer.Key("height");
+	writer.Int(imageResolution.y);
+	writer.EndObject();
+	writer.Key("shadow_bias");
+	writeFloatToJson(writer, shadowBias);
+	writer.EndObject();
+
+	writer.Key("camera");
+	writer.StartObject();
+	// The matrix is read column by column
+	writer.Key("matrix");
+	writer.StartArray();
+	for (const Vec3f &col : { camera.rotation.xCol, camera.rotation.yCol, camera.rotation.zCol }) {
+		writeFloatToJson(writer, col.x);
+		writeFloatToJson(writer, col.y);
+		writeFloatToJson(writer, col.z);
+	}
+	writer.EndArray();
+	writer.Key("position");
+	writeVec3fToJson(writer, camera.position);
+	writer.EndObject();
+
+	writer.Key("lights");
+	writer.StartArray();
+	for (int i = 0; i < lightsCount; i++) {
+		writer.StartObject();
+		writer.Key("intensity");
+		writeFloatToJson(writer, lights[i].intensity);
+		writer.Key("position");
+		writeVec3fToJson(writer, lights[i].position);
+		writer.Key("albedo");
+		writeVec3fToJson(writer, lights[i].albedo);
+		writer.EndObject();
+	}
+	writer.EndArray();
+
+	writer.Key("objects");
+	writer.StartArray();
+	for (int i = 0; i < objectsCount; i++) {
+		const Mesh &mesh = objects[i];
+		writer.StartObject();
+		writer.Key("vertices");
+		writer.StartArray();
+		for (int vIdx = 0; vIdx < mesh.verticesCount; vIdx++) {
+			writeFloatToJson(writer, mesh.vertices[vIdx].x);
+			writeFloatToJson(writer, mesh.vertices[vIdx].y);
+			writeFloatToJson(writer, mesh.vertices[vIdx].z);
+		}
+		writer.EndArray();
+		writer.Key("triangles");
+		writer.StartArray();
+		for (int trIdx = 0; trIdx < mesh.trianglesCount; trIdx++) {
+			writer.Int(mesh.triangles[trIdx].x);
+			writer.Int(mesh.triangles[trIdx].y);
+			writer.Int(mesh.triangles[trIdx].z);
+		}
+		writer.EndArray();
+		writer.EndObject();
+	}
+	writer.EndArray();
+
+	writer.Key("instances");
+	writer.StartArray();
+	for (int i = 0; i < instancesCount; i++) {
+		const MeshInstance &instance = instances[i];
+		writer.StartObject();
+		writer.Key("mesh");
+		writer.Int(instance.meshIdx);
+		// The matrix is read column by column, like the camera's
+		writer.Key("matrix");
+		writer.StartArray();
+		for (const Vec3f &col : { instance.matrix.xCol, instance.matrix.yCol, instance.matrix.zCol }) {
+			writeFloatToJson(writer, col.x);
+			writeFloatToJson(writer, col.y);
+			writeFloatToJson(writer, col.z);
+		}
+		writer.EndArray();
+		writer.Key("position");
+		writeVec3fToJson(writer, instance.position);
+		writer.EndObject();
+	}
+	writer.EndArray();
+
+	writer.EndObject();
+
+	stream.Flush();
+	const bool success = !ferror(file);
+	fclose(file);
+	return success;
 }
\ No newline at end of file
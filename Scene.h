@@ -4,21 +4,74 @@
 #include "Camera.h"
 #include "Mesh.h"
 #include "Light.h"
+#include "InstanceBvh.h"
+#include "MeshInstance.h"
+#include "utils/FileUtils.h"
 
 #include "rapidjson/document.h"
 
+#include <string>
+
 using namespace MathUtils;
 
 /// Class representing the scene,
 /// holding data about all objects, camera and settings
 struct Scene {
 	/// Reads the scene from a JSON value
-	void readFromJson(const rapidjson::Value &json);
+	/// @param[in] json The scene's JSON object
+	/// @return True on success, false if an instance refers to a mesh that doesn't exist
+	bool readFromJson(const rapidjson::Value &json);
+
+	/// Reads the scene from a JSON file with a streaming (SAX) parser.
+	/// Doesn't build a JSON document in memory,
+	/// the meshes' vertices and triangles are read directly into their arrays.
+	/// @param[in] filepath Path to the JSON file
+	/// @return True on success
+	bool readFromJsonFile(const std::string &filepath);
+
+	/// Reads the scene from a binary scene file (.crtbin).
+	/// The file is mapped to memory and the meshes' vertices and triangles point directly into the mapping,
+	/// so nothing is parsed or copied and the mapping stays alive as long as the scene is used.
+	/// @param[in] filepath Path to the binary scene file
+	/// @return True on success
+	bool readFromBinaryFile(const std::string &filepath);
+
+	/// Writes the scene to a binary scene file (.crtbin)
+	/// @param[in] filepath Path to the binary scene file
+	/// @return True on success
+	bool writeToBinaryFile(const std::string &filepath) const;
+
+	/// Writes the scene to a JSON scene file (.crtscene)
+	/// @param[in] filepath Path to the JSON file
+	/// @return True on success
+	bool writeToJsonFile(const std::string &filepath) const;
+
+	/// Builds the acceleration structure, called after the objects and the instances are read.
+	/// A scene without instances gets one with the identity transform for each object,
+	/// so that scenes with the objects in world space are drawn as they are.
+	void buildBvh();
+
+	/// Updates the scene after the vertices of some objects move, with the same triangles in the objects.
+	/// Recomputes the objects' precomputed triangles and updates the acceleration structure, see InstanceBvh::update,
+	/// so the work done depends on the moved objects and not on the whole scene.
+	/// @param[in] objIdxs Indices of the moved objects
+	/// @param[in] objIdxsCount Number of the indices
+	/// @param[out] stats Work done by the update, with the time of the whole update
+	void updateObjects(const int *objIdxs, int objIdxsCount, BvhUpdateStats &stats);
 
 	/// Array of mesh objects in the scene
 	Mesh *objects = nullptr;
 	int objectsCount = 0;
 
+	/// Array of placed copies of the objects, objects without instances are not drawn
+	MeshInstance *instances = nullptr;
+	int instancesCount = 0;
+
+	/// Acceleration structure over the instances, with a hierarchy for each object
+	InstanceBvh bvh;
+	/// How the hierarchy is built, set before reading the scene
+	BvhBuildOptions bvhBuildOptions;
+
 	/// Array of lights in the scene
 	Light *lights = nullptr;
 	int lightsCount = 0;
@@ -36,4 +89,7 @@ struct Scene {
 	/// so that the shadow ray doesn't accidentally intersect the surface where it comes from,
 	/// due to floaing point precision
 	float shadowBias = 0.00001f;
+
+	/// Binary scene file mapped to memory, if the scene was read from one
+	FileUtils::MappedFile binaryFile;
 };
\ No newline at end of file
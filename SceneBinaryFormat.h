@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+
+/// Layout of the binary scene format (.crtbin).
+/// The file starts with a header, followed by an array of light records, an array of mesh records
+/// and an array of instance records. After them come the vertices and triangles of each mesh, stored exactly as the Vec3f and Vec3i arrays of a Mesh,
+/// so that a loader can point the meshes directly into a memory mapping of the file.
+/// All offsets are in bytes from the start of the file, and all arrays start at a multiple of the alignment.
+/// Numbers are stored in the byte order of the machine that wrote the file, which is expected to be little-endian.
+namespace SceneBinaryFormat {
+
+/// Magic bytes at the start of every file
+static const char magic[8] = { 'C', 'R', 'T', 'B', 'I', 'N', '\0', '\0' };
+/// Version of the format, incremented on every change of the layout
+static const uint32_t version = 2;
+/// Alignment of the arrays in the file, in bytes
+static const uint64_t alignment = 64;
+
+/// Header at the start of the file, holding the scene settings and the camera
+struct Header {
+	char magic[8];
+	uint32_t version;
+	/// Size of the header, for validation
+	uint32_t headerSize;
+
+	float backgroundColor[3];
+	int32_t imageWidth;
+	int32_t imageHeight;
+	float shadowBias;
+
+	float cameraPosition[3];
+	/// Camera rotation matrix, stored column by column
+	float cameraRotation[9];
+	float cameraViewSize[2];
+	float cameraViewDepth;
+
+	uint32_t lightsCount;
+	uint32_t meshesCount;
+	uint32_t instancesCount;
+	/// Offset of the array of light records
+	uint64_t lightsOffset;
+	/// Offset of the array of mesh records
+	uint64_t meshesOffset;
+	/// Offset of the array of instance records
+	uint64_t instancesOffset;
+};
+
+/// Record of a single light
+struct LightRecord {
+	float position[3];
+	float intensity;
+	float albedo[3];
+	float reserved;
+};
+
+/// Record of a single mesh
+struct MeshRecord {
+	/// Offset of the mesh's array of vertices
+	uint64_t verticesOffset;
+	/// Offset of the mesh's array of triangles
+	uint64_t trianglesOffset;
+	uint32_t verticesCount;
+	uint32_t trianglesCount;
+};
+
+/// Record of a single instance of a mesh
+struct InstanceRecord {
+	/// Linear part of the transform, stored column by column
+	float matrix[9];
+	float position[3];
+	/// Index of the instanced mesh in the array of mesh records
+	int32_t meshIdx;
+	uint32_t reserved;
+};
+
+static_assert(sizeof(Header) == 136, "Unexpected size of the binary scene header");
+static_assert(sizeof(LightRecord) == 32, "Unexpected size of the binary scene light record");
+static_assert(sizeof(MeshRecord) == 24, "Unexpected size of the binary scene mesh record");
+static_assert(sizeof(InstanceRecord) == 56, "Unexpected size of the binary scene instance record");
+
+/// Rounds an offset up to the alignment of the arrays
+inline uint64_t alignOffset(uint64_t offset) {
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+} // namespace SceneBinaryFormat
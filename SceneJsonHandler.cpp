@@ -0,0 +1,355 @@
+#include "SceneJsonHandler.h"
+
+#include <algorithm>
+#include <climits>
+#include <iostream>
+
+/// Appends a value to an array allocated with new[], growing the array when it's full
+/// @param[in] arr The array, reallocated when it grows
+/// @param[in] count Number of values in the array
+/// @param[in] capacity Number of values the array has space for
+/// @param[in] value Value to be appended
+template <typename T>
+static void appendToArray(T* &arr, int &count, int &capacity, const T &value) {
+	if (count == capacity) {
+		capacity = getMax(64, capacity * 2);
+		T *newArr = new T[capacity];
+		std::copy(arr, arr + count, newArr);
+		delete[] arr;
+		arr = newArr;
+	}
+	arr[count++] = value;
+}
+
+/// Shrinks an array allocated with new[] to the number of values in it
+template <typename T>
+static void shrinkArray(T* &arr, int count, int &capacity) {
+	if (count == capacity) {
+		return;
+	}
+	T *newArr = (count > 0) ? new T[count] : nullptr;
+	std::copy(arr, arr + count, newArr);
+	delete[] arr;
+	arr = newArr;
+	capacity = count;
+}
+
+SceneJsonHandler::SceneJsonHandler(Scene &scene)
+	: scene(scene)
+{}
+
+bool SceneJsonHandler::finish() {
+	delete[] scene.objects;
+	scene.objectsCount = int(meshes.size());
+	scene.objects = (scene.objectsCount > 0) ? new Mesh[scene.objectsCount] : nullptr;
+	std::copy(meshes.begin(), meshes.end(), scene.objects);
+	meshes.clear();
+
+	for (int i = 0; i < int(instances.size()); i++) {
+		if (instances[i].meshIdx < 0 || instances[i].meshIdx >= scene.objectsCount) {
+			std::cout << "Error: Instance " << i << " refers to mesh " << instances[i].meshIdx << ", the scene has " << scene.objectsCount << " meshes\n";
+			return false;
+		}
+	}
+	delete[] scene.instances;
+	scene.instancesCount = int(instances.size());
+	scene.instances = (scene.instancesCount > 0) ? new MeshInstance[scene.instancesCount] : nullptr;
+	std::copy(instances.begin(), instances.end(), scene.instances);
+	instances.clear();
+
+	delete[] scene.lights;
+	scene.lightsCount = int(lights.size());
+	scene.lights = (scene.lightsCount > 0) ? new Light[scene.lightsCount] : nullptr;
+	std::copy(lights.begin(), lights.end(), scene.lights);
+	lights.clear();
+	return true;
+}
+
+std::string SceneJsonHandler::getValuePath() const {
+	if (containers.empty()) {
+		return "";
+	}
+	const Container &parent = containers.back();
+	return parent.path + "/" + (parent.isArray ? "[]" : key);
+}
+
+SceneJsonHandler::Target SceneJsonHandler::getTarget(const std::string &path) {
+	static const std::pair<const char *, Target> targets[] = {
+		{ "/settings/background_color", Target::BackgroundColor },
+		{ "/settings/image_settings/width", Target::ImageWidth },
+		{ "/settings/image_settings/height", Target::ImageHeight },
+		{ "/settings/shadow_bias", Target::ShadowBias },
+		{ "/camera/matrix", Target::CameraMatrix },
+		{ "/camera/position", Target::CameraPosition },
+		{ "/lights/[]", Target::Light },
+		{ "/lights/[]/position", Target::LightPosition },
+		{ "/lights/[]/intensity", Target::LightIntensity },
+		{ "/lights/[]/albedo", Target::LightAlbedo },
+		{ "/objects/[]", Target::Mesh },
+		{ "/objects/[]/vertices", Target::MeshVertices },
+		{ "/objects/[]/triangles", Target::MeshTriangles },
+		{ "/instances/[]", Target::Instance },
+		{ "/instances/[]/mesh", Target::InstanceMesh },
+		{ "/instances/[]/matrix", Target::InstanceMatrix },
+		{ "/instances/[]/position", Target::InstancePosition }
+	};
+	for (const std::pair<const char *, Target> &target : targets) {
+		if (path == target.first) {
+			return target.second;
+		}
+	}
+	return Target::None;
+}
+
+int SceneJsonHandler::getNumbersCount(Target target) {
+	switch (target) {
+	case Target::BackgroundColor:
+	case Target::CameraPosition:
+	case Target::LightPosition:
+	case Target::LightAlbedo:
+	case Target::InstancePosition:
+		return 3;
+	case Target::CameraMatrix:
+	case Target::InstanceMatrix:
+		return 9;
+	default:
+		return 0;
+	}
+}
+
+bool SceneJsonHandler::Null() {
+	return true;
+}
+
+bool SceneJsonHandler::Bool(bool /*value*/) {
+	return true;
+}
+
+bool SceneJsonHandler::Int(int value) {
+	return number(double(value), true);
+}
+
+bool SceneJsonHandler::Uint(unsigned value) {
+	return number(double(value), true);
+}
+
+bool SceneJsonHandler::Int64(int64_t value) {
+	return number(double(value), true);
+}
+
+bool SceneJsonHandler::Uint64(uint64_t value) {
+	return number(double(value), true);
+}
+
+bool SceneJsonHandler::Double(double value) {
+	return number(value, false);
+}
+
+bool SceneJsonHandler::String(const char * /*str*/, rapidjson::SizeType /*length*/, bool /*copy*/) {
+	return true;
+}
+
+bool SceneJsonHandler::Key(const char *str, rapidjson::SizeType length, bool /*copy*/) {
+	key.assign(str, length);
+	keyTarget = getTarget(getValuePath());
+	return true;
+}
+
+bool SceneJsonHandler::StartObject() {
+	Container container;
+	container.path = getValuePath();
+	container.target = getTarget(container.path);
+	container.isArray = false;
+	containers.push_back(container);
+
+	if (container.target == Target::Light) {
+		lights.emplace_back();
+	} else if (container.target == Target::Instance) {
+		instances.emplace_back();
+	} else if (container.target == Target::Mesh) {
+		mesh = Mesh();
+		verticesCapacity = 0;
+		trianglesCapacity = 0;
+	}
+	return true;
+}
+
+bool SceneJsonHandler::EndObject(rapidjson::SizeType /*membersCount*/) {
+	if (containers.back().target == Target::Mesh) {
+		if (!finishMesh()) {
+			return false;
+		}
+	} else if (containers.back().target == Target::Instance) {
+		instances.back().precomputeTransform();
+	}
+	containers.pop_back();
+	return true;
+}
+
+bool SceneJsonHandler::StartArray() {
+	Container container;
+	container.path = getValuePath();
+	container.target = getTarget(container.path);
+	container.isArray = true;
+	containers.push_back(container);
+
+	numbersCount = 0;
+	pendingCount = 0;
+	return true;
+}
+
+bool SceneJsonHandler::EndArray(rapidjson::SizeType /*elementsCount*/) {
+	const Container container = std::move(containers.back());
+	const Target target = container.target;
+	containers.pop_back();
+
+	// Fixed size arrays have to be complete, otherwise the rest of the numbers would be left from the previous array
+	const int expectedCount = getNumbersCount(target);
+	if (expectedCount > 0 && numbersCount != expectedCount) {
+		std::cout << "Error: Expected " << expectedCount << " numbers in " << container.path << ", found " << numbersCount << "\n";
+		return false;
+	}
+
+	switch (target) {
+	case Target::BackgroundColor:
+		scene.backgroundColor = Color(numbers[0], numbers[1], numbers[2]);
+		break;
+	case Target::CameraMatrix:
+		scene.camera.rotation = Matrix3f(
+			{ numbers[0], numbers[1], numbers[2] },
+			{ numbers[3], numbers[4], numbers[5] },
+			{ numbers[6], numbers[7], numbers[8] }
+		);
+		break;
+	case Target::CameraPosition:
+		scene.camera.position = Vec3f(numbers[0], numbers[1], numbers[2]);
+		break;
+	case Target::LightPosition:
+		lights.back().position = Vec3f(numbers[0], numbers[1], numbers[2]);
+		break;
+	case Target::LightAlbedo:
+		lights.back().albedo = Color(numbers[0], numbers[1], numbers[2]);
+		break;
+	case Target::InstanceMatrix:
+		instances.back().matrix = Matrix3f(
+			{ numbers[0], numbers[1], numbers[2] },
+			{ numbers[3], numbers[4], numbers[5] },
+			{ numbers[6], numbers[7], numbers[8] }
+		);
+		break;
+	case Target::InstancePosition:
+		instances.back().position = Vec3f(numbers[0], numbers[1], numbers[2]);
+		break;
+	case Target::MeshVertices:
+	case Target::MeshTriangles:
+		// The number of values in the array has to be a multiple of 3
+		if (pendingCount != 0) {
+			std::cout << "Error: The number of values in " << container.path << " is not a multiple of 3\n";
+			return false;
+		}
+		break;
+	default:
+		break;
+	}
+	return true;
+}
+
+bool SceneJsonHandler::number(double value, bool isInt) {
+	const bool isInArray = !containers.empty() && containers.back().isArray;
+	const Target target = isInArray ? containers.back().target : keyTarget;
+
+	// Numbers of fixed size arrays, but also ones outside of an array where an array is expected
+	const int maxNumbersCount = getNumbersCount(target);
+	if (maxNumbersCount > 0 && (!isInArray || numbersCount == maxNumbersCount)) {
+		std::cout << "Error: Expected an array of " << maxNumbersCount << " numbers in " << (isInArray ? containers.back().path : getValuePath()) << "\n";
+		return false;
+	}
+
+	switch (target) {
+	case Target::MeshVertices:
+		pendingCoords[pendingCount++] = float(value);
+		if (pendingCount == 3) {
+			appendToArray(mesh.vertices, mesh.verticesCount, verticesCapacity, Vec3f(pendingCoords[0], pendingCoords[1], pendingCoords[2]));
+			pendingCount = 0;
+		}
+		break;
+	case Target::MeshTriangles:
+		if (!isInt) {
+			std::cout << "Error: Expected integer vertex indices in " << containers.back().path << "\n";
+			return false;
+		}
+		// Only the lower bound of the vertex indices is checked here, the vertices may come after the triangles
+		if (value < 0. || value > double(INT_MAX)) {
+			std::cout << "Error: Vertex index " << value << " in " << containers.back().path << " is out of range\n";
+			return false;
+		}
+		pendingIndices[pendingCount++] = int(value);
+		if (pendingCount == 3) {
+			appendToArray(mesh.triangles, mesh.trianglesCount, trianglesCapacity, Vec3i(pendingIndices[0], pendingIndices[1], pendingIndices[2]));
+			pendingCount = 0;
+		}
+		break;
+	case Target::BackgroundColor:
+	case Target::CameraMatrix:
+	case Target::CameraPosition:
+	case Target::LightPosition:
+	case Target::LightAlbedo:
+	case Target::InstanceMatrix:
+	case Target::InstancePosition:
+		numbers[numbersCount++] = float(value);
+		break;
+	case Target::ImageWidth:
+		if (!isInt) {
+			std::cout << "Error: Expected an integer image width\n";
+			return false;
+		}
+		scene.imageResolution.x = int(value);
+		break;
+	case Target::ImageHeight:
+		if (!isInt) {
+			std::cout << "Error: Expected an integer image height\n";
+			return false;
+		}
+		scene.imageResolution.y = int(value);
+		break;
+	case Target::ShadowBias:
+		scene.shadowBias = float(value);
+		break;
+	case Target::LightIntensity:
+		lights.back().intensity = float(value);
+		break;
+	case Target::InstanceMesh:
+		if (!isInt) {
+			std::cout << "Error: Expected an integer mesh index in " << getValuePath() << "\n";
+			return false;
+		}
+		// Indices past the last mesh are reported by finish, after all meshes are read
+		if (value < 0. || value > double(INT_MAX)) {
+			std::cout << "Error: Mesh index " << value << " in " << getValuePath() << " is out of range\n";
+			return false;
+		}
+		instances.back().meshIdx = int(value);
+		break;
+	default:
+		break;
+	}
+	return true;
+}
+
+bool SceneJsonHandler::finishMesh() {
+	// The vertex indices are used without checks from now on, so check them once here
+	for (int i = 0; i < mesh.trianglesCount; i++) {
+		const Vec3i &triangle = mesh.triangles[i];
+		if (triangle.x >= mesh.verticesCount || triangle.y >= mesh.verticesCount || triangle.z >= mesh.verticesCount) {
+			std::cout << "Error: Triangle " << i << " of mesh " << meshes.size() << " has a vertex index out of range\n";
+			return false;
+		}
+	}
+	// Free the unused capacity, the arrays are final from now on
+	shrinkArray(mesh.vertices, mesh.verticesCount, verticesCapacity);
+	shrinkArray(mesh.triangles, mesh.trianglesCount, trianglesCapacity);
+	mesh.precomputeTriangles();
+	meshes.push_back(mesh);
+	mesh = Mesh();
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "Scene.h"
+
+#include "rapidjson/reader.h"
+
+#include <string>
+#include <vector>
+
+/// Handler for rapidjson's SAX reader, that reads a scene from a crtscene JSON file as it is being parsed,
+/// without building a JSON document in memory.
+/// Vertices and triangles of the meshes are streamed directly into the meshes' arrays.
+/// Everything missing from the file keeps the same defaults as when reading the scene from a JSON document.
+struct SceneJsonHandler : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, SceneJsonHandler> {
+	/// Creates a handler that reads into a given scene
+	/// @param[in] scene Scene to read into, it is expected to be empty
+	SceneJsonHandler(Scene &scene);
+
+	/// Moves the meshes, instances and lights read so far into the scene.
+	/// Should be called after the whole file is parsed.
+	/// @return True on success, false if an instance refers to a mesh that doesn't exist
+	bool finish();
+
+	/// Functions called by the SAX reader
+	bool Null();
+	bool Bool(bool value);
+	bool Int(int value);
+	bool Uint(unsigned value);
+	bool Int64(int64_t value);
+	bool Uint64(uint64_t value);
+	bool Double(double value);
+	bool String(const char *str, rapidjson::SizeType length, bool copy);
+	bool Key(const char *str, rapidjson::SizeType length, bool copy);
+	bool StartObject();
+	bool EndObject(rapidjson::SizeType membersCount);
+	bool StartArray();
+	bool EndArray(rapidjson::SizeType elementsCount);
+
+private: /* types */
+	/// Parts of the scene into which a JSON value can be read
+	enum class Target {
+		None,
+		BackgroundColor,
+		ImageWidth,
+		ImageHeight,
+		ShadowBias,
+		CameraMatrix,
+		CameraPosition,
+		Light,
+		LightPosition,
+		LightIntensity,
+		LightAlbedo,
+		Mesh,
+		MeshVertices,
+		MeshTriangles,
+		Instance,
+		InstanceMesh,
+		InstanceMatrix,
+		InstancePosition
+	};
+
+	/// JSON object or array that is currently being parsed
+	struct Container {
+		/// Path of the container from the root, made of the keys of the objects,
+		/// with "[]" for the elements of arrays, for example "/objects/[]/vertices"
+		std::string path;
+		/// Part of the scene into which the container is read
+		Target target = Target::None;
+		/// Indicates whether the container is an array or an object
+		bool isArray = false;
+	};
+
+private: /* functions */
+	/// Returns the path of a value that starts at the current position in the file
+	std::string getValuePath() const;
+
+	/// Returns the part of the scene into which the value at some path is read
+	static Target getTarget(const std::string &path);
+
+	/// Returns the number of numbers in a fixed size array (color, position or matrix) read into some part of the scene,
+	/// or 0 if the part is not read from a fixed size array
+	static int getNumbersCount(Target target);
+
+	/// Handles a number value from the file
+	/// @param[in] value The number
+	/// @param[in] isInt Indicates whether the number is an integer
+	/// @return False if the number doesn't fit where it is in the file, which stops the parsing
+	bool number(double value, bool isInt);
+
+	/// Checks the vertex indices of the mesh being read and moves it into the array of meshes
+	/// @return False if a triangle refers to a vertex that doesn't exist, which stops the parsing
+	bool finishMesh();
+
+private: /* variables */
+	/// The scene being read
+	Scene &scene;
+
+	/// Stack of the containers that are currently being parsed, the innermost one is last
+	std::vector<Container> containers;
+	/// The last key read in the innermost object
+	std::string key;
+	/// Part of the scene into which the value after the last key is read
+	Target keyTarget = Target::None;
+
+	/// Numbers of a small fixed size array (color, position or matrix) read so far
+	float numbers[9];
+	int numbersCount = 0;
+
+	/// Meshes, instances and lights read so far
+	std::vector<Mesh> meshes;
+	std::vector<MeshInstance> instances;
+	std::vector<Light> lights;
+
+	/// Mesh being read, with the capacities of its arrays
+	Mesh mesh;
+	int verticesCapacity = 0;
+	int trianglesCapacity = 0;
+	/// Coordinates of a vertex or indices of a triangle read so far, before all 3 of them are read
+	float pendingCoords[3];
+	int pendingIndices[3];
+	int pendingCount = 0;
+};
\ No newline at end of file
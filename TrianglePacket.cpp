@@ -0,0 +1,75 @@
+#include "TrianglePacket.h"
+#include "TrianglePacketKernels.h"
+
+using CpuUtils::IsaLevel;
+
+void TrianglePacket::setLane(int lane, const PrecomputedTriangle &triangle) {
+	normalX[lane] = triangle.normal.x;
+	normalY[lane] = triangle.normal.y;
+	normalZ[lane] = triangle.normal.z;
+	planeDist[lane] = triangle.planeDist;
+	for (int edge = 0; edge < 3; edge++) {
+		edgeNormalX[edge][lane] = triangle.edgeNormals[edge].x;
+		edgeNormalY[edge][lane] = triangle.edgeNormals[edge].y;
+		edgeNormalZ[edge][lane] = triangle.edgeNormals[edge].z;
+		edgeDist[edge][lane] = triangle.edgeDists[edge];
+	}
+}
+
+#ifdef CPU_X86
+
+CPU_TARGET_SSE42 static int intersectClosestSse42(const Ray &ray, const TrianglePacket &packet, float maxDist, float &dist) {
+	return TrianglePacketKernels::intersectClosest<IsaLevel::Sse42>(ray, packet, maxDist, dist);
+}
+
+CPU_TARGET_AVX2 static int intersectClosestAvx2(const Ray &ray, const TrianglePacket &packet, float maxDist, float &dist) {
+	return TrianglePacketKernels::intersectClosest<IsaLevel::Avx2>(ray, packet, maxDist, dist);
+}
+
+CPU_TARGET_AVX512 static int intersectClosestAvx512(const Ray &ray, const TrianglePacket &packet, float maxDist, float &dist) {
+	return TrianglePacketKernels::intersectClosest<IsaLevel::Avx512>(ray, packet, maxDist, dist);
+}
+
+CPU_TARGET_SSE42 static bool intersectAnySse42(const Ray &ray, const TrianglePacket &packet, float maxDist) {
+	return TrianglePacketKernels::intersectAny<IsaLevel::Sse42>(ray, packet, maxDist);
+}
+
+CPU_TARGET_AVX2 static bool intersectAnyAvx2(const Ray &ray, const TrianglePacket &packet, float maxDist) {
+	return TrianglePacketKernels::intersectAny<IsaLevel::Avx2>(ray, packet, maxDist);
+}
+
+CPU_TARGET_AVX512 static bool intersectAnyAvx512(const Ray &ray, const TrianglePacket &packet, float maxDist) {
+	return TrianglePacketKernels::intersectAny<IsaLevel::Avx512>(ray, packet, maxDist);
+}
+
+#endif
+
+int intersectClosest(const Ray &ray, const TrianglePacket &packet, float maxDist, float &dist) {
+	switch (CpuUtils::getIsaLevel()) {
+#ifdef CPU_X86
+	case IsaLevel::Avx512:
+		return intersectClosestAvx512(ray, packet, maxDist, dist);
+	case IsaLevel::Avx2:
+		return intersectClosestAvx2(ray, packet, maxDist, dist);
+	case IsaLevel::Sse42:
+		return intersectClosestSse42(ray, packet, maxDist, dist);
+#endif
+	default:
+		return TrianglePacketKernels::intersectClosest<IsaLevel::Scalar>(ray, packet, maxDist, dist);
+	}
+}
+
+bool intersectAny(const Ray &ray, const TrianglePacket &packet, float maxDist) {
+	switch (CpuUtils::getIsaLevel()) {
+#ifdef CPU_X86
+	case IsaLevel::Avx512:
+		return intersectAnyAvx512(ray, packet, maxDist);
+	case IsaLevel::Avx2:
+		return intersectAnyAvx2(ray, packet, maxDist);
+	case IsaLevel::Sse42:
+		return intersectAnySse42(ray, packet, maxDist);
+#endif
+	default:
+		return TrianglePacketKernels::intersectAny<IsaLevel::Scalar>(ray, packet, maxDist);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "utils/MathUtils.h"
+
+using namespace MathUtils;
+
+/// Number of triangles in a packet.
+/// 8 fills an AVX register, and SSE processes the packet in 2 halves of 4.
+static const int trianglePacketWidth = 8;
+
+/// Precomputed data of up to trianglePacketWidth triangles in structure-of-arrays layout,
+/// so that a ray can be tested against all of them at once with SIMD instructions.
+/// Each array holds one value per triangle, lane i of every array belongs to the i-th triangle.
+/// Unused lanes have a zero normal, which no ray ever intersects.
+/// Arrays of packets are aligned by hand, as C++14 new[] doesn't honor the alignment.
+/// The kernels still load the values unaligned, so a packet anywhere else works too.
+/// See PrecomputedTriangle for the meaning of the values.
+struct alignas(32) TrianglePacket {
+	/// Sets the values of a lane from a precomputed triangle
+	/// @param[in] lane Index of the lane
+	/// @param[in] triangle The precomputed triangle
+	void setLane(int lane, const PrecomputedTriangle &triangle);
+
+	/// Returns the normal of the triangle in a lane
+	Vec3f getNormal(int lane) const { return { normalX[lane], normalY[lane], normalZ[lane] }; }
+
+	/// Unit normals of the triangles
+	float normalX[trianglePacketWidth] = {};
+	float normalY[trianglePacketWidth] = {};
+	float normalZ[trianglePacketWidth] = {};
+	/// Distances from the origin to the triangles' planes
+	float planeDist[trianglePacketWidth] = {};
+	/// Normals of the planes through the triangles' edges AB, BC and CA
+	float edgeNormalX[3][trianglePacketWidth] = {};
+	float edgeNormalY[3][trianglePacketWidth] = {};
+	float edgeNormalZ[3][trianglePacketWidth] = {};
+	/// Distances from the origin to the planes through the triangles' edges
+	float edgeDist[3][trianglePacketWidth] = {};
+};
+
+/// Finds the closest intersection of a ray with the front side of a triangle in a packet.
+/// Gives the same results as testing the triangles one by one with rayTriangleIntersection.
+/// Uses the kernel of the instruction set level picked by CpuUtils.
+/// @param[in] ray The ray to be intersected
+/// @param[in] packet The packet of triangles
+/// @param[in] maxDist Intersections at this distance along the ray or further are ignored
+/// @param[out] dist Distance along the ray to the closest intersection, if there is one
+/// @return Index of the lane of the closest intersected triangle, or -1 if there is none.
+/// If several triangles are intersected at the same distance, the first one wins.
+int intersectClosest(const Ray &ray, const TrianglePacket &packet, float maxDist, float &dist);
+
+/// Checks if a ray intersects any triangle in a packet, from either side, closer than some distance.
+/// Uses the kernel of the instruction set level picked by CpuUtils.
+/// @param[in] ray The ray to be intersected
+/// @param[in] packet The packet of triangles
+/// @param[in] maxDist Intersections at this distance along the ray or further are ignored
+/// @return True if the ray intersects some triangle before maxDist
+bool intersectAny(const Ray &ray, const TrianglePacket &packet, float maxDist);
\ No newline at end of file
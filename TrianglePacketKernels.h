@@ -0,0 +1,247 @@
+#pragma once
+
+#include "TrianglePacket.h"
+#include "utils/CpuUtils.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+/// The ray/packet intersection compiled for each instruction set level.
+/// Included by the code which dispatches on the level, so that the kernels inline into its per-level functions.
+/// All levels do the same operations in the same order as rayTriangleIntersection, so that the results are identical.
+namespace TrianglePacketKernels {
+
+using CpuUtils::IsaLevel;
+using CpuUtils::IsaTag;
+
+/// Threshold under which the projection of a ray on a triangle's normal counts as zero, the same as isApproxZero's
+static const float rayProjEpsilon = 0.0001f;
+
+// Each intersectLanes overload tests a ray against all lanes of a packet.
+// dists is filled with the distances along the ray to the triangles' planes.
+// Returns a bit mask of the lanes which the ray intersects closer than maxDist, only from the front side if frontOnly is set.
+
+/// One lane at a time
+inline int intersectLanes(IsaTag<IsaLevel::Scalar>, const Ray &ray, const TrianglePacket &packet, float maxDist, bool frontOnly, float *dists) {
+	int hitMask = 0;
+	for (int lane = 0; lane < trianglePacketWidth; lane++) {
+		const Vec3f normal = packet.getNormal(lane);
+		const float rayProj = dotProduct(ray.direction, normal);
+		if (isApproxZero(rayProj, rayProjEpsilon) || (frontOnly && rayProj >= 0.f)) {
+			continue;
+		}
+		const float distToPlane = packet.planeDist[lane] - dotProduct(ray.origin, normal);
+		if (rayProj * distToPlane < 0.f) {
+			continue;
+		}
+		const float dist = distToPlane / rayProj;
+		if (!(dist < maxDist)) {
+			continue;
+		}
+		const Vec3f point = ray.origin + ray.direction * dist;
+		bool inside = true;
+		for (int edge = 0; edge < 3; edge++) {
+			const Vec3f edgeNormal = { packet.edgeNormalX[edge][lane], packet.edgeNormalY[edge][lane], packet.edgeNormalZ[edge][lane] };
+			inside = inside && dotProduct(point, edgeNormal) >= packet.edgeDist[edge][lane];
+		}
+		if (inside) {
+			dists[lane] = dist;
+			hitMask |= 1 << lane;
+		}
+	}
+	return hitMask;
+}
+
+#ifdef CPU_X86
+
+/// The packet in halves of 4 lanes
+CPU_TARGET_SSE42 inline int intersectLanes(IsaTag<IsaLevel::Sse42>, const Ray &ray, const TrianglePacket &packet, float maxDist, bool frontOnly, float *dists) {
+	const __m128 originX = _mm_set1_ps(ray.origin.x);
+	const __m128 originY = _mm_set1_ps(ray.origin.y);
+	const __m128 originZ = _mm_set1_ps(ray.origin.z);
+	const __m128 dirX = _mm_set1_ps(ray.direction.x);
+	const __m128 dirY = _mm_set1_ps(ray.direction.y);
+	const __m128 dirZ = _mm_set1_ps(ray.direction.z);
+	const __m128 zero = _mm_setzero_ps();
+
+	int hitMask = 0;
+	for (int first = 0; first < trianglePacketWidth; first += 4) {
+		const __m128 normalX = _mm_loadu_ps(packet.normalX + first);
+		const __m128 normalY = _mm_loadu_ps(packet.normalY + first);
+		const __m128 normalZ = _mm_loadu_ps(packet.normalZ + first);
+		const __m128 rayProj = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dirX, normalX), _mm_mul_ps(dirY, normalY)), _mm_mul_ps(dirZ, normalZ));
+		const __m128 originProj = _mm_add_ps(_mm_add_ps(_mm_mul_ps(originX, normalX), _mm_mul_ps(originY, normalY)), _mm_mul_ps(originZ, normalZ));
+		const __m128 distToPlane = _mm_sub_ps(_mm_loadu_ps(packet.planeDist + first), originProj);
+		const __m128 dist = _mm_div_ps(distToPlane, rayProj);
+
+		// Not almost perpendicular to the normal, and the plane is not behind the ray
+		const __m128 absRayProj = _mm_andnot_ps(_mm_set1_ps(-0.f), rayProj);
+		__m128 mask = _mm_cmpnlt_ps(absRayProj, _mm_set1_ps(rayProjEpsilon));
+		mask = _mm_and_ps(mask, _mm_cmpnlt_ps(_mm_mul_ps(rayProj, distToPlane), zero));
+		mask = _mm_and_ps(mask, _mm_cmplt_ps(dist, _mm_set1_ps(maxDist)));
+		if (frontOnly) {
+			mask = _mm_and_ps(mask, _mm_cmplt_ps(rayProj, zero));
+		}
+		if (_mm_movemask_ps(mask) == 0) {
+			continue;
+		}
+
+		// The point of intersection has to be on the inner side of all 3 edges
+		const __m128 pointX = _mm_add_ps(originX, _mm_mul_ps(dirX, dist));
+		const __m128 pointY = _mm_add_ps(originY, _mm_mul_ps(dirY, dist));
+		const __m128 pointZ = _mm_add_ps(originZ, _mm_mul_ps(dirZ, dist));
+		for (int edge = 0; edge < 3; edge++) {
+			const __m128 edgeProj = _mm_add_ps(
+				_mm_add_ps(
+					_mm_mul_ps(pointX, _mm_loadu_ps(packet.edgeNormalX[edge] + first)),
+					_mm_mul_ps(pointY, _mm_loadu_ps(packet.edgeNormalY[edge] + first))
+				),
+				_mm_mul_ps(pointZ, _mm_loadu_ps(packet.edgeNormalZ[edge] + first))
+			);
+			mask = _mm_and_ps(mask, _mm_cmpge_ps(edgeProj, _mm_loadu_ps(packet.edgeDist[edge] + first)));
+		}
+
+		_mm_storeu_ps(dists + first, dist);
+		hitMask |= _mm_movemask_ps(mask) << first;
+	}
+	return hitMask;
+}
+
+/// All 8 lanes at once
+CPU_TARGET_AVX2 inline int intersectLanes(IsaTag<IsaLevel::Avx2>, const Ray &ray, const TrianglePacket &packet, float maxDist, bool frontOnly, float *dists) {
+	const __m256 originX = _mm256_set1_ps(ray.origin.x);
+	const __m256 originY = _mm256_set1_ps(ray.origin.y);
+	const __m256 originZ = _mm256_set1_ps(ray.origin.z);
+	const __m256 dirX = _mm256_set1_ps(ray.direction.x);
+	const __m256 dirY = _mm256_set1_ps(ray.direction.y);
+	const __m256 dirZ = _mm256_set1_ps(ray.direction.z);
+	const __m256 zero = _mm256_setzero_ps();
+
+	const __m256 normalX = _mm256_loadu_ps(packet.normalX);
+	const __m256 normalY = _mm256_loadu_ps(packet.normalY);
+	const __m256 normalZ = _mm256_loadu_ps(packet.normalZ);
+	const __m256 rayProj = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dirX, normalX), _mm256_mul_ps(dirY, normalY)), _mm256_mul_ps(dirZ, normalZ));
+	const __m256 originProj = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(originX, normalX), _mm256_mul_ps(originY, normalY)), _mm256_mul_ps(originZ, normalZ));
+	const __m256 distToPlane = _mm256_sub_ps(_mm256_loadu_ps(packet.planeDist), originProj);
+	const __m256 dist = _mm256_div_ps(distToPlane, rayProj);
+
+	// Not almost perpendicular to the normal, and the plane is not behind the ray
+	const __m256 absRayProj = _mm256_andnot_ps(_mm256_set1_ps(-0.f), rayProj);
+	__m256 mask = _mm256_cmp_ps(absRayProj, _mm256_set1_ps(rayProjEpsilon), _CMP_NLT_UQ);
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_mul_ps(rayProj, distToPlane), zero, _CMP_NLT_UQ));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(dist, _mm256_set1_ps(maxDist), _CMP_LT_OQ));
+	if (frontOnly) {
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(rayProj, zero, _CMP_LT_OQ));
+	}
+	if (_mm256_movemask_ps(mask) == 0) {
+		return 0;
+	}
+
+	// The point of intersection has to be on the inner side of all 3 edges
+	const __m256 pointX = _mm256_add_ps(originX, _mm256_mul_ps(dirX, dist));
+	const __m256 pointY = _mm256_add_ps(originY, _mm256_mul_ps(dirY, dist));
+	const __m256 pointZ = _mm256_add_ps(originZ, _mm256_mul_ps(dirZ, dist));
+	for (int edge = 0; edge < 3; edge++) {
+		const __m256 edgeProj = _mm256_add_ps(
+			_mm256_add_ps(
+				_mm256_mul_ps(pointX, _mm256_loadu_ps(packet.edgeNormalX[edge])),
+				_mm256_mul_ps(pointY, _mm256_loadu_ps(packet.edgeNormalY[edge]))
+			),
+			_mm256_mul_ps(pointZ, _mm256_loadu_ps(packet.edgeNormalZ[edge]))
+		);
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(edgeProj, _mm256_loadu_ps(packet.edgeDist[edge]), _CMP_GE_OQ));
+	}
+
+	_mm256_storeu_ps(dists, dist);
+	return _mm256_movemask_ps(mask);
+}
+
+/// All 8 lanes at once, with the lane mask kept in a mask register
+CPU_TARGET_AVX512 inline int intersectLanes(IsaTag<IsaLevel::Avx512>, const Ray &ray, const TrianglePacket &packet, float maxDist, bool frontOnly, float *dists) {
+	const __m256 originX = _mm256_set1_ps(ray.origin.x);
+	const __m256 originY = _mm256_set1_ps(ray.origin.y);
+	const __m256 originZ = _mm256_set1_ps(ray.origin.z);
+	const __m256 dirX = _mm256_set1_ps(ray.direction.x);
+	const __m256 dirY = _mm256_set1_ps(ray.direction.y);
+	const __m256 dirZ = _mm256_set1_ps(ray.direction.z);
+	const __m256 zero = _mm256_setzero_ps();
+
+	const __m256 normalX = _mm256_loadu_ps(packet.normalX);
+	const __m256 normalY = _mm256_loadu_ps(packet.normalY);
+	const __m256 normalZ = _mm256_loadu_ps(packet.normalZ);
+	const __m256 rayProj = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dirX, normalX), _mm256_mul_ps(dirY, normalY)), _mm256_mul_ps(dirZ, normalZ));
+	const __m256 originProj = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(originX, normalX), _mm256_mul_ps(originY, normalY)), _mm256_mul_ps(originZ, normalZ));
+	const __m256 distToPlane = _mm256_sub_ps(_mm256_loadu_ps(packet.planeDist), originProj);
+	const __m256 dist = _mm256_div_ps(distToPlane, rayProj);
+
+	// Not almost perpendicular to the normal, and the plane is not behind the ray.
+	// Each comparison only runs on the lanes which passed the previous ones.
+	const __m256 absRayProj = _mm256_andnot_ps(_mm256_set1_ps(-0.f), rayProj);
+	__mmask8 mask = _mm256_cmp_ps_mask(absRayProj, _mm256_set1_ps(rayProjEpsilon), _CMP_NLT_UQ);
+	mask = _mm256_mask_cmp_ps_mask(mask, _mm256_mul_ps(rayProj, distToPlane), zero, _CMP_NLT_UQ);
+	mask = _mm256_mask_cmp_ps_mask(mask, dist, _mm256_set1_ps(maxDist), _CMP_LT_OQ);
+	if (frontOnly) {
+		mask = _mm256_mask_cmp_ps_mask(mask, rayProj, zero, _CMP_LT_OQ);
+	}
+	if (mask == 0) {
+		return 0;
+	}
+
+	// The point of intersection has to be on the inner side of all 3 edges
+	const __m256 pointX = _mm256_add_ps(originX, _mm256_mul_ps(dirX, dist));
+	const __m256 pointY = _mm256_add_ps(originY, _mm256_mul_ps(dirY, dist));
+	const __m256 pointZ = _mm256_add_ps(originZ, _mm256_mul_ps(dirZ, dist));
+	for (int edge = 0; edge < 3; edge++) {
+		const __m256 edgeProj = _mm256_add_ps(
+			_mm256_add_ps(
+				_mm256_mul_ps(pointX, _mm256_loadu_ps(packet.edgeNormalX[edge])),
+				_mm256_mul_ps(pointY, _mm256_loadu_ps(packet.edgeNormalY[edge]))
+			),
+			_mm256_mul_ps(pointZ, _mm256_loadu_ps(packet.edgeNormalZ[edge]))
+		);
+		mask = _mm256_mask_cmp_ps_mask(mask, edgeProj, _mm256_loadu_ps(packet.edgeDist[edge]), _CMP_GE_OQ);
+	}
+
+	_mm256_storeu_ps(dists, dist);
+	return int(mask);
+}
+
+#endif
+
+/// Picks the lane with the smallest distance out of the lanes with a set bit in a mask.
+/// The first lane wins ties, like when the triangles are tested one by one.
+/// @param[in] hitMask Bit i is set if lane i has an intersection
+/// @param[in] dists Distances of the intersections of all lanes
+/// @param[out] dist Distance of the picked lane
+/// @return Index of the picked lane, or -1 if no bit is set
+inline int pickClosestLane(int hitMask, const float *dists, float &dist) {
+	int closestLane = -1;
+	for (int lane = 0; lane < trianglePacketWidth; lane++) {
+		if ((hitMask & (1 << lane)) && (closestLane < 0 || dists[lane] < dist)) {
+			closestLane = lane;
+			dist = dists[lane];
+		}
+	}
+	return closestLane;
+}
+
+/// intersectClosest with the kernel of some level
+template<IsaLevel level>
+CPU_FORCE_INLINE int intersectClosest(const Ray &ray, const TrianglePacket &packet, float maxDist, float &dist) {
+	float dists[trianglePacketWidth];
+	const int hitMask = intersectLanes(IsaTag<level>(), ray, packet, maxDist, true, dists);
+	if (hitMask == 0) {
+		return -1;
+	}
+	return pickClosestLane(hitMask, dists, dist);
+}
+
+/// intersectAny with the kernel of some level
+template<IsaLevel level>
+CPU_FORCE_INLINE bool intersectAny(const Ray &ray, const TrianglePacket &packet, float maxDist) {
+	float dists[trianglePacketWidth];
+	return intersectLanes(IsaTag<level>(), ray, packet, maxDist, false, dists) != 0;
+}
+
+} // namespace TrianglePacketKernels
\ No newline at end of file
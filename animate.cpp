@@ -0,0 +1,240 @@
+#include "RayTracer.h"
+#include "Scene.h"
+
+#include "utils/StringUtils.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/// Settings of an animation, set from the command line
+struct AnimationSettings {
+	/// Path to the scene file, a .crtbin extension reads a binary scene, anything else a JSON scene
+	std::string scenePath;
+	/// Prefix of the frames' image files, followed by the frame's number and .ppm
+	std::string outputPrefix;
+	/// Number of frames
+	int framesCount = 30;
+	/// Indices of the objects which move, all objects if it is empty
+	std::vector<int> movingObjIdxs;
+	/// Angle in radians by which the top of each moving object is twisted further each frame
+	float twistPerFrame = 0.05f;
+	/// Amounts by which the camera moves forward and turns left each frame
+	float cameraDollyPerFrame = 0.f;
+	float cameraPanPerFrame = 0.f;
+	/// Resolution overriding the scene's one, if it is positive
+	Vec2i resolution = { 0, 0 };
+	/// Options passed to the ray tracer
+	RenderOptions options;
+	/// How the scene's hierarchy is built and updated, with the same number of threads as the render
+	BvhBuildOptions bvhBuildOptions;
+	/// Indicates whether to rebuild the whole hierarchy every frame instead of updating it, for comparison
+	bool fullRebuild = false;
+};
+
+/// Original vertices of a moving object, which each frame's vertices are computed from
+struct MovingObject {
+	int objIdx = 0;
+	std::vector<Vec3f> vertices;
+	/// Center of the object's box, around which it is twisted
+	Vec3f center;
+	/// Bottom and height of the object's box, the bottom isn't twisted and the top is twisted the most
+	float bottom = 0.f;
+	float height = 0.f;
+};
+
+/// Checks if a string ends with some suffix
+static bool endsWith(const std::string &str, const std::string &suffix) {
+	return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/// Parses a comma separated list of indices
+/// @return False if the list has anything other than non-negative integers
+static bool parseIndices(const char *str, std::vector<int> &indices) {
+	indices.clear();
+	while (*str) {
+		char *end = nullptr;
+		const long value = strtol(str, &end, 10);
+		if (end == str || value < 0) {
+			return false;
+		}
+		indices.push_back(int(value));
+		str = (*end == ',') ? end + 1 : end;
+	}
+	return !indices.empty();
+}
+
+/// Parses the command line into the animation settings
+/// @return False if the command line is invalid
+static bool parseArgs(int argc, char **argv, AnimationSettings &settings) {
+	if (argc < 3) {
+		return false;
+	}
+	settings.scenePath = argv[1];
+	settings.outputPrefix = argv[2];
+	for (int i = 3; i < argc; i++) {
+		const bool hasValue = i + 1 < argc;
+		if (strcmp(argv[i], "--frames") == 0 && hasValue) {
+			settings.framesCount = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--objects") == 0 && hasValue) {
+			if (!parseIndices(argv[++i], settings.movingObjIdxs)) {
+				return false;
+			}
+		} else if (strcmp(argv[i], "--twist") == 0 && hasValue) {
+			settings.twistPerFrame = float(atof(argv[++i]));
+		} else if (strcmp(argv[i], "--dolly") == 0 && hasValue) {
+			settings.cameraDollyPerFrame = float(atof(argv[++i]));
+		} else if (strcmp(argv[i], "--pan") == 0 && hasValue) {
+			settings.cameraPanPerFrame = float(atof(argv[++i]));
+		} else if (strcmp(argv[i], "--resolution") == 0 && i + 2 < argc) {
+			settings.resolution.x = atoi(argv[++i]);
+			settings.resolution.y = atoi(argv[++i]);
+			if (settings.resolution.x <= 0 || settings.resolution.y <= 0) {
+				return false;
+			}
+		} else if (strcmp(argv[i], "--threads") == 0 && hasValue) {
+			settings.options.threadsCount = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--bvh") == 0 && hasValue) {
+			if (!parseBvhBuildMode(argv[++i], settings.bvhBuildOptions.mode)) {
+				return false;
+			}
+		} else if (strcmp(argv[i], "--spatial-split-budget") == 0 && hasValue) {
+			settings.bvhBuildOptions.spatialSplitBudget = float(atof(argv[++i]));
+		} else if (strcmp(argv[i], "--bvh-layout") == 0 && hasValue) {
+			if (!parseBvhLayout(argv[++i], settings.bvhBuildOptions.layout)) {
+				return false;
+			}
+		} else if (strcmp(argv[i], "--rebuild-threshold") == 0 && hasValue) {
+			settings.bvhBuildOptions.rebuildThreshold = float(atof(argv[++i]));
+		} else if (strcmp(argv[i], "--full-rebuild") == 0) {
+			settings.fullRebuild = true;
+		} else if (strcmp(argv[i], "--stats") == 0) {
+			settings.options.printStats = true;
+		} else {
+			return false;
+		}
+	}
+	return settings.framesCount > 0;
+}
+
+/// Twists a moving object around the vertical axis through its center,
+/// by an angle growing from zero at its bottom to the full angle at its top
+/// @param[in] object Original vertices of the object
+/// @param[in] angle Angle in radians at the top of the object
+/// @param[out] mesh The object's mesh, whose vertices are replaced
+static void twistObject(const MovingObject &object, float angle, Mesh &mesh) {
+	for (int vIdx = 0; vIdx < mesh.verticesCount; vIdx++) {
+		const Vec3f &vertex = object.vertices[vIdx];
+		const float vertexAngle = angle * (vertex.y - object.bottom) / object.height;
+		const float cosAngle = cosf(vertexAngle);
+		const float sinAngle = sinf(vertexAngle);
+		const float x = vertex.x - object.center.x;
+		const float z = vertex.z - object.center.z;
+		mesh.vertices[vIdx] = {
+			object.center.x + x * cosAngle + z * sinAngle,
+			vertex.y,
+			object.center.z - x * sinAngle + z * cosAngle
+		};
+	}
+}
+
+/// Renders a sequence of frames of a scene, in which some objects are twisted further each frame and the camera moves.
+/// Only the moved objects' hierarchies are updated each frame, by refitting them and rebuilding their degraded subtrees.
+int main(int argc, char **argv) {
+	AnimationSettings settings;
+	if (!parseArgs(argc, argv, settings)) {
+		std::cout << "Usage: " << argv[0] << " <scene.crtscene|scene.crtbin> <output prefix>"
+			<< " [--frames N] [--objects i,j,...] [--twist radians] [--dolly amount] [--pan radians]"
+			<< " [--resolution W H] [--threads N] [--bvh sweep|binned|lbvh|sbvh] [--spatial-split-budget X] [--bvh-layout binary|wide] [--rebuild-threshold X] [--full-rebuild] [--stats]\n";
+		return 1;
+	}
+
+	Scene scene;
+	scene.bvhBuildOptions = settings.bvhBuildOptions;
+	scene.bvhBuildOptions.threadsCount = settings.options.threadsCount;
+	const bool sceneRead = endsWith(settings.scenePath, ".crtbin")
+		? scene.readFromBinaryFile(settings.scenePath)
+		: scene.readFromJsonFile(settings.scenePath);
+	if (!sceneRead) {
+		std::cout << "Error: Cannot read scene " << settings.scenePath << "\n";
+		return 1;
+	}
+	if (settings.resolution.x > 0) {
+		scene.imageResolution = settings.resolution;
+		// Keep the pixels square when the aspect ratio changes
+		scene.camera.viewSize.y = scene.camera.viewSize.x * float(settings.resolution.y) / float(settings.resolution.x);
+	}
+	std::cout << "Built the BVH in " << scene.bvh.buildStats.seconds << "s, SAH cost " << scene.bvh.buildStats.sahCost << "\n";
+
+	if (settings.movingObjIdxs.empty()) {
+		for (int objIdx = 0; objIdx < scene.objectsCount; objIdx++) {
+			settings.movingObjIdxs.push_back(objIdx);
+		}
+	}
+	std::vector<MovingObject> movingObjects;
+	for (const int objIdx : settings.movingObjIdxs) {
+		if (objIdx >= scene.objectsCount) {
+			std::cout << "Error: The scene has no object " << objIdx << "\n";
+			return 1;
+		}
+		const Mesh &mesh = scene.objects[objIdx];
+		MovingObject object;
+		object.objIdx = objIdx;
+		object.vertices.assign(mesh.vertices, mesh.vertices + mesh.verticesCount);
+		BoundingBox box;
+		for (const Vec3f &vertex : object.vertices) {
+			box.expand(vertex);
+		}
+		object.center = box.getCenter();
+		object.bottom = box.min.y;
+		object.height = getMax(box.max.y - box.min.y, 1e-6f);
+		movingObjects.push_back(object);
+	}
+
+	const int frameDigits = int(std::to_string(settings.framesCount - 1).size());
+	double totalUpdateSeconds = 0.0;
+	for (int frameIdx = 0; frameIdx < settings.framesCount; frameIdx++) {
+		// The first frame is the scene as it is read
+		BvhUpdateStats updateStats;
+		if (frameIdx > 0) {
+			for (const MovingObject &object : movingObjects) {
+				twistObject(object, settings.twistPerFrame * float(frameIdx), scene.objects[object.objIdx]);
+			}
+			scene.camera.dolly(settings.cameraDollyPerFrame);
+			scene.camera.pan(settings.cameraPanPerFrame);
+
+			if (settings.fullRebuild) {
+				const auto startTime = std::chrono::steady_clock::now();
+				for (const MovingObject &object : movingObjects) {
+					scene.objects[object.objIdx].precomputeTriangles();
+				}
+				scene.buildBvh();
+				updateStats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+			} else {
+				scene.updateObjects(settings.movingObjIdxs.data(), int(settings.movingObjIdxs.size()), updateStats);
+			}
+			totalUpdateSeconds += updateStats.seconds;
+		}
+
+		const std::string framePath = settings.outputPrefix + StringUtils::getPaddedNumberString(frameIdx, frameDigits) + ".ppm";
+		const auto renderStartTime = std::chrono::steady_clock::now();
+		RayTracer rayTracer(scene);
+		if (!rayTracer.renderImage(framePath.c_str(), settings.options)) {
+			std::cout << "Error: Cannot render image " << framePath << "\n";
+			return 1;
+		}
+		const double renderSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStartTime).count();
+
+		std::cout << "Frame " << frameIdx << ": updated the BVH in " << updateStats.seconds * 1000.0 << "ms"
+			<< " (" << updateStats.refitNodes << " nodes refit, " << updateStats.rebuiltSubtrees << " subtrees with "
+			<< updateStats.rebuiltTriangles << " triangles rebuilt), SAH cost " << scene.bvh.buildStats.sahCost
+			<< ", rendered in " << renderSeconds << "s\n";
+	}
+	std::cout << "Updated the BVH in " << totalUpdateSeconds << "s over " << settings.framesCount - 1 << " frames\n";
+
+	return 0;
+}
\ No newline at end of file
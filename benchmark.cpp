@@ -0,0 +1,828 @@
+#include "RayTracer.h"
+#include "Scene.h"
+#include "TrianglePacket.h"
+
+#include "utils/CpuUtils.h"
+#include "utils/JsonUtils.h"
+#include "utils/SimdUtils.h"
+
+#include "rapidjson/filewritestream.h"
+#include "rapidjson/writer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Settings of a benchmark run, set from the command line
+struct BenchSettings {
+	/// Runs before the measured ones, to warm up caches and the CPU clock
+	int warmupsCount = 1;
+	/// Measured runs of each benchmark
+	int repeatsCount = 5;
+	/// Only benchmarks whose names contain this are run
+	std::string filter;
+	/// Path to the JSON file with the results
+	std::string outputPath = "render/bench.json";
+	/// Instruction set level of the kernels, the best one of the CPU by default
+	CpuUtils::IsaLevel isaLevel = CpuUtils::detectIsaLevel();
+};
+
+/// Timings of the measured runs of a single benchmark
+struct BenchResult {
+	/// Name of the benchmark, in the form "group/case"
+	std::string name;
+	/// Number of items (rays, tests, loads, ...) processed by a single run
+	double itemsCount = 0.0;
+	/// Name of the items
+	std::string itemsName;
+	/// Times of the measured runs in seconds, sorted
+	std::vector<double> times;
+
+	/// Returns the time at some percentile of the runs, with the nearest rank method
+	double getPercentile(double percentile) const {
+		const int rank = int(std::ceil(percentile / 100.0 * double(times.size())));
+		return times[getMin(getMax(rank, 1), int(times.size())) - 1];
+	}
+
+	/// Returns the median time of the runs
+	double getMedian() const {
+		const size_t mid = times.size() / 2;
+		return (times.size() % 2 == 1) ? times[mid] : (times[mid - 1] + times[mid]) * 0.5;
+	}
+};
+
+/// Sink for the results of the benchmarked code, so that the compiler can't optimize the code away
+static volatile long long benchSink = 0;
+
+/// Results of all benchmarks run so far
+static std::vector<BenchResult> benchResults;
+
+/// Runs a benchmark with warmup runs and measured repeat runs, and saves its result.
+/// Does nothing if the benchmark is filtered out.
+/// @param[in] settings Settings of the benchmark run
+/// @param[in] name Name of the benchmark
+/// @param[in] itemsCount Number of items processed by a single run of the benchmark
+/// @param[in] itemsName Name of the items
+/// @param[in] run Function that does a single run, returns a value to be sunk
+static void runBenchmark(
+	const BenchSettings &settings,
+	const std::string &name,
+	double itemsCount,
+	const char *itemsName,
+	const std::function<long long()> &run
+) {
+	if (name.find(settings.filter) == std::string::npos) {
+		return;
+	}
+
+	for (int i = 0; i < settings.warmupsCount; i++) {
+		benchSink = benchSink + run();
+	}
+
+	BenchResult result;
+	result.name = name;
+	result.itemsCount = itemsCount;
+	result.itemsName = itemsName;
+	for (int i = 0; i < getMax(1, settings.repeatsCount); i++) {
+		const auto start = std::chrono::steady_clock::now();
+		benchSink = benchSink + run();
+		const std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+		result.times.push_back(time.count());
+	}
+	std::sort(result.times.begin(), result.times.end());
+
+	const double median = result.getMedian();
+	std::cout << std::left << std::setw(40) << name << std::right
+		<< " median " << std::setw(10) << median * 1000.0 << " ms"
+		<< "  p95 " << std::setw(10) << result.getPercentile(95.0) * 1000.0 << " ms"
+		<< "  " << itemsCount / median << " " << itemsName << "/s\n";
+	benchResults.push_back(result);
+}
+
+/// Writes the results of all benchmarks run so far to a JSON file
+/// @param[in] settings Settings of the benchmark run
+/// @return True on success
+static bool writeResults(const BenchSettings &settings) {
+	FILE *file = fopen(settings.outputPath.c_str(), "wb");
+	if (!file) {
+		return false;
+	}
+	char buffer[1 << 16];
+	rapidjson::FileWriteStream stream(file, buffer, sizeof(buffer));
+	rapidjson::Writer<rapidjson::FileWriteStream> writer(stream);
+
+	writer.StartObject();
+	writer.Key("compiler");
+#ifdef __VERSION__
+	writer.String(__VERSION__);
+#else
+	writer.String("unknown");
+#endif
+	writer.Key("isa");
+	writer.String(CpuUtils::getIsaLevelName(CpuUtils::getIsaLevel()));
+	writer.Key("hardwareThreads");
+	writer.Int(int(std::thread::hardware_concurrency()));
+	writer.Key("warmups");
+	writer.Int(settings.warmupsCount);
+	writer.Key("repeats");
+	writer.Int(settings.repeatsCount);
+	writer.Key("results");
+	writer.StartArray();
+	for (const BenchResult &result : benchResults) {
+		const double median = result.getMedian();
+		writer.StartObject();
+		writer.Key("name");
+		writer.String(result.name.c_str());
+		writer.Key("medianSec");
+		writer.Double(median);
+		writer.Key("p95Sec");
+		writer.Double(result.getPercentile(95.0));
+		writer.Key("minSec");
+		writer.Double(result.times.front());
+		writer.Key("maxSec");
+		writer.Double(result.times.back());
+		writer.Key("items");
+		writer.Double(result.itemsCount);
+		writer.Key("itemsName");
+		writer.String(result.itemsName.c_str());
+		writer.Key("itemsPerSec");
+		writer.Double(result.itemsCount / median);
+		writer.Key("timesSec");
+		writer.StartArray();
+		for (double time : result.times) {
+			writer.Double(time);
+		}
+		writer.EndArray();
+		writer.EndObject();
+	}
+	writer.EndArray();
+	writer.EndObject();
+
+	stream.Flush();
+	fclose(file);
+	return true;
+}
+
+/// Reads a scene file through a mapped JSON document
+/// @return True on success
+static bool loadScene(const char *scenePath, Scene &scene) {
+	JsonUtils::MappedJsonDocument jsonDoc(scenePath);
+	return jsonDoc.isParsed && scene.readFromJson(jsonDoc.doc);
+}
+
+/// Generates camera rays through the centers of the pixels of an image with some resolution
+static std::vector<Ray> generateCameraRays(const Camera &camera, const Vec2i &resolution) {
+	std::vector<Ray> rays;
+	rays.reserve(resolution.x * resolution.y);
+	for (Vec2i pixel = { 0, 0 }; pixel.y < resolution.y; pixel.y++) {
+		for (pixel.x = 0; pixel.x < resolution.x; pixel.x++) {
+			const Vec3f cameraToPixel = {
+				((float(pixel.x) + 0.5f) / float(resolution.x) * 2.f - 1.f) * camera.viewSize.x * 0.5f,
+				(1.f - (float(pixel.y) + 0.5f) / float(resolution.y) * 2.f) * camera.viewSize.y * 0.5f,
+				-camera.viewDepth
+			};
+			rays.push_back({ camera.position, camera.rotation * cameraToPixel.getNormal() });
+		}
+	}
+	return rays;
+}
+
+/// Finds the closest front side intersection of a ray by testing every triangle of every object,
+/// the way the ray tracer did it before the BVH
+static bool intersectBruteForce(const Scene &scene, const Ray &ray, TriangleIntersection &intersection) {
+	float minDist = -1.f;
+	for (int objIdx = 0; objIdx < scene.objectsCount; objIdx++) {
+		const Mesh &obj = scene.objects[objIdx];
+		for (int trIdx = 0; trIdx < obj.trianglesCount; trIdx++) {
+			const RayTriangleIntersectionResult intersectionResult = rayTriangleIntersection(
+				ray,
+				obj.vertices[obj.triangles[trIdx].x],
+				obj.vertices[obj.triangles[trIdx].y],
+				obj.vertices[obj.triangles[trIdx].z]
+			);
+			if (!intersectionResult.doesIntersect || !intersectionResult.frontSide) {
+				continue;
+			}
+			if (minDist == -1.f || intersectionResult.distAlongRay < minDist) {
+				minDist = intersectionResult.distAlongRay;
+				intersection.point = intersectionResult.point;
+				intersection.mesh = &obj;
+				intersection.triangle = &obj.triangles[trIdx];
+			}
+		}
+	}
+	return minDist != -1.f;
+}
+
+/// Benchmarks primary rays intersected with the brute-force loop, with the BVH ray by ray and with the BVH in packets
+static void benchPrimaryRays(const BenchSettings &settings, const char *scenePath) {
+	Scene scene;
+	if (!loadScene(scenePath, scene)) {
+		return;
+	}
+
+	// Brute force is too slow for as many rays as the BVH
+	const std::vector<Ray> bruteForceRays = generateCameraRays(scene.camera, { 96, 54 });
+	runBenchmark(settings, "primaryRays/bruteForce", double(bruteForceRays.size()), "rays", [&]() {
+		long long hits = 0;
+		for (const Ray &ray : bruteForceRays) {
+			TriangleIntersection intersection;
+			hits += intersectBruteForce(scene, ray, intersection);
+		}
+		return hits;
+	});
+
+	const std::vector<Ray> rays = generateCameraRays(scene.camera, { 480, 270 });
+	runBenchmark(settings, "primaryRays/bvh", double(rays.size()), "rays", [&]() {
+		long long hits = 0;
+		RayStats stats;
+		for (const Ray &ray : rays) {
+			TriangleIntersection intersection;
+			hits += scene.bvh.intersect(ray, intersection, stats);
+		}
+		return hits;
+	});
+
+	// The same rays in packets of blocks of pixels, the way the ray tracer traces them
+	const Vec2i resolution = { 480, 270 };
+	std::vector<RayPacket> packets;
+	for (Vec2i blockMin = { 0, 0 }; blockMin.y < resolution.y; blockMin.y += rayPacketDim) {
+		for (blockMin.x = 0; blockMin.x < resolution.x; blockMin.x += rayPacketDim) {
+			packets.emplace_back();
+			RayPacket &packet = packets.back();
+			for (int y = blockMin.y; y < getMin(blockMin.y + rayPacketDim, resolution.y); y++) {
+				for (int x = blockMin.x; x < getMin(blockMin.x + rayPacketDim, resolution.x); x++) {
+					packet.rays[packet.raysCount++] = rays[y * resolution.x + x];
+				}
+			}
+			packet.prepare();
+		}
+	}
+	runBenchmark(settings, "primaryRays/bvhPacket", double(rays.size()), "rays", [&]() {
+		long long hits = 0;
+		RayStats stats;
+		for (const RayPacket &packet : packets) {
+			TriangleIntersection intersections[rayPacketSize];
+			bool found[rayPacketSize];
+			scene.bvh.intersect(packet, intersections, found, stats);
+			for (int i = 0; i < packet.raysCount; i++) {
+				hits += found[i];
+			}
+		}
+		return hits;
+	});
+}
+
+/// Creates a mesh of small triangles at random positions in a unit cube, a worst case for the BVH builders
+static Mesh createTriangleSoup(int trianglesCount) {
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> position(0.f, 1.f);
+	std::uniform_real_distribution<float> offset(-0.01f, 0.01f);
+	Vec3f *vertices = new Vec3f[trianglesCount * 3];
+	Vec3i *triangles = new Vec3i[trianglesCount];
+	for (int trIdx = 0; trIdx < trianglesCount; trIdx++) {
+		const Vec3f center = { position(rng), position(rng), position(rng) };
+		for (int i = 0; i < 3; i++) {
+			vertices[trIdx * 3 + i] = center + Vec3f{ offset(rng), offset(rng), offset(rng) };
+		}
+		triangles[trIdx] = { trIdx * 3, trIdx * 3 + 1, trIdx * 3 + 2 };
+	}
+	return Mesh(vertices, trianglesCount * 3, triangles, trianglesCount);
+}
+
+/// Benchmarks building the BVH of a scene and of a large triangle soup with each build mode,
+/// and tracing the scene's primary rays through the BVH of each mode
+static void benchBvhBuild(const BenchSettings &settings, const char *scenePath) {
+	Scene scene;
+	if (!loadScene(scenePath, scene)) {
+		return;
+	}
+	const Mesh soup = createTriangleSoup(200000);
+	const std::vector<Ray> rays = generateCameraRays(scene.camera, { 480, 270 });
+
+	const BvhBuildMode modes[] = { BvhBuildMode::Sweep, BvhBuildMode::Binned, BvhBuildMode::Lbvh, BvhBuildMode::Sbvh };
+	for (const BvhBuildMode mode : modes) {
+		BvhBuildOptions options;
+		options.mode = mode;
+		const std::string modeName = getBvhBuildModeName(mode);
+
+		// The build and the trace quality of the same hierarchy, printed only if the build ran
+		Bvh bvh;
+		runBenchmark(settings, "bvhBuild/scene3/" + modeName, 1.0, "builds", [&]() {
+			bvh.build(scene.objects, scene.objectsCount, options);
+			return (long long)(bvh.nodesCount);
+		});
+		if (bvh.nodesCount > 0) {
+			std::cout << "  SAH cost " << bvh.buildStats.sahCost << ", " << bvh.nodesCount << " nodes\n";
+		}
+
+		Bvh soupBvh;
+		runBenchmark(settings, "bvhBuild/soup/" + modeName, double(soup.trianglesCount), "triangles", [&]() {
+			soupBvh.build(&soup, 1, options);
+			return (long long)(soupBvh.nodesCount);
+		});
+		if (soupBvh.nodesCount > 0) {
+			std::cout << "  SAH cost " << soupBvh.buildStats.sahCost << ", " << soupBvh.nodesCount << " nodes\n";
+		}
+
+		Bvh traceBvh;
+		traceBvh.build(scene.objects, scene.objectsCount, options);
+		runBenchmark(settings, "bvhTrace/scene3/" + modeName, double(rays.size()), "rays", [&]() {
+			long long hits = 0;
+			RayStats stats;
+			for (const Ray &ray : rays) {
+				TriangleIntersection intersection;
+				hits += traceBvh.intersect(ray, intersection, stats);
+			}
+			return hits;
+		});
+	}
+}
+
+/// Benchmarks tracing through the binary and the wide layout of the same hierarchies,
+/// with the camera rays of a scene ray by ray and in packets,
+/// and with closest intersection and occlusion rays through a large triangle soup, whose nodes don't fit in the caches
+static void benchBvhLayout(const BenchSettings &settings, const char *scenePath) {
+	Scene scene;
+	if (!loadScene(scenePath, scene)) {
+		return;
+	}
+	const Mesh soup = createTriangleSoup(200000);
+
+	const Vec2i resolution = { 480, 270 };
+	const std::vector<Ray> rays = generateCameraRays(scene.camera, resolution);
+	std::vector<RayPacket> packets;
+	for (Vec2i blockMin = { 0, 0 }; blockMin.y < resolution.y; blockMin.y += rayPacketDim) {
+		for (blockMin.x = 0; blockMin.x < resolution.x; blockMin.x += rayPacketDim) {
+			packets.emplace_back();
+			RayPacket &packet = packets.back();
+			for (int y = blockMin.y; y < getMin(blockMin.y + rayPacketDim, resolution.y); y++) {
+				for (int x = blockMin.x; x < getMin(blockMin.x + rayPacketDim, resolution.x); x++) {
+					packet.rays[packet.raysCount++] = rays[y * resolution.x + x];
+				}
+			}
+			packet.prepare();
+		}
+	}
+
+	// Rays from in front of the soup's cube to random points in it, and occlusion rays between two random points in it
+	std::mt19937 rng(2);
+	std::uniform_real_distribution<float> position(0.f, 1.f);
+	const int soupRaysCount = 100000;
+	std::vector<Ray> soupRays;
+	std::vector<Ray> soupShadowRays;
+	std::vector<float> soupShadowDists;
+	for (int i = 0; i < soupRaysCount; i++) {
+		const Vec3f origin = { 0.5f, 0.5f, -1.f };
+		const Vec3f target = { position(rng), position(rng), position(rng) };
+		soupRays.push_back({ origin, (target - origin).getNormal() });
+		const Vec3f from = { position(rng), position(rng), position(rng) };
+		soupShadowRays.push_back({ from, (target - from).getNormal() });
+		soupShadowDists.push_back((target - from).getLength());
+	}
+
+	const BvhLayout layouts[] = { BvhLayout::Binary, BvhLayout::Wide };
+	for (const BvhLayout layout : layouts) {
+		BvhBuildOptions options;
+		options.layout = layout;
+		const std::string layoutName = getBvhLayoutName(layout);
+
+		Bvh bvh;
+		bvh.build(scene.objects, scene.objectsCount, options);
+		int trianglesCount = 0;
+		for (int objIdx = 0; objIdx < scene.objectsCount; objIdx++) {
+			trianglesCount += scene.objects[objIdx].trianglesCount;
+		}
+		std::cout << "bvhLayout/scene3/" << layoutName << ": " << bvh.getNodesSize() << " bytes of nodes, "
+			<< double(bvh.getNodesSize()) / double(getMax(1, trianglesCount)) << " per triangle\n";
+		runBenchmark(settings, "bvhLayout/scene3/" + layoutName + "/rays", double(rays.size()), "rays", [&]() {
+			long long hits = 0;
+			RayStats stats;
+			for (const Ray &ray : rays) {
+				TriangleIntersection intersection;
+				hits += bvh.intersect(ray, intersection, stats);
+			}
+			return hits;
+		});
+		runBenchmark(settings, "bvhLayout/scene3/" + layoutName + "/packets", double(rays.size()), "rays", [&]() {
+			long long hits = 0;
+			RayStats stats;
+			for (const RayPacket &packet : packets) {
+				TriangleIntersection intersections[rayPacketSize];
+				bool found[rayPacketSize];
+				bvh.intersect(packet, intersections, found, stats);
+				for (int i = 0; i < packet.raysCount; i++) {
+					hits += found[i];
+				}
+			}
+			return hits;
+		});
+
+		Bvh soupBvh;
+		soupBvh.build(&soup, 1, options);
+		std::cout << "bvhLayout/soup/" << layoutName << ": " << soupBvh.getNodesSize() << " bytes of nodes, "
+			<< double(soupBvh.getNodesSize()) / double(soup.trianglesCount) << " per triangle\n";
+		runBenchmark(settings, "bvhLayout/soup/" + layoutName + "/rays", double(soupRaysCount), "rays", [&]() {
+			long long hits = 0;
+			RayStats stats;
+			for (const Ray &ray : soupRays) {
+				TriangleIntersection intersection;
+				hits += soupBvh.intersect(ray, intersection, stats);
+			}
+			return hits;
+		});
+		runBenchmark(settings, "bvhLayout/soup/" + layoutName + "/occlusion", double(soupRaysCount), "rays", [&]() {
+			long long hits = 0;
+			RayStats stats;
+			for (int i = 0; i < soupRaysCount; i++) {
+				hits += soupBvh.isOccluded(soupShadowRays[i], soupShadowDists[i], stats);
+			}
+			return hits;
+		});
+		if (layout == BvhLayout::Wide) {
+			runBenchmark(settings, "bvhLayout/soup/convert", double(soup.trianglesCount), "triangles", [&]() {
+				soupBvh.buildWideNodes();
+				return (long long)(soupBvh.wideNodesCount);
+			});
+		}
+	}
+}
+
+/// Creates a mesh like an architectural interior: the floor, the ceiling and the walls of a room
+/// and a few walls across it, each made of two huge triangles, long and thin cables between random points of the room,
+/// and small triangles of clutter near the floor. The boxes of the huge and the long triangles overlap most of the others,
+/// which is the worst case for splitting the triangles only by their centers.
+static Mesh createRoom(int clutterCount, int cablesCount) {
+	std::mt19937 rng(3);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	const Vec3f size = { 20.f, 4.f, 20.f };
+	auto randomPoint = [&](float heightScale) {
+		return Vec3f{ unit(rng) * size.x, unit(rng) * size.y * heightScale, unit(rng) * size.z };
+	};
+
+	std::vector<Vec3f> vertices;
+	std::vector<Vec3i> triangles;
+	// Quads with the corners going counterclockwise as seen from their front side
+	auto addQuad = [&](const Vec3f &a, const Vec3f &b, const Vec3f &c, const Vec3f &d) {
+		const int first = int(vertices.size());
+		vertices.insert(vertices.end(), { a, b, c, d });
+		triangles.push_back({ first, first + 1, first + 2 });
+		triangles.push_back({ first, first + 2, first + 3 });
+	};
+	const Vec3f up = { 0.f, size.y, 0.f };
+	const Vec3f corners[4] = { { 0.f, 0.f, 0.f }, { size.x, 0.f, 0.f }, { size.x, 0.f, size.z }, { 0.f, 0.f, size.z } };
+	addQuad(corners[0], corners[3], corners[2], corners[1]);
+	addQuad(corners[0] + up, corners[1] + up, corners[2] + up, corners[3] + up);
+	for (int i = 0; i < 4; i++) {
+		const Vec3f &a = corners[i];
+		const Vec3f &b = corners[(i + 1) % 4];
+		addQuad(a, b, b + up, a + up);
+	}
+	// Walls across the room are seen from both sides
+	for (int i = 0; i < 6; i++) {
+		const Vec3f a = randomPoint(0.f);
+		const Vec3f b = randomPoint(0.f);
+		addQuad(a, b, b + up, a + up);
+		addQuad(b, a, a + up, b + up);
+	}
+	for (int i = 0; i < cablesCount; i++) {
+		const Vec3f a = randomPoint(1.f);
+		const Vec3f b = randomPoint(1.f);
+		const int first = int(vertices.size());
+		vertices.insert(vertices.end(), { a, b, a + Vec3f{ 0.01f, 0.01f, 0.f } });
+		triangles.push_back({ first, first + 1, first + 2 });
+	}
+	for (int i = 0; i < clutterCount; i++) {
+		const Vec3f center = randomPoint(0.3f);
+		const int first = int(vertices.size());
+		for (int j = 0; j < 3; j++) {
+			vertices.push_back(center + Vec3f{ unit(rng), unit(rng), unit(rng) } * 0.1f);
+		}
+		triangles.push_back({ first, first + 1, first + 2 });
+	}
+
+	Vec3f *meshVertices = new Vec3f[vertices.size()];
+	std::copy(vertices.begin(), vertices.end(), meshVertices);
+	Vec3i *meshTriangles = new Vec3i[triangles.size()];
+	std::copy(triangles.begin(), triangles.end(), meshTriangles);
+	return Mesh(meshVertices, int(vertices.size()), meshTriangles, int(triangles.size()));
+}
+
+/// Benchmarks building and tracing the BVH of a room of huge, long and small triangles, see createRoom,
+/// with object splits only and with spatial splits under a few budgets
+static void benchSpatialSplits(const BenchSettings &settings) {
+	const Mesh room = createRoom(100000, 5000);
+
+	// Rays from random points in the room in random directions
+	std::mt19937 rng(5);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	const int raysCount = 20000;
+	std::vector<Ray> rays;
+	for (int i = 0; i < raysCount; i++) {
+		const Vec3f origin = { 1.f + unit(rng) * 18.f, 0.5f + unit(rng) * 3.f, 1.f + unit(rng) * 18.f };
+		const Vec3f direction = Vec3f{ unit(rng) - 0.5f, unit(rng) - 0.5f, unit(rng) - 0.5f }.getNormal();
+		rays.push_back({ origin, direction });
+	}
+
+	struct Variant {
+		std::string name;
+		BvhBuildMode mode;
+		float spatialSplitBudget;
+	};
+	const Variant variants[] = {
+		{ "binned", BvhBuildMode::Binned, 0.f },
+		{ "sweep", BvhBuildMode::Sweep, 0.f },
+		{ "sbvh-0.1", BvhBuildMode::Sbvh, 0.1f },
+		{ "sbvh-0.3", BvhBuildMode::Sbvh, 0.3f },
+		{ "sbvh-1.0", BvhBuildMode::Sbvh, 1.f }
+	};
+	for (const Variant &variant : variants) {
+		BvhBuildOptions options;
+		options.mode = variant.mode;
+		options.spatialSplitBudget = variant.spatialSplitBudget;
+
+		Bvh bvh;
+		runBenchmark(settings, "spatialSplits/room/" + variant.name + "/build", double(room.trianglesCount), "triangles", [&]() {
+			bvh.build(&room, 1, options);
+			return (long long)(bvh.nodesCount);
+		});
+		if (bvh.nodesCount == 0) {
+			bvh.build(&room, 1, options);
+		}
+		RayStats stats;
+		runBenchmark(settings, "spatialSplits/room/" + variant.name + "/rays", double(raysCount), "rays", [&]() {
+			long long hits = 0;
+			stats = RayStats();
+			for (const Ray &ray : rays) {
+				TriangleIntersection intersection;
+				hits += bvh.intersect(ray, intersection, stats);
+			}
+			return hits;
+		});
+		// The work of the rays is printed only if they were traced
+		if (stats.nodeVisits > 0) {
+			std::cout << "spatialSplits/room/" << variant.name << ": SAH cost " << bvh.buildStats.sahCost
+				<< ", " << bvh.buildStats.duplicatedRefs << " references added to " << room.trianglesCount << " triangles"
+				<< ", " << double(stats.nodeVisits) / double(raysCount) << " node visits and "
+				<< double(stats.triangleTests) / double(raysCount) << " triangle tests per ray\n";
+		}
+	}
+}
+
+/// Benchmarks ray/triangle tests from vertices, from precomputed triangles and from triangle packets,
+/// testing camera rays against every triangle of every object
+static void benchTriangleIntersection(const BenchSettings &settings, const char *scenePath) {
+	Scene scene;
+	if (!loadScene(scenePath, scene)) {
+		return;
+	}
+
+	const std::vector<Ray> rays = generateCameraRays(scene.camera, { 96, 54 });
+	long long testsCount = 0;
+	for (int objIdx = 0; objIdx < scene.objectsCount; objIdx++) {
+		testsCount += (long long)(rays.size()) * scene.objects[objIdx].trianglesCount;
+	}
+
+	runBenchmark(settings, "rayTriangle/fromVertices", double(testsCount), "tests", [&]() {
+		long long hits = 0;
+		for (const Ray &ray : rays) {
+			for (int objIdx = 0; objIdx < scene.objectsCount; objIdx++) {
+				const Mesh &obj = scene.objects[objIdx];
+				for (int trIdx = 0; trIdx < obj.trianglesCount; trIdx++) {
+					hits += rayTriangleIntersection(
+						ray,
+						obj.vertices[obj.triangles[trIdx].x],
+						obj.vertices[obj.triangles[trIdx].y],
+						obj.vertices[obj.triangles[trIdx].z]
+					).doesIntersect;
+				}
+			}
+		}
+		return hits;
+	});
+
+	runBenchmark(settings, "rayTriangle/precomputed", double(testsCount), "tests", [&]() {
+		long long hits = 0;
+		for (const Ray &ray : rays) {
+			for (int objIdx = 0; objIdx < scene.objectsCount; objIdx++) {
+				const Mesh &obj = scene.objects[objIdx];
+				for (int trIdx = 0; trIdx < obj.trianglesCount; trIdx++) {
+					hits += rayTriangleIntersection(ray, obj.precomputedTriangles[trIdx]).doesIntersect;
+				}
+			}
+		}
+		return hits;
+	});
+
+	// The same triangles with their vectors in SSE registers
+	std::vector<std::vector<SimdUtils::PrecomputedTriangleSimd>> simdTriangles(scene.objectsCount);
+	for (int objIdx = 0; objIdx < scene.objectsCount; objIdx++) {
+		const Mesh &obj = scene.objects[objIdx];
+		simdTriangles[objIdx].assign(obj.precomputedTriangles, obj.precomputedTriangles + obj.trianglesCount);
+	}
+	runBenchmark(settings, "rayTriangle/precomputedSimd", double(testsCount), "tests", [&]() {
+		long long hits = 0;
+		for (const Ray &ray : rays) {
+			const SimdUtils::RaySimd simdRay(ray);
+			for (const std::vector<SimdUtils::PrecomputedTriangleSimd> &triangles : simdTriangles) {
+				for (const SimdUtils::PrecomputedTriangleSimd &triangle : triangles) {
+					hits += SimdUtils::rayTriangleIntersection(simdRay, triangle).doesIntersect;
+				}
+			}
+		}
+		return hits;
+	});
+
+	// The same triangles in packets, the hits are counted per packet
+	std::vector<TrianglePacket> packets;
+	for (int objIdx = 0; objIdx < scene.objectsCount; objIdx++) {
+		const Mesh &obj = scene.objects[objIdx];
+		for (int trIdx = 0; trIdx < obj.trianglesCount; trIdx++) {
+			if (trIdx % trianglePacketWidth == 0) {
+				packets.emplace_back();
+			}
+			packets.back().setLane(trIdx % trianglePacketWidth, obj.precomputedTriangles[trIdx]);
+		}
+	}
+	runBenchmark(settings, "rayTriangle/packet", double(testsCount), "tests", [&]() {
+		long long hits = 0;
+		for (const Ray &ray : rays) {
+			for (const TrianglePacket &packet : packets) {
+				hits += intersectAny(ray, packet, std::numeric_limits<float>::max());
+			}
+		}
+		return hits;
+	});
+}
+
+/// Benchmarks the basic Vec3f operations over an array of random vectors
+static void benchVec3f(const BenchSettings &settings) {
+	const int vectorsCount = 1 << 20;
+	std::vector<Vec3f> vectors(vectorsCount);
+	std::mt19937 random(42);
+	std::uniform_real_distribution<float> distribution(-1.f, 1.f);
+	for (Vec3f &vec : vectors) {
+		vec = { distribution(random), distribution(random), distribution(random) };
+	}
+
+	runBenchmark(settings, "vec3f/addScale", double(vectorsCount), "vectors", [&]() {
+		Vec3f sum;
+		for (const Vec3f &vec : vectors) {
+			sum += vec * 0.5f - sum * 0.001f;
+		}
+		return (long long)(sum.x + sum.y + sum.z);
+	});
+
+	runBenchmark(settings, "vec3f/dotCross", double(vectorsCount - 1), "vectors", [&]() {
+		float sum = 0.f;
+		for (int i = 0; i + 1 < vectorsCount; i++) {
+			sum += dotProduct(crossProduct(vectors[i], vectors[i + 1]), vectors[i]);
+		}
+		return (long long)(sum);
+	});
+
+	runBenchmark(settings, "vec3f/normalize", double(vectorsCount), "vectors", [&]() {
+		float sum = 0.f;
+		for (const Vec3f &vec : vectors) {
+			sum += vec.getNormal().x;
+		}
+		return (long long)(sum);
+	});
+}
+
+/// Benchmarks parsing a scene file into a JSON document, and reading the whole scene
+static void benchJsonLoading(const BenchSettings &settings, const char *scenePath) {
+	runBenchmark(settings, "json/stream", 1.0, "loads", [&]() {
+		rapidjson::Document jsonDoc = JsonUtils::readJsonDocument(scenePath);
+		return (long long)(jsonDoc.MemberCount());
+	});
+
+	runBenchmark(settings, "json/mapped", 1.0, "loads", [&]() {
+		JsonUtils::MappedJsonDocument jsonDoc(scenePath);
+		return jsonDoc.isParsed ? (long long)(jsonDoc.doc.MemberCount()) : 0;
+	});
+
+	runBenchmark(settings, "scene/document", 1.0, "loads", [&]() {
+		Scene scene;
+		loadScene(scenePath, scene);
+		return (long long)(scene.objectsCount);
+	});
+
+	runBenchmark(settings, "scene/streaming", 1.0, "loads", [&]() {
+		Scene scene;
+		scene.readFromJsonFile(scenePath);
+		return (long long)(scene.objectsCount);
+	});
+}
+
+/// Benchmarks whole renders of a scene, with all hardware threads and, for the largest scene,
+/// with fewer threads and without ray packets
+static void benchRender(const BenchSettings &settings, const char *sceneName, bool withThreadScaling) {
+	const std::string scenePath = std::string("scenes/") + sceneName + ".crtscene";
+	Scene scene;
+	if (!loadScene(scenePath.c_str(), scene)) {
+		return;
+	}
+	RayTracer rayTracer(scene);
+	const double pixelsCount = double(scene.imageResolution.x) * double(scene.imageResolution.y);
+
+	const int maxThreadsCount = getMax(1, int(std::thread::hardware_concurrency()));
+	// Powers of 2 below the number of hardware threads, and the number itself
+	std::vector<int> threadsCounts;
+	for (int threadsCount = 1; withThreadScaling && threadsCount < maxThreadsCount; threadsCount *= 2) {
+		threadsCounts.push_back(threadsCount);
+	}
+	threadsCounts.push_back(maxThreadsCount);
+
+	for (int threadsCount : threadsCounts) {
+		RenderOptions options;
+		options.threadsCount = threadsCount;
+		std::string name = std::string("render/") + sceneName;
+		if (threadsCount != maxThreadsCount) {
+			name += "/threads" + std::to_string(threadsCount);
+		}
+		runBenchmark(settings, name, pixelsCount, "pixels", [&]() {
+			return (long long)(rayTracer.renderImage("render/bench.ppm", options));
+		});
+	}
+
+	if (withThreadScaling) {
+		RenderOptions options;
+		options.rayPackets = false;
+		runBenchmark(settings, std::string("render/") + sceneName + "/singleRays", pixelsCount, "pixels", [&]() {
+			return (long long)(rayTracer.renderImage("render/bench.ppm", options));
+		});
+	}
+}
+
+/// Parses the command line into the benchmark settings
+/// @return False if the command line is invalid
+static bool parseArgs(int argc, char *argv[], BenchSettings &settings) {
+	for (int i = 1; i < argc; i++) {
+		const bool hasValue = i + 1 < argc;
+		if (strcmp(argv[i], "--out") == 0 && hasValue) {
+			settings.outputPath = argv[++i];
+		} else if (strcmp(argv[i], "--filter") == 0 && hasValue) {
+			settings.filter = argv[++i];
+		} else if (strcmp(argv[i], "--warmup") == 0 && hasValue) {
+			settings.warmupsCount = getMax(0, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--repeat") == 0 && hasValue) {
+			settings.repeatsCount = getMax(1, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--isa") == 0 && hasValue) {
+			if (!CpuUtils::parseIsaLevel(argv[++i], settings.isaLevel)) {
+				return false;
+			}
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	BenchSettings settings;
+	if (!parseArgs(argc, argv, settings)) {
+		std::cout << "Usage: " << argv[0] << " [--out results.json] [--filter name] [--warmup N] [--repeat N]"
+			<< " [--isa scalar|sse4.2|avx2|avx512]\n";
+		return 1;
+	}
+	if (!CpuUtils::setIsaLevel(settings.isaLevel)) {
+		std::cout << "The CPU doesn't support " << CpuUtils::getIsaLevelName(settings.isaLevel) << "\n";
+		return 1;
+	}
+	std::cout << "Kernels: " << CpuUtils::getIsaLevelName(CpuUtils::getIsaLevel()) << "\n";
+
+	// Microbenchmarks
+	benchTriangleIntersection(settings, "scenes/scene3.crtscene");
+	benchVec3f(settings);
+	benchJsonLoading(settings, "scenes/scene3.crtscene");
+	benchPrimaryRays(settings, "scenes/scene3.crtscene");
+	benchBvhBuild(settings, "scenes/scene3.crtscene");
+	benchBvhLayout(settings, "scenes/scene3.crtscene");
+	benchSpatialSplits(settings);
+
+	// Whole scene regression runs
+	benchRender(settings, "scene0", false);
+	benchRender(settings, "scene1", false);
+	benchRender(settings, "scene2", false);
+	benchRender(settings, "scene3", true);
+
+	if (!writeResults(settings)) {
+		std::cout << "Failed to write the results to " << settings.outputPath << "\n";
+		return 1;
+	}
+	std::cout << "Results written to " << settings.outputPath << "\n";
+
+	return 0;
+}
\ No newline at end of file
@@ -1,2 +1,2 @@
 #!/bin/bash
-g++ -o 00.exe -I . prob00.cpp Camera.cpp Light.cpp Mesh.cpp RayTracer.cpp Scene.cpp utils/MathUtils.cpp utils/StringUtils.cpp utils/JsonUtils.cpp
\ No newline at end of file
+g++ -pthread -o 00.exe -I . prob00.cpp Bvh.cpp BvhBuild.cpp Camera.cpp InstanceBvh.cpp Light.cpp Mesh.cpp MeshInstance.cpp RayTracer.cpp Scene.cpp SceneJsonHandler.cpp TrianglePacket.cpp utils/CpuUtils.cpp utils/FileUtils.cpp utils/MathUtils.cpp utils/ProfileUtils.cpp utils/StringUtils.cpp utils/JsonUtils.cpp "$@"
\ No newline at end of file
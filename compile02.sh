@@ -1,2 +1,2 @@
 #!/bin/bash
-g++ -O3 -o 02.exe -I . prob02.cpp Camera.cpp Light.cpp Mesh.cpp RayTracer.cpp Scene.cpp utils/MathUtils.cpp utils/StringUtils.cpp utils/JsonUtils.cpp
\ No newline at end of file
+g++ -O3 -pthread -o 02.exe -I . prob02.cpp Bvh.cpp BvhBuild.cpp Camera.cpp InstanceBvh.cpp Light.cpp Mesh.cpp MeshInstance.cpp RayTracer.cpp Scene.cpp SceneJsonHandler.cpp TrianglePacket.cpp utils/CpuUtils.cpp utils/FileUtils.cpp utils/MathUtils.cpp utils/ProfileUtils.cpp utils/StringUtils.cpp utils/JsonUtils.cpp "$@"
\ No newline at end of file
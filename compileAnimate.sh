@@ -0,0 +1,2 @@
+#!/bin/bash
+g++ -O3 -pthread -o animate.exe -I . animate.cpp Bvh.cpp BvhBuild.cpp Camera.cpp InstanceBvh.cpp Light.cpp Mesh.cpp MeshInstance.cpp RayTracer.cpp Scene.cpp SceneJsonHandler.cpp TrianglePacket.cpp utils/CpuUtils.cpp utils/FileUtils.cpp utils/MathUtils.cpp utils/ProfileUtils.cpp utils/StringUtils.cpp utils/JsonUtils.cpp "$@"
\ No newline at end of file
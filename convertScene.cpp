@@ -0,0 +1,23 @@
+#include "Scene.h"
+
+#include <iostream>
+
+/// Converts a JSON scene file (.crtscene) to a binary scene file (.crtbin)
+int main(int argc, char **argv) {
+	if (argc != 3) {
+		std::cout << "Usage: " << argv[0] << " <input.crtscene> <output.crtbin>\n";
+		return 1;
+	}
+
+	Scene scene;
+	if (!scene.readFromJsonFile(argv[1])) {
+		std::cout << "Error: Cannot read scene " << argv[1] << "\n";
+		return 1;
+	}
+	if (!scene.writeToBinaryFile(argv[2])) {
+		std::cout << "Error: Cannot write binary scene " << argv[2] << "\n";
+		return 1;
+	}
+
+	return 0;
+}
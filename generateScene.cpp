@@ -0,0 +1,287 @@
+#include "Scene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+
+/// Ways in which the triangles of a generated scene are distributed
+enum class Distribution {
+	/// Small triangles spread uniformly over the whole scene
+	Soup,
+	/// Small triangles packed densely around a few cluster centers
+	Clusters,
+	/// Long and thin triangles spread over the whole scene, which overlap many others and have large bounding boxes
+	Thin,
+	/// Instances of a single mesh, moved and scaled to random places in the scene
+	Instances
+};
+
+/// Settings of a generated scene, set from the command line
+struct GeneratorSettings {
+	/// Path to the output file, a .crtbin extension writes a binary scene, anything else a JSON scene
+	std::string outputPath;
+	/// Total number of triangles over all objects
+	int trianglesCount = 100000;
+	/// Number of objects, the triangles are split evenly between them.
+	/// With instances, the number of instances of a single object which has the triangles of one of them.
+	int objectsCount = 1;
+	/// Number of lights
+	int lightsCount = 1;
+	/// Distribution of the triangles
+	Distribution distribution = Distribution::Soup;
+	/// Seed of the random generator, the same settings and seed give the same scene
+	unsigned seed = 1;
+	/// Resolution of the image
+	Vec2i imageResolution = { 1920, 1080 };
+};
+
+/// Region in front of the camera which the generated triangles fill.
+/// The camera is at the origin looking down -Z, and sees all of it.
+static const BoundingBox sceneRegion = { { -8.f, -4.5f, -28.f }, { 8.f, 4.5f, -10.f } };
+
+/// Random generator of the scene
+struct SceneRandom {
+	SceneRandom(unsigned seed)
+		: engine(seed)
+	{}
+
+	/// Returns a random number in range [min, max)
+	float uniform(float min, float max) {
+		return std::uniform_real_distribution<float>(min, max)(engine);
+	}
+
+	/// Returns a random point in a box
+	Vec3f pointInBox(const BoundingBox &box) {
+		return { uniform(box.min.x, box.max.x), uniform(box.min.y, box.max.y), uniform(box.min.z, box.max.z) };
+	}
+
+	/// Returns a random unit vector
+	Vec3f direction() {
+		std::normal_distribution<float> normal(0.f, 1.f);
+		Vec3f dir = { normal(engine), normal(engine), normal(engine) };
+		while (dir.getLength() < 1e-6f) {
+			dir = { normal(engine), normal(engine), normal(engine) };
+		}
+		return dir.getNormal();
+	}
+
+	/// Returns a point around a center with normally distributed coordinates
+	Vec3f pointAround(const Vec3f &center, float sigma) {
+		std::normal_distribution<float> normal(0.f, sigma);
+		return center + Vec3f(normal(engine), normal(engine), normal(engine));
+	}
+
+	std::mt19937 engine;
+};
+
+/// Fills a mesh with unconnected triangles, 3 new vertices for each.
+/// Triangles are wound so that they face the camera, otherwise camera rays would go through half of them.
+/// @param[in] mesh The mesh to fill, its arrays are allocated
+/// @param[in] trianglesCount Number of triangles
+/// @param[in] makeTriangle Function that returns the 3 vertices of the next triangle
+template <typename MakeTriangle>
+static void fillMesh(Mesh &mesh, int trianglesCount, MakeTriangle makeTriangle) {
+	mesh.trianglesCount = trianglesCount;
+	mesh.triangles = new Vec3i[trianglesCount];
+	mesh.verticesCount = trianglesCount * 3;
+	mesh.vertices = new Vec3f[mesh.verticesCount];
+	for (int trIdx = 0; trIdx < trianglesCount; trIdx++) {
+		Vec3f a, b, c;
+		makeTriangle(a, b, c);
+		if (crossProduct(b - a, c - a).z < 0.f) {
+			std::swap(b, c);
+		}
+		mesh.vertices[trIdx * 3 + 0] = a;
+		mesh.vertices[trIdx * 3 + 1] = b;
+		mesh.vertices[trIdx * 3 + 2] = c;
+		mesh.triangles[trIdx] = { trIdx * 3 + 0, trIdx * 3 + 1, trIdx * 3 + 2 };
+	}
+}
+
+/// Generates the objects of a scene with triangles in some distribution
+static void generateObjects(const GeneratorSettings &settings, SceneRandom &random, Scene &scene) {
+	scene.objectsCount = settings.objectsCount;
+	scene.objects = new Mesh[scene.objectsCount];
+
+	const Vec3f regionSize = sceneRegion.max - sceneRegion.min;
+	const float regionVolume = regionSize.x * regionSize.y * regionSize.z;
+	// Size of triangles, so that they fill about as much of the region together regardless of their count
+	const float triangleSize = 2.f * std::cbrt(regionVolume / float(settings.trianglesCount));
+
+	// The first objects get one triangle more when the triangles can't be split evenly
+	auto getObjectTrianglesCount = [&settings](int objIdx) {
+		return settings.trianglesCount / settings.objectsCount + (objIdx < settings.trianglesCount % settings.objectsCount ? 1 : 0);
+	};
+	auto makeSmallTriangle = [&random](const Vec3f &center, float size, Vec3f &a, Vec3f &b, Vec3f &c) {
+		a = center + random.direction() * (size * 0.5f);
+		b = center + random.direction() * (size * 0.5f);
+		c = center + random.direction() * (size * 0.5f);
+	};
+
+	switch (settings.distribution) {
+	case Distribution::Soup:
+		for (int objIdx = 0; objIdx < scene.objectsCount; objIdx++) {
+			fillMesh(scene.objects[objIdx], getObjectTrianglesCount(objIdx), [&](Vec3f &a, Vec3f &b, Vec3f &c) {
+				makeSmallTriangle(random.pointInBox(sceneRegion), triangleSize, a, b, c);
+			});
+		}
+		break;
+	case Distribution::Clusters: {
+		// A few clusters per object, each one much denser than the soup
+		const int clustersPerObject = 4;
+		const float clusterSigma = regionSize.y * 0.04f;
+		for (int objIdx = 0; objIdx < scene.objectsCount; objIdx++) {
+			Vec3f clusterCenters[clustersPerObject];
+			for (Vec3f &center : clusterCenters) {
+				center = random.pointInBox(sceneRegion);
+			}
+			int trIdx = 0;
+			fillMesh(scene.objects[objIdx], getObjectTrianglesCount(objIdx), [&](Vec3f &a, Vec3f &b, Vec3f &c) {
+				const Vec3f &center = clusterCenters[trIdx++ % clustersPerObject];
+				makeSmallTriangle(random.pointAround(center, clusterSigma), triangleSize * 0.2f, a, b, c);
+			});
+		}
+		break;
+	}
+	case Distribution::Thin: {
+		// As long as a tenth of the region, and as wide as a small fraction of the soup's triangles
+		const float length = regionSize.x * 0.1f;
+		const float width = triangleSize * 0.02f;
+		for (int objIdx = 0; objIdx < scene.objectsCount; objIdx++) {
+			fillMesh(scene.objects[objIdx], getObjectTrianglesCount(objIdx), [&](Vec3f &a, Vec3f &b, Vec3f &c) {
+				const Vec3f center = random.pointInBox(sceneRegion);
+				const Vec3f dir = random.direction();
+				a = center - dir * (length * 0.5f);
+				b = center + dir * (length * 0.5f);
+				c = center + random.direction() * width;
+			});
+		}
+		break;
+	}
+	case Distribution::Instances: {
+		// A single cluster of triangles around the origin, placed as many times as there are objects.
+		// The scene stores the cluster once, so it has a single object.
+		const float baseSize = regionSize.y * 0.1f;
+		const int instancesCount = scene.objectsCount;
+		delete[] scene.objects;
+		scene.objectsCount = 1;
+		scene.objects = new Mesh[1];
+		fillMesh(scene.objects[0], getObjectTrianglesCount(0), [&](Vec3f &a, Vec3f &b, Vec3f &c) {
+			makeSmallTriangle(random.pointAround({ 0.f, 0.f, 0.f }, baseSize * 0.3f), baseSize * 0.2f, a, b, c);
+		});
+		scene.instancesCount = instancesCount;
+		scene.instances = new MeshInstance[instancesCount];
+		for (int instIdx = 0; instIdx < instancesCount; instIdx++) {
+			const Vec3f offset = random.pointInBox(sceneRegion);
+			const float scale = random.uniform(0.5f, 2.f);
+			scene.instances[instIdx] = MeshInstance(0, Matrix3f(
+				{ scale, 0.f, 0.f },
+				{ 0.f, scale, 0.f },
+				{ 0.f, 0.f, scale }
+			), offset);
+		}
+		break;
+	}
+	}
+}
+
+/// Generates the lights of a scene, above and in front of the generated triangles
+static void generateLights(const GeneratorSettings &settings, SceneRandom &random, Scene &scene) {
+	scene.lightsCount = settings.lightsCount;
+	scene.lights = new Light[scene.lightsCount];
+	const BoundingBox lightsRegion = {
+		{ sceneRegion.min.x, sceneRegion.max.y, sceneRegion.min.z },
+		{ sceneRegion.max.x, sceneRegion.max.y * 2.f, sceneRegion.max.z * 0.5f }
+	};
+	for (int lIdx = 0; lIdx < scene.lightsCount; lIdx++) {
+		// Light intensity falls off with the squared distance, and the farthest triangles are about 30 units away
+		const float intensity = 4000.f / float(scene.lightsCount);
+		const Color albedo = { random.uniform(0.5f, 1.f), random.uniform(0.5f, 1.f), random.uniform(0.5f, 1.f) };
+		scene.lights[lIdx] = Light(random.pointInBox(lightsRegion), intensity, albedo);
+	}
+}
+
+/// Parses the name of a distribution
+/// @return False if there is no distribution with that name
+static bool parseDistribution(const char *name, Distribution &distribution) {
+	static const std::pair<const char *, Distribution> distributions[] = {
+		{ "soup", Distribution::Soup },
+		{ "clusters", Distribution::Clusters },
+		{ "thin", Distribution::Thin },
+		{ "instances", Distribution::Instances }
+	};
+	for (const std::pair<const char *, Distribution> &entry : distributions) {
+		if (strcmp(name, entry.first) == 0) {
+			distribution = entry.second;
+			return true;
+		}
+	}
+	return false;
+}
+
+/// Parses the command line into the generator settings
+/// @return False if the command line is invalid
+static bool parseArgs(int argc, char **argv, GeneratorSettings &settings) {
+	if (argc < 2) {
+		return false;
+	}
+	settings.outputPath = argv[1];
+	for (int i = 2; i < argc; i++) {
+		const bool hasValue = i + 1 < argc;
+		if (strcmp(argv[i], "--triangles") == 0 && hasValue) {
+			settings.trianglesCount = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--objects") == 0 && hasValue) {
+			settings.objectsCount = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--lights") == 0 && hasValue) {
+			settings.lightsCount = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--distribution") == 0 && hasValue) {
+			if (!parseDistribution(argv[++i], settings.distribution)) {
+				return false;
+			}
+		} else if (strcmp(argv[i], "--seed") == 0 && hasValue) {
+			settings.seed = unsigned(atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--resolution") == 0 && i + 2 < argc) {
+			settings.imageResolution.x = atoi(argv[++i]);
+			settings.imageResolution.y = atoi(argv[++i]);
+		} else {
+			return false;
+		}
+	}
+	return settings.trianglesCount >= settings.objectsCount && settings.objectsCount > 0 && settings.lightsCount >= 0
+		&& settings.imageResolution.x > 0 && settings.imageResolution.y > 0;
+}
+
+/// Generates a scene with a configurable number of triangles, objects and lights,
+/// and writes it to a JSON (.crtscene) or a binary (.crtbin) scene file
+int main(int argc, char **argv) {
+	GeneratorSettings settings;
+	if (!parseArgs(argc, argv, settings)) {
+		std::cout << "Usage: " << argv[0] << " <output.crtscene|output.crtbin>"
+			<< " [--triangles N] [--objects N] [--lights N]"
+			<< " [--distribution soup|clusters|thin|instances] [--seed N] [--resolution W H]\n";
+		return 1;
+	}
+
+	SceneRandom random(settings.seed);
+	Scene scene;
+	scene.imageResolution = settings.imageResolution;
+	scene.backgroundColor = { 0.1f, 0.1f, 0.15f };
+	generateObjects(settings, random, scene);
+	generateLights(settings, random, scene);
+
+	const std::string &path = settings.outputPath;
+	const std::string binaryExtension = ".crtbin";
+	const bool isBinary = path.size() >= binaryExtension.size()
+		&& path.compare(path.size() - binaryExtension.size(), binaryExtension.size(), binaryExtension) == 0;
+	const bool success = isBinary ? scene.writeToBinaryFile(path) : scene.writeToJsonFile(path);
+	if (!success) {
+		std::cout << "Error: Cannot write scene " << path << "\n";
+		return 1;
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -2,14 +2,23 @@
 #include "Scene.h"
 
 #include "utils/JsonUtils.h"
+#include "utils/ProfileUtils.h"
 
 int main() {
 	Scene scene;
-	rapidjson::Document jsonDoc = JsonUtils::readJsonDocument("scenes/scene3.crtscene");
-	scene.readFromJson(jsonDoc);
+	JsonUtils::MappedJsonDocument jsonDoc("scenes/scene3.crtscene");
+	if (!jsonDoc.isParsed || !scene.readFromJson(jsonDoc.doc)) {
+		return 1;
+	}
 
 	RayTracer rayTracer(scene);
-	rayTracer.renderImage("render/03.ppm");
+	RenderOptions options;
+	options.printStats = true;
+	rayTracer.renderImage("render/03.ppm", options);
+
+	// Only does something when built with ENABLE_PROFILING
+	ProfileUtils::printSummary();
+	ProfileUtils::writeChromeTrace("render/03.trace.json");
 
 	return 0;
 }
\ No newline at end of file
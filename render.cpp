@@ -0,0 +1,150 @@
+#include "RayTracer.h"
+#include "Scene.h"
+
+#include "utils/CpuUtils.h"
+#include "utils/ProfileUtils.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+/// Settings of a render, set from the command line
+struct RenderSettings {
+	/// Path to the scene file, a .crtbin extension reads a binary scene, anything else a JSON scene
+	std::string scenePath;
+	/// Path to the output image file
+	std::string outputPath;
+	/// Resolution overriding the scene's one, if it is positive
+	Vec2i resolution = { 0, 0 };
+	/// Path to a Chrome trace file, if it is not empty
+	std::string tracePath;
+	/// Options passed to the ray tracer
+	RenderOptions options;
+	/// Path to the heatmap image, kept here because the options only point to it
+	std::string heatmapPath;
+	/// Instruction set level forced for the kernels, if it is set
+	bool forceIsaLevel = false;
+	CpuUtils::IsaLevel isaLevel = CpuUtils::IsaLevel::Scalar;
+	/// How the scene's hierarchy is built, with the same number of threads as the render
+	BvhBuildOptions bvhBuildOptions;
+};
+
+/// Checks if a string ends with some suffix
+static bool endsWith(const std::string &str, const std::string &suffix) {
+	return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/// Parses the command line into the render settings
+/// @return False if the command line is invalid
+static bool parseArgs(int argc, char **argv, RenderSettings &settings) {
+	if (argc < 3) {
+		return false;
+	}
+	settings.scenePath = argv[1];
+	settings.outputPath = argv[2];
+	for (int i = 3; i < argc; i++) {
+		const bool hasValue = i + 1 < argc;
+		if (strcmp(argv[i], "--resolution") == 0 && i + 2 < argc) {
+			settings.resolution.x = atoi(argv[++i]);
+			settings.resolution.y = atoi(argv[++i]);
+			if (settings.resolution.x <= 0 || settings.resolution.y <= 0) {
+				return false;
+			}
+		} else if (strcmp(argv[i], "--threads") == 0 && hasValue) {
+			settings.options.threadsCount = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--format") == 0 && hasValue) {
+			i++;
+			if (strcmp(argv[i], "p3") == 0) {
+				settings.options.imageFormat = ImageFormat::PpmText;
+			} else if (strcmp(argv[i], "p6") == 0) {
+				settings.options.imageFormat = ImageFormat::PpmBinary;
+			} else {
+				return false;
+			}
+		} else if (strcmp(argv[i], "--isa") == 0 && hasValue) {
+			if (!CpuUtils::parseIsaLevel(argv[++i], settings.isaLevel)) {
+				return false;
+			}
+			settings.forceIsaLevel = true;
+		} else if (strcmp(argv[i], "--bvh") == 0 && hasValue) {
+			if (!parseBvhBuildMode(argv[++i], settings.bvhBuildOptions.mode)) {
+				return false;
+			}
+		} else if (strcmp(argv[i], "--spatial-split-budget") == 0 && hasValue) {
+			settings.bvhBuildOptions.spatialSplitBudget = float(atof(argv[++i]));
+		} else if (strcmp(argv[i], "--bvh-layout") == 0 && hasValue) {
+			if (!parseBvhLayout(argv[++i], settings.bvhBuildOptions.layout)) {
+				return false;
+			}
+		} else if (strcmp(argv[i], "--bvh-cache") == 0 && hasValue) {
+			settings.bvhBuildOptions.cacheDirectory = argv[++i];
+		} else if (strcmp(argv[i], "--single-rays") == 0) {
+			settings.options.rayPackets = false;
+		} else if (strcmp(argv[i], "--stats") == 0) {
+			settings.options.printStats = true;
+		} else if (strcmp(argv[i], "--heatmap") == 0 && hasValue) {
+			settings.heatmapPath = argv[++i];
+		} else if (strcmp(argv[i], "--trace") == 0 && hasValue) {
+			settings.tracePath = argv[++i];
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+/// Renders a scene file to an image file, with the settings given on the command line
+int main(int argc, char **argv) {
+	RenderSettings settings;
+	if (!parseArgs(argc, argv, settings)) {
+		std::cout << "Usage: " << argv[0] << " <scene.crtscene|scene.crtbin> <output.ppm>"
+			<< " [--resolution W H] [--threads N] [--format p3|p6]"
+			<< " [--isa scalar|sse4.2|avx2|avx512] [--bvh sweep|binned|lbvh|sbvh] [--spatial-split-budget X] [--bvh-layout binary|wide] [--bvh-cache dir] [--single-rays] [--stats] [--heatmap heatmap.ppm] [--trace trace.json]\n";
+		return 1;
+	}
+	if (!settings.heatmapPath.empty()) {
+		settings.options.heatmapFilepath = settings.heatmapPath.c_str();
+	}
+	if (settings.forceIsaLevel && !CpuUtils::setIsaLevel(settings.isaLevel)) {
+		std::cout << "Error: The CPU doesn't support " << CpuUtils::getIsaLevelName(settings.isaLevel)
+			<< ", it supports up to " << CpuUtils::getIsaLevelName(CpuUtils::detectIsaLevel()) << "\n";
+		return 1;
+	}
+
+	Scene scene;
+	scene.bvhBuildOptions = settings.bvhBuildOptions;
+	scene.bvhBuildOptions.threadsCount = settings.options.threadsCount;
+	const bool sceneRead = endsWith(settings.scenePath, ".crtbin")
+		? scene.readFromBinaryFile(settings.scenePath)
+		: scene.readFromJsonFile(settings.scenePath);
+	if (!sceneRead) {
+		std::cout << "Error: Cannot read scene " << settings.scenePath << "\n";
+		return 1;
+	}
+	if (!settings.bvhBuildOptions.cacheDirectory.empty()) {
+		const BvhBuildStats &buildStats = scene.bvh.buildStats;
+		std::cout << "BVH cache " << settings.bvhBuildOptions.cacheDirectory << ": " << buildStats.cacheHits << " hits, "
+			<< buildStats.cacheMisses << " misses, " << buildStats.seconds << "s to load and build\n";
+	}
+	if (settings.resolution.x > 0) {
+		scene.imageResolution = settings.resolution;
+		// Keep the pixels square when the aspect ratio changes
+		scene.camera.viewSize.y = scene.camera.viewSize.x * float(settings.resolution.y) / float(settings.resolution.x);
+	}
+
+	RayTracer rayTracer(scene);
+	if (!rayTracer.renderImage(settings.outputPath.c_str(), settings.options)) {
+		std::cout << "Error: Cannot render image " << settings.outputPath << "\n";
+		return 1;
+	}
+
+	if (!settings.tracePath.empty()) {
+		ProfileUtils::printSummary();
+		if (!ProfileUtils::writeChromeTrace(settings.tracePath)) {
+			std::cout << "Warning: Nothing was recorded for the trace, build with ENABLE_PROFILING to record it\n";
+		}
+	}
+
+	return 0;
+}
\ No newline at end of file
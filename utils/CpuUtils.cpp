@@ -0,0 +1,58 @@
+#include "CpuUtils.h"
+
+#include <cstring>
+
+namespace CpuUtils {
+
+IsaLevel detectIsaLevel() {
+#ifdef CPU_X86
+	// Also checks that the OS saves the AVX registers, not only that the CPU has them
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl")) {
+		return IsaLevel::Avx512;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		return IsaLevel::Avx2;
+	}
+	if (__builtin_cpu_supports("sse4.2")) {
+		return IsaLevel::Sse42;
+	}
+#endif
+	return IsaLevel::Scalar;
+}
+
+/// The level supported by the CPU, detected once at startup
+static const IsaLevel supportedIsaLevel = detectIsaLevel();
+/// The level used by the kernels
+static IsaLevel currentIsaLevel = supportedIsaLevel;
+
+IsaLevel getIsaLevel() {
+	return currentIsaLevel;
+}
+
+bool setIsaLevel(IsaLevel level) {
+	if (int(level) > int(supportedIsaLevel)) {
+		return false;
+	}
+	currentIsaLevel = level;
+	return true;
+}
+
+/// Names of the levels, in the order of the enum
+static const char *isaLevelNames[] = { "scalar", "sse4.2", "avx2", "avx512" };
+
+const char *getIsaLevelName(IsaLevel level) {
+	return isaLevelNames[int(level)];
+}
+
+bool parseIsaLevel(const char *name, IsaLevel &level) {
+	for (int i = 0; i < int(sizeof(isaLevelNames) / sizeof(isaLevelNames[0])); i++) {
+		if (strcmp(name, isaLevelNames[i]) == 0) {
+			level = IsaLevel(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace CpuUtils
\ No newline at end of file
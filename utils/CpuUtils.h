@@ -0,0 +1,58 @@
+#pragma once
+
+/// Selection of the instruction set used by the hot kernels at runtime.
+/// The kernels are compiled for several instruction set levels in the same binary,
+/// each with the target attribute of its level, and the best level the CPU supports is picked at startup.
+/// So a single build runs on old CPUs and still uses AVX2 or AVX-512 on new ones.
+namespace CpuUtils {
+
+/// Instruction set levels for which the kernels are compiled, from the oldest to the newest
+enum class IsaLevel {
+	/// Plain C++ without intrinsics, runs on any CPU
+	Scalar,
+	/// SSE up to SSE4.2, 4 floats per register
+	Sse42,
+	/// AVX2, 8 floats per register
+	Avx2,
+	/// AVX-512 F and VL, 8 floats per register with mask registers, or 16 floats
+	Avx512
+};
+
+/// Empty type for each level, to pick overloads of a kernel at compile time
+template<IsaLevel level>
+struct IsaTag {};
+
+/// Returns the newest level supported by the CPU running the program
+IsaLevel detectIsaLevel();
+
+/// Returns the level used by the kernels, which is the detected one unless it is overridden
+IsaLevel getIsaLevel();
+
+/// Overrides the level used by the kernels, for benchmarks and for narrowing down bugs to a kernel
+/// @param[in] level The level to be used
+/// @return False if the CPU doesn't support the level, then the current level is kept
+bool setIsaLevel(IsaLevel level);
+
+/// Returns the name of a level, as accepted by parseIsaLevel
+const char *getIsaLevelName(IsaLevel level);
+
+/// Parses the name of a level: scalar, sse4.2, avx2 or avx512
+/// @param[in] name Name of the level
+/// @param[out] level The parsed level
+/// @return False if the name is unknown
+bool parseIsaLevel(const char *name, IsaLevel &level);
+
+} // namespace CpuUtils
+
+// Attributes compiling a function for a level.
+// Only x86 has the SIMD levels, elsewhere everything runs the scalar kernels.
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_X86
+#define CPU_TARGET_SSE42 __attribute__((target("sse4.2")))
+#define CPU_TARGET_AVX2 __attribute__((target("avx2")))
+// AVX-512 F includes fused multiply-adds, which would round differently from the other levels
+#define CPU_TARGET_AVX512 __attribute__((target("avx512f,avx512vl"), optimize("fp-contract=off")))
+#endif
+
+/// Forces a function to be inlined, so that it is compiled for the level of each function calling it
+#define CPU_FORCE_INLINE inline __attribute__((always_inline))
\ No newline at end of file
@@ -0,0 +1,119 @@
+#include "FileUtils.h"
+
+#include <cstdio>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <direct.h>
+#include <sys/stat.h>
+#endif
+
+namespace FileUtils {
+
+/// Reads a whole file into a new heap buffer followed by a null character
+/// @param[in] file Opened file
+/// @param[in] fileSize Size of the file
+/// @return The buffer, to be freed with delete[], or nullptr if the file couldn't be read
+static char *readFileToBuffer(FILE *file, size_t fileSize) {
+	char *buffer = new char[fileSize + 1];
+	const size_t readSize = fread(buffer, 1, fileSize, file);
+	if (readSize != fileSize) {
+		delete[] buffer;
+		return nullptr;
+	}
+	buffer[readSize] = '\0';
+	return buffer;
+}
+
+bool MappedFile::map(const std::string &filepath, bool nullTerminated) {
+	unmap();
+
+#ifndef _WIN32
+	// Open the file and find its size
+	const int fd = open(filepath.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0) {
+		close(fd);
+		return false;
+	}
+	const size_t fileSize = size_t(fileStat.st_size);
+	const size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+	// The rest of the last page of a mapping is filled with zeros, so it has a null character after the contents,
+	// unless the file fills its last page completely.
+	if (fileSize > 0 && (!nullTerminated || fileSize % pageSize != 0)) {
+		void *mapping = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (mapping == MAP_FAILED) {
+			return false;
+		}
+		data = static_cast<char *>(mapping);
+		size = fileSize;
+		memorySize = fileSize;
+		isMapped = true;
+		return true;
+	}
+	FILE *file = fdopen(fd, "rb");
+	if (!file) {
+		close(fd);
+		return false;
+	}
+#else
+	FILE *file = fopen(filepath.c_str(), "rb");
+	if (!file) {
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	const size_t fileSize = size_t(ftell(file));
+	fseek(file, 0, SEEK_SET);
+#endif
+
+	data = readFileToBuffer(file, fileSize);
+	fclose(file);
+	if (!data) {
+		return false;
+	}
+	size = fileSize;
+	memorySize = fileSize + 1;
+	isMapped = false;
+	return true;
+}
+
+void MappedFile::unmap() {
+	if (!data) {
+		return;
+	}
+#ifndef _WIN32
+	if (isMapped) {
+		munmap(data, memorySize);
+	} else {
+		delete[] data;
+	}
+#else
+	delete[] data;
+#endif
+	data = nullptr;
+	size = 0;
+	memorySize = 0;
+	isMapped = false;
+}
+
+bool createDirectory(const std::string &path) {
+#ifndef _WIN32
+	mkdir(path.c_str(), 0755);
+	struct stat dirStat;
+	return stat(path.c_str(), &dirStat) == 0 && S_ISDIR(dirStat.st_mode);
+#else
+	_mkdir(path.c_str());
+	struct _stat dirStat;
+	return _stat(path.c_str(), &dirStat) == 0 && (dirStat.st_mode & _S_IFDIR) != 0;
+#endif
+}
+
+} // namespace FileUtils
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace FileUtils {
+
+/// Whole file mapped to memory copy-on-write.
+/// Writes to the memory are private to the process and never reach the file.
+/// Where memory mapping is not available, the file is read into a heap buffer instead.
+struct MappedFile {
+	/// Maps a file to memory. Unmaps the previously mapped file, if any.
+	/// @param[in] filepath Path to the file
+	/// @param[in] nullTerminated If true, the memory is guaranteed to have a null character after the file's contents
+	/// @return True on success
+	bool map(const std::string &filepath, bool nullTerminated = false);
+
+	/// Unmaps the file and frees its memory
+	void unmap();
+
+	/// Memory holding the file's contents
+	char *data = nullptr;
+	/// Size of the file's contents
+	size_t size = 0;
+
+private: /* variables */
+	/// Indicates whether the memory is a mapping of the file or a heap copy of it
+	bool isMapped = false;
+	/// Size of the mapping or the heap copy
+	size_t memorySize = 0;
+};
+
+/// Creates a directory, if it doesn't exist yet. The parent directory has to exist.
+/// @param[in] path Path to the directory
+/// @return True if the directory exists afterwards
+bool createDirectory(const std::string &path);
+
+} // namespace FileUtils
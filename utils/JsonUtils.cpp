@@ -1,4 +1,5 @@
 #include "JsonUtils.h"
+#include "ProfileUtils.h"
 
 #include "rapidjson/istreamwrapper.h"
 #include <fstream>
@@ -7,6 +8,7 @@
 namespace JsonUtils {
 
 rapidjson::Document readJsonDocument(const std::string &filepath) {
+	PROFILE_SCOPE("JsonUtils::readJsonDocument");
     // Open the file
 	std::ifstream ifs(filepath);
 	assert(ifs.is_open());
@@ -26,6 +28,39 @@ rapidjson::Document readJsonDocument(const std::string &filepath) {
 	return doc;
 }
 
+MappedJsonDocument::MappedJsonDocument(const std::string &filepath) {
+	PROFILE_SCOPE("JsonUtils::MappedJsonDocument");
+	// Map the file copy-on-write, so that the in situ parsing doesn't modify the file itself.
+	// In situ parsing needs a null character after the contents.
+	if (!file.map(filepath, true)) {
+		std::cout << "Error: Couldn't read the file " << filepath << "\n";
+		return;
+	}
+
+	// Parse the document directly in the file's memory
+	doc.ParseInsitu(file.data);
+	// Check for error
+	if (doc.HasParseError()) {
+		std::cout << "Error: " << doc.GetParseError() << "\n";
+		std::cout << "Offset: " << doc.GetErrorOffset() << "\n";
+		doc.SetNull();
+		return;
+	}
+	if (!doc.IsObject()) {
+		std::cout << "Error: The file " << filepath << " doesn't contain a JSON object\n";
+		doc.SetNull();
+		return;
+	}
+	isParsed = true;
+}
+
+MappedJsonDocument::~MappedJsonDocument() {
+	// Free the document before the memory its strings point to
+	doc.SetNull();
+	doc.GetAllocator().Clear();
+	file.unmap();
+}
+
 Vec3f getVec3fFromJsonArr(const rapidjson::Value::ConstArray &arr) {
 	assert(arr.Size() == 3);
 	assert(arr[0].IsNumber() && arr[1].IsNumber() && arr[2].IsNumber());
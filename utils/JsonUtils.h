@@ -1,6 +1,7 @@
 #pragma once
 
 #include "MathUtils.h"
+#include "FileUtils.h"
 
 #include "rapidjson/document.h"
 
@@ -11,6 +12,32 @@ namespace JsonUtils {
 /// Reads a JSON document from a file
 rapidjson::Document readJsonDocument(const std::string &filepath);
 
+/// JSON document parsed in situ from a memory mapped file.
+/// The file is mapped copy-on-write and parsed directly in the mapped memory,
+/// without reading it through a stream and without copying its strings.
+/// Strings in the document point into the mapped memory, so it is kept alive together with the document.
+struct MappedJsonDocument {
+	/// Maps a file to memory and parses it as a JSON document.
+	/// If the file can't be read or isn't a JSON object, the error is printed and the document is left null.
+	/// @param[in] filepath Path to the JSON file
+	MappedJsonDocument(const std::string &filepath);
+
+	/// Frees the document and unmaps the file
+	~MappedJsonDocument();
+
+	MappedJsonDocument(const MappedJsonDocument &) = delete;
+	MappedJsonDocument& operator=(const MappedJsonDocument &) = delete;
+
+	/// The parsed JSON document
+	rapidjson::Document doc;
+	/// Indicates whether the file was read and parsed into a JSON object, callers check it before using the document
+	bool isParsed = false;
+
+private: /* variables */
+	/// The mapped file, which holds the document's strings
+	FileUtils::MappedFile file;
+};
+
 /// Extracts a Vector of 3 floats from a JSON array
 Vec3f getVec3fFromJsonArr(const rapidjson::Value::ConstArray &arr);
 
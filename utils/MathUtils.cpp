@@ -4,106 +4,8 @@
 
 namespace MathUtils {
 
-// Function definitions for Vec2f
-
-float Vec2f::getLength() const {
-    return sqrtf(x * x + y * y);
-}
-
-Vec2f Vec2f::getNormal() const {
-    const float length = getLength();
-    if (isApproxZero(length)) {
-        return { 0.f, 0.f };
-    }
-    return { x / length, y / length };
-}
-
-void Vec2f::normalize() {
-    *this = getNormal();
-}
-
-Vec2f Vec2f::operator+(const Vec2f &rhs) const {
-    return { x + rhs.x, y + rhs.y };
-}
-
-Vec2f& Vec2f::operator+=(const Vec2f &rhs) {
-    *this = *this + rhs;
-    return *this;
-}
-
-Vec2f Vec2f::operator-(const Vec2f &rhs) const {
-    return { x - rhs.x, y - rhs.y };
-}
-
-Vec2f& Vec2f::operator-=(const Vec2f &rhs) {
-    *this = *this - rhs;
-    return *this;
-}
-
-Vec2f Vec2f::operator*(float scalar) const {
-    return { x * scalar, y * scalar };
-}
-
-Vec2f& Vec2f::operator*=(float scalar) {
-    *this = *this * scalar;
-    return *this;
-}
-
-// Function definitions for Vec3f
-
-float Vec3f::getLength() const {
-    return sqrtf(x * x + y * y + z * z);
-}
-
-Vec3f Vec3f::getNormal() const {
-    const float length = getLength();
-    if (isApproxZero(length)) {
-        return { 0.f, 0.f, 0.f };
-    }
-    return { x / length, y / length, z / length };
-}
-
-void Vec3f::normalize() {
-    *this = getNormal();
-}
-
-Vec3f Vec3f::operator+(const Vec3f &rhs) const {
-    return { x + rhs.x, y + rhs.y, z + rhs.z };
-}
-
-Vec3f& Vec3f::operator+=(const Vec3f &rhs) {
-    *this = *this + rhs;
-    return *this;
-}
-
-Vec3f Vec3f::operator-(const Vec3f &rhs) const {
-    return { x - rhs.x, y - rhs.y, z - rhs.z };
-}
-
-Vec3f& Vec3f::operator-=(const Vec3f &rhs) {
-    *this = *this - rhs;
-    return *this;
-}
-
-Vec3f Vec3f::operator*(float scalar) const {
-    return { x * scalar, y * scalar, z * scalar };
-}
-
-Vec3f& Vec3f::operator*=(float scalar) {
-    *this = *this * scalar;
-    return *this;
-}
-
 // Function definitions for Matrix3f
 
-Vec3f Matrix3f::operator*(const Vec3f &vec) const {
-    return {
-        xCol.x * vec.x + yCol.x * vec.y + zCol.x * vec.z,
-        xCol.y * vec.x + yCol.y * vec.y + zCol.y * vec.z,
-        xCol.z * vec.x + yCol.z * vec.y + zCol.z * vec.z,
-    };
-}
-
 Matrix3f Matrix3f::operator*(const Matrix3f &other) const {
     return Matrix3f(
         {
@@ -129,23 +31,25 @@ Matrix3f& Matrix3f::operator*=(const Matrix3f &other) {
     return *this;
 }
 
-// Global function definitions
-
-Vec3f crossProduct(const Vec3f &lhs, const Vec3f &rhs) {
-	return {
-		lhs.y * rhs.z - lhs.z * rhs.y,
-		lhs.z * rhs.x - lhs.x * rhs.z,
-		lhs.x * rhs.y - lhs.y * rhs.x,
-	};
+Matrix3f Matrix3f::getTranspose() const {
+    return Matrix3f(
+        { xCol.x, yCol.x, zCol.x },
+        { xCol.y, yCol.y, zCol.y },
+        { xCol.z, yCol.z, zCol.z }
+    );
 }
 
-float dotProduct(const Vec2f &lhs, const Vec2f &rhs) {
-	return lhs.x * rhs.x + lhs.y * rhs.y;
+Matrix3f Matrix3f::getInverse() const {
+    // The rows of the inverse are the cross products of pairs of columns, divided by the determinant
+    const float invDet = 1.f / dotProduct(xCol, crossProduct(yCol, zCol));
+    return Matrix3f(
+        crossProduct(yCol, zCol) * invDet,
+        crossProduct(zCol, xCol) * invDet,
+        crossProduct(xCol, yCol) * invDet
+    ).getTranspose();
 }
 
-float dotProduct(const Vec3f &lhs, const Vec3f &rhs) {
-	return lhs.x * rhs.x + lhs.y * rhs.y + lhs.z * rhs.z;
-}
+// Global function definitions
 
 Vec3f getTriangleNormal(Vec3f aVertex, Vec3f bVertex, Vec3f cVertex) {
 	return crossProduct(
@@ -161,12 +65,19 @@ float getTriangleArea(Vec3f aVertex, Vec3f bVertex, Vec3f cVertex) {
 	).getLength() / 2.f;
 }
 
-bool isApprox(float lhs, float rhs, float epsilon) {
-	return fabsf(lhs - rhs) < epsilon;
-}
-
-bool isApproxZero(float x, float epsilon) {
-	return fabsf(x) < epsilon;
+PrecomputedTriangle precomputeTriangle(const Vec3f &aVert, const Vec3f &bVert, const Vec3f &cVert) {
+    PrecomputedTriangle triangle;
+    triangle.normal = getTriangleNormal(aVert, bVert, cVert);
+    triangle.planeDist = dotProduct(aVert, triangle.normal);
+    // A point P is on the inner side of edge AB if dot(N, cross(B - A, P - A)) >= 0,
+    // which is the same as dot(P, cross(N, B - A)) >= dot(A, cross(N, B - A))
+    triangle.edgeNormals[0] = crossProduct(triangle.normal, bVert - aVert);
+    triangle.edgeNormals[1] = crossProduct(triangle.normal, cVert - bVert);
+    triangle.edgeNormals[2] = crossProduct(triangle.normal, aVert - cVert);
+    triangle.edgeDists[0] = dotProduct(aVert, triangle.edgeNormals[0]);
+    triangle.edgeDists[1] = dotProduct(bVert, triangle.edgeNormals[1]);
+    triangle.edgeDists[2] = dotProduct(cVert, triangle.edgeNormals[2]);
+    return triangle;
 }
 
 RayTriangleIntersectionResult rayTriangleIntersection(
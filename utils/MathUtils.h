@@ -1,14 +1,16 @@
 #pragma once
 
+#include <cmath>
+
 namespace MathUtils {
 
 /// Vector of 2 integer coordinates
 struct Vec2i {
     /// Creates a zero vector
-	Vec2i(){}
+	constexpr Vec2i(){}
 
     /// Creates a vector with some coordinates
-	Vec2i(int x, int y)
+	constexpr Vec2i(int x, int y)
 		: x(x), y(y)
 	{}
 
@@ -20,10 +22,10 @@ struct Vec2i {
 /// Vector of 2 float coordinates
 struct Vec2f {
     /// Creates a zero vector
-	Vec2f(){}
+	constexpr Vec2f(){}
 
     /// Creates a vector with some coordinates
-	Vec2f(float x, float y)
+	constexpr Vec2f(float x, float y)
 		: x(x), y(y)
 	{}
 
@@ -38,15 +40,15 @@ struct Vec2f {
     /// Normalizes the vector, changes it to have unit length
 	void normalize();
     /// Returns the sum of this vector and another vector
-	Vec2f operator+(const Vec2f &rhs) const;
+	constexpr Vec2f operator+(const Vec2f &rhs) const;
     /// Adds another vector to this vector
 	Vec2f& operator+=(const Vec2f &rhs);
     /// Returns the difference of this vector and another vector
-	Vec2f operator-(const Vec2f &rhs) const;
+	constexpr Vec2f operator-(const Vec2f &rhs) const;
     /// Subtracts another vector from this vector
 	Vec2f& operator-=(const Vec2f &rhs);
     /// Returns the result of scaling this vector by a number
-	Vec2f operator*(float scalar) const;
+	constexpr Vec2f operator*(float scalar) const;
     /// Returns the result of scaling this vector by a number
 	Vec2f& operator*=(float scalar);
 };
@@ -54,10 +56,10 @@ struct Vec2f {
 /// Vector of 3 integer coordinates
 struct Vec3i {
     /// Creates a zero vector
-	Vec3i(){}
+	constexpr Vec3i(){}
 
     /// Creates a vector with some coordinates
-	Vec3i(int x, int y, int z)
+	constexpr Vec3i(int x, int y, int z)
 		: x(x), y(y), z(z)
 	{}
 
@@ -70,10 +72,10 @@ struct Vec3i {
 /// Vector of 3 float coordinates
 struct Vec3f {
     /// Creates a zero vector
-	Vec3f(){}
+	constexpr Vec3f(){}
 
     /// Creates a vector with some coordinates
-	Vec3f(float x, float y, float z)
+	constexpr Vec3f(float x, float y, float z)
 		: x(x), y(y), z(z)
 	{}
 
@@ -89,15 +91,15 @@ struct Vec3f {
     /// Normalizes the vector, changes it to have unit length
 	void normalize();
     /// Returns the sum of this vector and another vector
-	Vec3f operator+(const Vec3f &rhs) const;
+	constexpr Vec3f operator+(const Vec3f &rhs) const;
     /// Adds another vector to this vector
 	Vec3f& operator+=(const Vec3f &rhs);
     /// Returns the difference of this vector and another vector
-	Vec3f operator-(const Vec3f &rhs) const;
+	constexpr Vec3f operator-(const Vec3f &rhs) const;
     /// Subtracts another vector from this vector
 	Vec3f& operator-=(const Vec3f &rhs);
     /// Returns the result of scaling this vector by a number
-	Vec3f operator*(float scalar) const;
+	constexpr Vec3f operator*(float scalar) const;
     /// Returns the result of scaling this vector by a number
 	Vec3f& operator*=(float scalar);
 };
@@ -109,10 +111,39 @@ typedef Vec3f Color;
 struct Ray {
 	/// Origin of the ray, a point in world space
 	Vec3f origin;
-	/// Direction of the ray, a normal vector
+	/// Direction of the ray, a normal vector.
+	/// Rays transformed to the space of an instanced mesh have the length the transformation gives them,
+	/// so that distances along them are the same as along the world space ray.
 	Vec3f direction;
 };
 
+/// Axis-aligned bounding box in 3D space
+struct BoundingBox {
+    /// Creates an empty bounding box, that doesn't contain any points
+	BoundingBox(){}
+
+    /// Creates a bounding box with given min and max corners
+	BoundingBox(const Vec3f &min, const Vec3f &max)
+		: min(min), max(max)
+	{}
+
+    /// Corner of the box with the minimum coordinates
+	Vec3f min = { 1e30f, 1e30f, 1e30f };
+    /// Corner of the box with the maximum coordinates
+	Vec3f max = { -1e30f, -1e30f, -1e30f };
+
+    /// Expands the box so that it contains a given point
+	void expand(const Vec3f &point);
+    /// Expands the box so that it contains another box
+	void expand(const BoundingBox &other);
+    /// Returns the center point of the box
+	Vec3f getCenter() const;
+    /// Calculates the surface area of the box. Returns 0 for an empty box.
+	float getSurfaceArea() const;
+    /// Returns the index of the axis (0, 1 or 2) along which the box is the largest
+	int getLargestAxis() const;
+};
+
 /// 3 by 3 matrix with float entries
 struct Matrix3f {
     /// Creates an identity matrix
@@ -138,16 +169,21 @@ struct Matrix3f {
 	Matrix3f operator*(const Matrix3f &other) const;
     /// Multiplies this matrix by another matrix.
     Matrix3f& operator*=(const Matrix3f &other);
+    /// Returns the transposed matrix, with the rows and the columns swapped
+	Matrix3f getTranspose() const;
+    /// Returns the inverse matrix, which undoes this matrix's transformation.
+    /// The matrix is expected to be invertible.
+	Matrix3f getInverse() const;
 };
 
 /// Computes the cross product of two 3D vectors
-Vec3f crossProduct(const Vec3f &lhs, const Vec3f &rhs);
+constexpr Vec3f crossProduct(const Vec3f &lhs, const Vec3f &rhs);
 
 /// Computes the dot product of two 2D vectors
-float dotProduct(const Vec2f &lhs, const Vec2f &rhs);
+constexpr float dotProduct(const Vec2f &lhs, const Vec2f &rhs);
 
 /// Computes the dot product of two 3D vectors
-float dotProduct(const Vec3f &lhs, const Vec3f &rhs);
+constexpr float dotProduct(const Vec3f &lhs, const Vec3f &rhs);
 
 /// Computes the normal vector of a triangle represented with its 3 vertices as points in world space.
 Vec3f getTriangleNormal(Vec3f aVertex, Vec3f bVertex, Vec3f cVertex);
@@ -163,6 +199,11 @@ bool isApprox(float lhs, float rhs, float epsilon = 0.0001f);
 /// Optionally an epsilon can be specified for the comparison.
 bool isApproxZero(float x, float epsilon = 0.0001f);
 
+/// Returns a coordinate of a vector by the index of its axis - 0 for X, 1 for Y and 2 for Z
+inline float getAxis(const Vec3f &vec, int axis) {
+	return (axis == 0) ? vec.x : ((axis == 1) ? vec.y : vec.z);
+}
+
 /// Returns the minimum of 2 values
 template <typename T>
 T getMin(T a, T b) {
@@ -187,6 +228,33 @@ struct RayTriangleIntersectionResult {
     bool frontSide = true;
 };
 
+/// Triangle data precomputed once, so that intersecting it with rays needs no normalization.
+/// The triangle is stored as its plane and the 3 planes through its edges, perpendicular to it,
+/// with normals pointing towards the inside of the triangle.
+struct PrecomputedTriangle {
+    /// Unit normal of the triangle
+    Vec3f normal;
+    /// Distance from the origin to the triangle's plane along the normal
+    float planeDist = 0.f;
+    /// Normals of the planes through the triangle's edges AB, BC and CA
+    Vec3f edgeNormals[3];
+    /// Distances from the origin to the planes through the triangle's edges
+    float edgeDists[3] = { 0.f, 0.f, 0.f };
+};
+
+/// Precomputes the data of a triangle needed for fast intersection with rays
+/// @param[in] aVert, bVert, cVert The vertices of the triangle
+/// @return The precomputed triangle
+PrecomputedTriangle precomputeTriangle(const Vec3f &aVert, const Vec3f &bVert, const Vec3f &cVert);
+
+/// Intersects a ray with a bounding box, using the slab method.
+/// @param[in] ray The ray to intersect with
+/// @param[in] invDirection Per-coordinate inverse of the ray's direction, precomputed once per ray
+/// @param[in] box The bounding box to be intersected
+/// @param[in] maxDist Intersections further than this distance along the ray are ignored
+/// @return True if the ray intersects the box between its origin and maxDist
+bool rayBoxIntersection(const Ray &ray, const Vec3f &invDirection, const BoundingBox &box, float maxDist);
+
 /// Intersects a ray with a triangle.
 /// Checks if the ray intersects the triangle and if it does, finds the intersection point.
 /// @param[in] aVert, bVert, cVert The vertices of the triangle to be intersected
@@ -199,4 +267,223 @@ RayTriangleIntersectionResult rayTriangleIntersection(
 	const Vec3f &cVert
 );
 
+/// Intersects a ray with a precomputed triangle.
+/// Gives the same result as rayTriangleIntersection, but does no normalization and no cross products.
+/// @param[in] ray The ray to intersect with
+/// @param[in] triangle The precomputed triangle to be intersected
+/// @return The result of the ray triangle intersection
+RayTriangleIntersectionResult rayTriangleIntersection(const Ray &ray, const PrecomputedTriangle &triangle);
+
+// The small functions below are called per ray and per triangle from other translation units,
+// so they are defined in the header where the compiler can inline them even without link time optimization.
+
+// Inline function definitions for Vec2f
+
+inline float Vec2f::getLength() const {
+    return sqrtf(x * x + y * y);
+}
+
+inline Vec2f Vec2f::getNormal() const {
+    const float length = getLength();
+    if (isApproxZero(length)) {
+        return { 0.f, 0.f };
+    }
+    return { x / length, y / length };
+}
+
+inline void Vec2f::normalize() {
+    *this = getNormal();
+}
+
+constexpr Vec2f Vec2f::operator+(const Vec2f &rhs) const {
+    return { x + rhs.x, y + rhs.y };
+}
+
+inline Vec2f& Vec2f::operator+=(const Vec2f &rhs) {
+    *this = *this + rhs;
+    return *this;
+}
+
+constexpr Vec2f Vec2f::operator-(const Vec2f &rhs) const {
+    return { x - rhs.x, y - rhs.y };
+}
+
+inline Vec2f& Vec2f::operator-=(const Vec2f &rhs) {
+    *this = *this - rhs;
+    return *this;
+}
+
+constexpr Vec2f Vec2f::operator*(float scalar) const {
+    return { x * scalar, y * scalar };
+}
+
+inline Vec2f& Vec2f::operator*=(float scalar) {
+    *this = *this * scalar;
+    return *this;
+}
+
+// Inline function definitions for Vec3f
+
+inline float Vec3f::getLength() const {
+    return sqrtf(x * x + y * y + z * z);
+}
+
+inline Vec3f Vec3f::getNormal() const {
+    const float length = getLength();
+    if (isApproxZero(length)) {
+        return { 0.f, 0.f, 0.f };
+    }
+    return { x / length, y / length, z / length };
+}
+
+inline void Vec3f::normalize() {
+    *this = getNormal();
+}
+
+constexpr Vec3f Vec3f::operator+(const Vec3f &rhs) const {
+    return { x + rhs.x, y + rhs.y, z + rhs.z };
+}
+
+inline Vec3f& Vec3f::operator+=(const Vec3f &rhs) {
+    *this = *this + rhs;
+    return *this;
+}
+
+constexpr Vec3f Vec3f::operator-(const Vec3f &rhs) const {
+    return { x - rhs.x, y - rhs.y, z - rhs.z };
+}
+
+inline Vec3f& Vec3f::operator-=(const Vec3f &rhs) {
+    *this = *this - rhs;
+    return *this;
+}
+
+constexpr Vec3f Vec3f::operator*(float scalar) const {
+    return { x * scalar, y * scalar, z * scalar };
+}
+
+inline Vec3f& Vec3f::operator*=(float scalar) {
+    *this = *this * scalar;
+    return *this;
+}
+
+// Inline function definitions for Matrix3f
+
+inline Vec3f Matrix3f::operator*(const Vec3f &vec) const {
+    return {
+        xCol.x * vec.x + yCol.x * vec.y + zCol.x * vec.z,
+        xCol.y * vec.x + yCol.y * vec.y + zCol.y * vec.z,
+        xCol.z * vec.x + yCol.z * vec.y + zCol.z * vec.z,
+    };
+}
+
+// Inline function definitions for BoundingBox
+
+inline void BoundingBox::expand(const Vec3f &point) {
+    min = { getMin(min.x, point.x), getMin(min.y, point.y), getMin(min.z, point.z) };
+    max = { getMax(max.x, point.x), getMax(max.y, point.y), getMax(max.z, point.z) };
+}
+
+inline void BoundingBox::expand(const BoundingBox &other) {
+    min = { getMin(min.x, other.min.x), getMin(min.y, other.min.y), getMin(min.z, other.min.z) };
+    max = { getMax(max.x, other.max.x), getMax(max.y, other.max.y), getMax(max.z, other.max.z) };
+}
+
+inline Vec3f BoundingBox::getCenter() const {
+    return (min + max) * 0.5f;
+}
+
+inline float BoundingBox::getSurfaceArea() const {
+    if (min.x > max.x || min.y > max.y || min.z > max.z) {
+        return 0.f;
+    }
+    const Vec3f size = max - min;
+    return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+inline int BoundingBox::getLargestAxis() const {
+    const Vec3f size = max - min;
+    if (size.x >= size.y && size.x >= size.z) {
+        return 0;
+    }
+    return (size.y >= size.z) ? 1 : 2;
+}
+
+// Inline global function definitions
+
+constexpr Vec3f crossProduct(const Vec3f &lhs, const Vec3f &rhs) {
+	return {
+		lhs.y * rhs.z - lhs.z * rhs.y,
+		lhs.z * rhs.x - lhs.x * rhs.z,
+		lhs.x * rhs.y - lhs.y * rhs.x,
+	};
+}
+
+constexpr float dotProduct(const Vec2f &lhs, const Vec2f &rhs) {
+	return lhs.x * rhs.x + lhs.y * rhs.y;
+}
+
+constexpr float dotProduct(const Vec3f &lhs, const Vec3f &rhs) {
+	return lhs.x * rhs.x + lhs.y * rhs.y + lhs.z * rhs.z;
+}
+
+inline bool isApprox(float lhs, float rhs, float epsilon) {
+	return fabsf(lhs - rhs) < epsilon;
+}
+
+inline bool isApproxZero(float x, float epsilon) {
+	return fabsf(x) < epsilon;
+}
+
+inline bool rayBoxIntersection(const Ray &ray, const Vec3f &invDirection, const BoundingBox &box, float maxDist) {
+    // Distances along the ray to the two planes of each slab of the box
+    const float tx1 = (box.min.x - ray.origin.x) * invDirection.x;
+    const float tx2 = (box.max.x - ray.origin.x) * invDirection.x;
+    const float ty1 = (box.min.y - ray.origin.y) * invDirection.y;
+    const float ty2 = (box.max.y - ray.origin.y) * invDirection.y;
+    const float tz1 = (box.min.z - ray.origin.z) * invDirection.z;
+    const float tz2 = (box.max.z - ray.origin.z) * invDirection.z;
+    // The ray is inside the box between the furthest entry and the closest exit of the slabs
+    const float tNear = getMax(getMax(getMin(tx1, tx2), getMin(ty1, ty2)), getMax(getMin(tz1, tz2), 0.f));
+    const float tFar = getMin(getMin(getMax(tx1, tx2), getMax(ty1, ty2)), getMin(getMax(tz1, tz2), maxDist));
+    return tNear <= tFar;
+}
+
+inline RayTriangleIntersectionResult rayTriangleIntersection(const Ray &ray, const PrecomputedTriangle &triangle) {
+    // Initialize the result as if there is no intersection
+    RayTriangleIntersectionResult result;
+
+	// Length of the ray projected on the triangle's normal.
+	const float rayProj = dotProduct(ray.direction, triangle.normal);
+	// If the ray is almost perpendicular to the triangle's plane, we don't bother to intersect it
+	if (isApproxZero(rayProj)) {
+		return result;
+	}
+
+	// Distance from the ray origin to the triangle's plane, along the triangle's normal direction
+	const float distToTrPlane = triangle.planeDist - dotProduct(ray.origin, triangle.normal);
+
+	// If the ray projection and the distance to plane have different signs,
+    // then the triangle is behind the ray, so there can be no intersection
+	if (rayProj * distToTrPlane < 0.f) {
+		return result;
+	}
+
+	// The sign determines whether the ray is looking at the front or the back side of the triangle
+	result.frontSide = (rayProj < 0.f);
+
+	// Calculate distance along the ray and the point of intersection
+	result.distAlongRay = distToTrPlane / rayProj;
+	result.point = ray.origin + ray.direction * result.distAlongRay;
+
+	// Check if the point of intersection is on the inner side of all 3 edges
+	result.doesIntersect = (
+		dotProduct(result.point, triangle.edgeNormals[0]) >= triangle.edgeDists[0]
+		&& dotProduct(result.point, triangle.edgeNormals[1]) >= triangle.edgeDists[1]
+		&& dotProduct(result.point, triangle.edgeNormals[2]) >= triangle.edgeDists[2]
+	);
+
+    return result;
+}
+
 } // namespace MathUtils
\ No newline at end of file
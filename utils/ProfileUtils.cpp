@@ -0,0 +1,198 @@
+#include "ProfileUtils.h"
+
+#include "rapidjson/filewritestream.h"
+#include "rapidjson/writer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace ProfileUtils {
+
+/// Maximum number of accumulators
+static const int maxAccumulators = 64;
+
+/// Span of time recorded on some thread
+struct Span {
+	const char *name;
+	long long startNs;
+	long long endNs;
+	int arg;
+};
+
+/// Everything recorded on a single thread.
+/// Only its own thread writes to it, so recording needs no locking.
+struct ThreadRecord {
+	/// Sequential index of the thread, in order of their first recording
+	int threadIdx = 0;
+	/// Spans recorded on the thread
+	std::vector<Span> spans;
+	/// Total time and count of each accumulator on the thread
+	long long accumulatorTimesNs[maxAccumulators] = {};
+	long long accumulatorCounts[maxAccumulators] = {};
+};
+
+/// Records of all threads, and names of all accumulators, guarded by a mutex
+static std::mutex recordsMutex;
+static std::vector<std::unique_ptr<ThreadRecord>> threadRecords;
+static const char *accumulatorNames[maxAccumulators];
+static int accumulatorsCount = 0;
+
+/// Returns the record of the calling thread, creating it on the thread's first call
+static ThreadRecord &getThreadRecord() {
+	thread_local ThreadRecord *threadRecord = nullptr;
+	if (!threadRecord) {
+		std::lock_guard<std::mutex> lock(recordsMutex);
+		threadRecords.emplace_back(new ThreadRecord);
+		threadRecord = threadRecords.back().get();
+		threadRecord->threadIdx = int(threadRecords.size()) - 1;
+	}
+	return *threadRecord;
+}
+
+void recordSpan(const char *name, long long startNs, long long endNs, int arg) {
+	getThreadRecord().spans.push_back({ name, startNs, endNs, arg });
+}
+
+int registerAccumulator(const char *name) {
+	std::lock_guard<std::mutex> lock(recordsMutex);
+	if (accumulatorsCount >= maxAccumulators) {
+		return maxAccumulators - 1;
+	}
+	accumulatorNames[accumulatorsCount] = name;
+	return accumulatorsCount++;
+}
+
+void accumulate(int accumulatorIdx, long long durationNs) {
+	ThreadRecord &threadRecord = getThreadRecord();
+	threadRecord.accumulatorTimesNs[accumulatorIdx] += durationNs;
+	threadRecord.accumulatorCounts[accumulatorIdx]++;
+}
+
+bool writeChromeTrace(const std::string &filepath) {
+	std::lock_guard<std::mutex> lock(recordsMutex);
+	bool hasSpans = false;
+	for (const std::unique_ptr<ThreadRecord> &threadRecord : threadRecords) {
+		hasSpans = hasSpans || !threadRecord->spans.empty();
+	}
+	if (!hasSpans) {
+		return false;
+	}
+
+	FILE *file = fopen(filepath.c_str(), "wb");
+	if (!file) {
+		return false;
+	}
+	char buffer[1 << 16];
+	rapidjson::FileWriteStream stream(file, buffer, sizeof(buffer));
+	rapidjson::Writer<rapidjson::FileWriteStream> writer(stream);
+
+	writer.StartObject();
+	writer.Key("traceEvents");
+	writer.StartArray();
+	for (const std::unique_ptr<ThreadRecord> &threadRecord : threadRecords) {
+		for (const Span &span : threadRecord->spans) {
+			// Complete events, with times in microseconds
+			writer.StartObject();
+			writer.Key("name");
+			writer.String(span.name);
+			writer.Key("ph");
+			writer.String("X");
+			writer.Key("ts");
+			writer.Double(double(span.startNs) / 1000.0);
+			writer.Key("dur");
+			writer.Double(double(span.endNs - span.startNs) / 1000.0);
+			writer.Key("pid");
+			writer.Int(0);
+			writer.Key("tid");
+			writer.Int(threadRecord->threadIdx);
+			if (span.arg >= 0) {
+				writer.Key("args");
+				writer.StartObject();
+				writer.Key("arg");
+				writer.Int(span.arg);
+				writer.EndObject();
+			}
+			writer.EndObject();
+		}
+	}
+	writer.EndArray();
+	writer.Key("displayTimeUnit");
+	writer.String("ms");
+	writer.EndObject();
+	stream.Flush();
+
+	const bool success = !ferror(file);
+	fclose(file);
+	return success;
+}
+
+void printSummary() {
+	std::lock_guard<std::mutex> lock(recordsMutex);
+
+	/// Statistics of all spans with the same name
+	struct SpanStats {
+		long long count = 0;
+		long long totalNs = 0;
+		long long maxNs = 0;
+		/// Time of the first span with the name, used to order the table
+		long long firstStartNs = 0;
+	};
+	std::map<std::string, SpanStats> spanStats;
+	for (const std::unique_ptr<ThreadRecord> &threadRecord : threadRecords) {
+		for (const Span &span : threadRecord->spans) {
+			SpanStats &stats = spanStats[span.name];
+			const long long durationNs = span.endNs - span.startNs;
+			stats.firstStartNs = (stats.count == 0) ? span.startNs : std::min(stats.firstStartNs, span.startNs);
+			stats.count++;
+			stats.totalNs += durationNs;
+			stats.maxNs = std::max(stats.maxNs, durationNs);
+		}
+	}
+	if (spanStats.empty() && accumulatorsCount == 0) {
+		return;
+	}
+
+	// Order spans by the time they first occured, which follows the order of the pipeline
+	std::vector<std::pair<std::string, SpanStats>> orderedStats(spanStats.begin(), spanStats.end());
+	std::sort(orderedStats.begin(), orderedStats.end(), [](const std::pair<std::string, SpanStats> &lhs, const std::pair<std::string, SpanStats> &rhs) {
+		return lhs.second.firstStartNs < rhs.second.firstStartNs;
+	});
+
+	std::cout << std::left << std::setw(48) << "phase"
+		<< std::right << std::setw(10) << "count"
+		<< std::setw(14) << "total ms"
+		<< std::setw(14) << "mean ms"
+		<< std::setw(14) << "max ms" << "\n";
+	std::cout << std::fixed << std::setprecision(3);
+	for (const std::pair<std::string, SpanStats> &nameStats : orderedStats) {
+		const SpanStats &stats = nameStats.second;
+		std::cout << std::left << std::setw(48) << nameStats.first
+			<< std::right << std::setw(10) << stats.count
+			<< std::setw(14) << double(stats.totalNs) / 1e6
+			<< std::setw(14) << double(stats.totalNs) / double(stats.count) / 1e6
+			<< std::setw(14) << double(stats.maxNs) / 1e6 << "\n";
+	}
+	// Accumulators are summed over all threads, so their total can exceed the wall time
+	for (int accIdx = 0; accIdx < accumulatorsCount; accIdx++) {
+		long long count = 0;
+		long long totalNs = 0;
+		for (const std::unique_ptr<ThreadRecord> &threadRecord : threadRecords) {
+			count += threadRecord->accumulatorCounts[accIdx];
+			totalNs += threadRecord->accumulatorTimesNs[accIdx];
+		}
+		std::cout << std::left << std::setw(48) << (std::string(accumulatorNames[accIdx]) + " (all threads)")
+			<< std::right << std::setw(10) << count
+			<< std::setw(14) << double(totalNs) / 1e6
+			<< std::setw(14) << ((count > 0) ? double(totalNs) / double(count) / 1e6 : 0.0)
+			<< std::setw(14) << "-" << "\n";
+	}
+	std::cout << std::defaultfloat;
+}
+
+} // namespace ProfileUtils
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+/// Lightweight instrumentation of the render pipeline.
+/// Scoped timers record spans of time per thread, which can be exported as Chrome trace events
+/// (viewable in chrome://tracing or Perfetto) and summarized in a table.
+/// Scoped accumulators only add up the time and count of very frequent calls per thread,
+/// for which recording a span per call would be too expensive.
+/// All timers are compiled out unless ENABLE_PROFILING is defined.
+namespace ProfileUtils {
+
+/// Returns the time since the start of the program in nanoseconds
+inline long long getTimeNs() {
+	static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+/// Records a span of time on the calling thread
+/// @param[in] name Name of the span, has to be a string literal or otherwise live until the end of the program
+/// @param[in] startNs Start time of the span, as returned by getTimeNs
+/// @param[in] endNs End time of the span, as returned by getTimeNs
+/// @param[in] arg Optional integer argument of the span, like the index of a tile. Negative if not used.
+void recordSpan(const char *name, long long startNs, long long endNs, int arg = -1);
+
+/// Registers a named accumulator. Returns its index.
+/// @param[in] name Name of the accumulator, has to be a string literal or otherwise live until the end of the program
+int registerAccumulator(const char *name);
+
+/// Adds some time to an accumulator of the calling thread and increments its count
+/// @param[in] accumulatorIdx Index of the accumulator, as returned by registerAccumulator
+/// @param[in] durationNs Time to be added
+void accumulate(int accumulatorIdx, long long durationNs);
+
+/// Writes all recorded spans to a file as Chrome trace events JSON.
+/// Does nothing if no spans were recorded.
+/// @param[in] filepath Path to the output file
+/// @return True if the file was written
+bool writeChromeTrace(const std::string &filepath);
+
+/// Prints a table with the count and the total, mean and max time of the spans of each name,
+/// and the count and total time of each accumulator, to the standard output.
+/// Does nothing if nothing was recorded.
+void printSummary();
+
+/// Timer recording a span from its creation until its destruction
+struct ScopedTimer {
+	/// Starts the timer
+	ScopedTimer(const char *name, int arg = -1)
+		: name(name), arg(arg), startNs(getTimeNs())
+	{}
+
+	/// Stops the timer and records the span
+	~ScopedTimer() {
+		recordSpan(name, startNs, getTimeNs(), arg);
+	}
+
+	const char *name;
+	int arg;
+	long long startNs;
+};
+
+/// Timer adding the time from its creation until its destruction to an accumulator
+struct ScopedAccumulator {
+	/// Starts the timer
+	ScopedAccumulator(int accumulatorIdx)
+		: accumulatorIdx(accumulatorIdx), startNs(getTimeNs())
+	{}
+
+	/// Stops the timer and adds the time to the accumulator
+	~ScopedAccumulator() {
+		accumulate(accumulatorIdx, getTimeNs() - startNs);
+	}
+
+	int accumulatorIdx;
+	long long startNs;
+};
+
+} // namespace ProfileUtils
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+
+#ifdef ENABLE_PROFILING
+/// Records a span from this line until the end of the enclosing scope
+#define PROFILE_SCOPE(name) ProfileUtils::ScopedTimer PROFILE_CONCAT(profileTimer, __LINE__)(name)
+/// Records a span with an integer argument from this line until the end of the enclosing scope
+#define PROFILE_SCOPE_ARG(name, arg) ProfileUtils::ScopedTimer PROFILE_CONCAT(profileTimer, __LINE__)(name, arg)
+/// Adds the time from this line until the end of the enclosing scope to a named accumulator
+#define PROFILE_ACCUMULATE(name) \
+	static const int PROFILE_CONCAT(profileAccumulatorIdx, __LINE__) = ProfileUtils::registerAccumulator(name); \
+	ProfileUtils::ScopedAccumulator PROFILE_CONCAT(profileAccumulator, __LINE__)(PROFILE_CONCAT(profileAccumulatorIdx, __LINE__))
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_SCOPE_ARG(name, arg)
+#define PROFILE_ACCUMULATE(name)
+#endif
@@ -0,0 +1,214 @@
+#pragma once
+
+#include "MathUtils.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace SimdUtils {
+
+/// Vector of 3 float coordinates, or a color, kept in the first 3 lanes of a 4-wide SSE register.
+/// The 4th lane is always 0, so that it doesn't affect dot products and lengths.
+/// Additions, subtractions and scaling are a single instruction, but dot and cross products need shuffles,
+/// so it pays off only for code which keeps its vectors in registers for long.
+/// Falls back to plain floats where SSE2 isn't available.
+struct Vec3fSimd {
+	/// Creates a zero vector
+	Vec3fSimd()
+#ifdef __SSE2__
+		: data(_mm_setzero_ps())
+#endif
+	{}
+
+	/// Creates a vector from a plain vector
+	Vec3fSimd(const MathUtils::Vec3f &vec)
+#ifdef __SSE2__
+		: data(_mm_set_ps(0.f, vec.z, vec.y, vec.x))
+#else
+		: data(vec)
+#endif
+	{}
+
+#ifdef __SSE2__
+	/// Creates a vector from a register, its 4th lane is expected to be 0
+	explicit Vec3fSimd(__m128 data)
+		: data(data)
+	{}
+#endif
+
+	/// Returns the vector as a plain vector
+	MathUtils::Vec3f toVec3f() const {
+#ifdef __SSE2__
+		alignas(16) float coords[4];
+		_mm_store_ps(coords, data);
+		return { coords[0], coords[1], coords[2] };
+#else
+		return data;
+#endif
+	}
+
+#ifdef __SSE2__
+	/// X, Y, Z and 0 in the lanes of the register
+	__m128 data;
+#else
+	MathUtils::Vec3f data;
+#endif
+};
+
+#ifdef __SSE2__
+
+/// Returns the sum of 2 vectors
+inline Vec3fSimd operator+(const Vec3fSimd &lhs, const Vec3fSimd &rhs) {
+	return Vec3fSimd(_mm_add_ps(lhs.data, rhs.data));
+}
+
+/// Returns the difference of 2 vectors
+inline Vec3fSimd operator-(const Vec3fSimd &lhs, const Vec3fSimd &rhs) {
+	return Vec3fSimd(_mm_sub_ps(lhs.data, rhs.data));
+}
+
+/// Returns the result of scaling a vector by a number
+inline Vec3fSimd operator*(const Vec3fSimd &vec, float scalar) {
+	return Vec3fSimd(_mm_mul_ps(vec.data, _mm_set1_ps(scalar)));
+}
+
+/// Returns the per-coordinate product of 2 vectors, used for colors
+inline Vec3fSimd operator*(const Vec3fSimd &lhs, const Vec3fSimd &rhs) {
+	return Vec3fSimd(_mm_mul_ps(lhs.data, rhs.data));
+}
+
+/// Returns the per-coordinate minimum of 2 vectors
+inline Vec3fSimd getMin(const Vec3fSimd &lhs, const Vec3fSimd &rhs) {
+	return Vec3fSimd(_mm_min_ps(lhs.data, rhs.data));
+}
+
+/// Returns the per-coordinate maximum of 2 vectors
+inline Vec3fSimd getMax(const Vec3fSimd &lhs, const Vec3fSimd &rhs) {
+	return Vec3fSimd(_mm_max_ps(lhs.data, rhs.data));
+}
+
+/// Computes the dot product of 2 vectors
+inline float dotProduct(const Vec3fSimd &lhs, const Vec3fSimd &rhs) {
+	// Sum the lanes of the product, the 4th one is 0
+	const __m128 product = _mm_mul_ps(lhs.data, rhs.data);
+	const __m128 pairs = _mm_add_ps(product, _mm_movehl_ps(product, product));
+	return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, _MM_SHUFFLE(1, 1, 1, 1))));
+}
+
+/// Computes the cross product of 2 vectors
+inline Vec3fSimd crossProduct(const Vec3fSimd &lhs, const Vec3fSimd &rhs) {
+	// lhs.yzx * rhs.zxy - lhs.zxy * rhs.yzx, computed as (lhs * rhs.yzx - lhs.yzx * rhs).yzx
+	const __m128 lhsYzx = _mm_shuffle_ps(lhs.data, lhs.data, _MM_SHUFFLE(3, 0, 2, 1));
+	const __m128 rhsYzx = _mm_shuffle_ps(rhs.data, rhs.data, _MM_SHUFFLE(3, 0, 2, 1));
+	const __m128 result = _mm_sub_ps(_mm_mul_ps(lhs.data, rhsYzx), _mm_mul_ps(lhsYzx, rhs.data));
+	return Vec3fSimd(_mm_shuffle_ps(result, result, _MM_SHUFFLE(3, 0, 2, 1)));
+}
+
+#else
+
+inline Vec3fSimd operator+(const Vec3fSimd &lhs, const Vec3fSimd &rhs) {
+	return lhs.data + rhs.data;
+}
+
+inline Vec3fSimd operator-(const Vec3fSimd &lhs, const Vec3fSimd &rhs) {
+	return lhs.data - rhs.data;
+}
+
+inline Vec3fSimd operator*(const Vec3fSimd &vec, float scalar) {
+	return vec.data * scalar;
+}
+
+inline Vec3fSimd operator*(const Vec3fSimd &lhs, const Vec3fSimd &rhs) {
+	return MathUtils::Vec3f(lhs.data.x * rhs.data.x, lhs.data.y * rhs.data.y, lhs.data.z * rhs.data.z);
+}
+
+inline Vec3fSimd getMin(const Vec3fSimd &lhs, const Vec3fSimd &rhs) {
+	return MathUtils::Vec3f(
+		MathUtils::getMin(lhs.data.x, rhs.data.x),
+		MathUtils::getMin(lhs.data.y, rhs.data.y),
+		MathUtils::getMin(lhs.data.z, rhs.data.z)
+	);
+}
+
+inline Vec3fSimd getMax(const Vec3fSimd &lhs, const Vec3fSimd &rhs) {
+	return MathUtils::Vec3f(
+		MathUtils::getMax(lhs.data.x, rhs.data.x),
+		MathUtils::getMax(lhs.data.y, rhs.data.y),
+		MathUtils::getMax(lhs.data.z, rhs.data.z)
+	);
+}
+
+inline float dotProduct(const Vec3fSimd &lhs, const Vec3fSimd &rhs) {
+	return MathUtils::dotProduct(lhs.data, rhs.data);
+}
+
+inline Vec3fSimd crossProduct(const Vec3fSimd &lhs, const Vec3fSimd &rhs) {
+	return MathUtils::crossProduct(lhs.data, rhs.data);
+}
+
+#endif
+
+/// Ray with its origin and direction kept in SSE registers
+struct RaySimd {
+	RaySimd(const MathUtils::Ray &ray)
+		: origin(ray.origin), direction(ray.direction)
+	{}
+
+	Vec3fSimd origin;
+	Vec3fSimd direction;
+};
+
+/// Precomputed triangle with its vectors kept in SSE registers, see MathUtils::PrecomputedTriangle
+struct PrecomputedTriangleSimd {
+	PrecomputedTriangleSimd(){}
+
+	PrecomputedTriangleSimd(const MathUtils::PrecomputedTriangle &triangle)
+		: normal(triangle.normal)
+		, planeDist(triangle.planeDist)
+		, edgeNormals{ triangle.edgeNormals[0], triangle.edgeNormals[1], triangle.edgeNormals[2] }
+		, edgeDists{ triangle.edgeDists[0], triangle.edgeDists[1], triangle.edgeDists[2] }
+	{}
+
+	Vec3fSimd normal;
+	float planeDist = 0.f;
+	Vec3fSimd edgeNormals[3];
+	float edgeDists[3] = { 0.f, 0.f, 0.f };
+};
+
+/// Intersects a ray with a precomputed triangle, with the same steps as MathUtils::rayTriangleIntersection.
+/// Finds the same intersections, but leaves the point unset when there is none.
+/// @param[in] ray The ray to intersect with
+/// @param[in] triangle The precomputed triangle to be intersected
+/// @return The result of the ray triangle intersection
+inline MathUtils::RayTriangleIntersectionResult rayTriangleIntersection(const RaySimd &ray, const PrecomputedTriangleSimd &triangle) {
+	MathUtils::RayTriangleIntersectionResult result;
+
+	const float rayProj = dotProduct(ray.direction, triangle.normal);
+	if (MathUtils::isApproxZero(rayProj)) {
+		return result;
+	}
+
+	const float distToTrPlane = triangle.planeDist - dotProduct(ray.origin, triangle.normal);
+	if (rayProj * distToTrPlane < 0.f) {
+		return result;
+	}
+
+	result.frontSide = (rayProj < 0.f);
+	result.distAlongRay = distToTrPlane / rayProj;
+	const Vec3fSimd point = ray.origin + ray.direction * result.distAlongRay;
+
+	result.doesIntersect = (
+		dotProduct(point, triangle.edgeNormals[0]) >= triangle.edgeDists[0]
+		&& dotProduct(point, triangle.edgeNormals[1]) >= triangle.edgeDists[1]
+		&& dotProduct(point, triangle.edgeNormals[2]) >= triangle.edgeDists[2]
+	);
+	// Only convert the point back for hits, the conversion goes through memory
+	if (result.doesIntersect) {
+		result.point = point.toVec3f();
+	}
+
+	return result;
+}
+
+} // namespace SimdUtils
\ No newline at end of file